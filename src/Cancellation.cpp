@@ -0,0 +1,83 @@
+//                        Caide C++ inliner
+//
+// This file is distributed under the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version. See LICENSE.TXT for details.
+
+#include "Cancellation.h"
+
+#include <clang/Basic/Diagnostic.h>
+
+
+namespace caide {
+namespace internal {
+
+static const unsigned POLLS_PER_CLOCK_CHECK = 64;
+
+Cancellation::Cancellation(const CancellationToken* token_, std::chrono::milliseconds timeout)
+    : token(token_)
+    , hasDeadline(timeout.count() > 0)
+    , deadline(hasDeadline ? Clock::now() + timeout : Clock::time_point())
+{}
+
+Cancellation Cancellation::withBudget(std::chrono::milliseconds time, std::size_t memoryBytes) const {
+    Cancellation res = *this;
+    res.hasBudgetDeadline = time.count() > 0;
+    if (res.hasBudgetDeadline)
+        res.budgetDeadline = Clock::now() + time;
+    res.memoryBudget = memoryBytes;
+    return res;
+}
+
+bool Cancellation::isRequested() const {
+    return isRequested(pollsUntilClockCheck-- == 0);
+}
+
+bool Cancellation::isRequested(bool checkClock) const {
+    if (reason != Reason::None)
+        return true;
+    if (token && token->isCancelled()) {
+        reason = Reason::Cancelled;
+    } else if ((hasDeadline || hasBudgetDeadline) && checkClock) {
+        pollsUntilClockCheck = POLLS_PER_CLOCK_CHECK;
+        const Clock::time_point now = Clock::now();
+        if (hasDeadline && now >= deadline)
+            reason = Reason::TimedOut;
+        else if (hasBudgetDeadline && now >= budgetDeadline)
+            reason = Reason::BudgetExceeded;
+    }
+    return reason != Reason::None;
+}
+
+void Cancellation::reportMemoryUsage(std::size_t bytes) const {
+    if (reason == Reason::None && memoryBudget != 0 && bytes > memoryBudget)
+        reason = Reason::BudgetExceeded;
+}
+
+void Cancellation::check() const {
+    if (!isRequested())
+        return;
+    switch (reason) {
+    case Reason::Cancelled:
+        throw InliningCancelled("Inlining has been cancelled");
+    case Reason::TimedOut:
+        throw InliningCancelled("Inlining has timed out");
+    default:
+        throw BudgetExceeded("Optimizer has exceeded its budget");
+    }
+}
+
+bool Cancellation::stopCompilationIfRequested(clang::DiagnosticsEngine& diagnostics) const {
+    if (!isRequested(/*checkClock=*/true))
+        return false;
+    if (!diagnostics.hasFatalErrorOccurred()) {
+        const unsigned id = diagnostics.getCustomDiagID(clang::DiagnosticsEngine::Fatal,
+            "caide inliner: operation cancelled");
+        diagnostics.Report(id);
+    }
+    return true;
+}
+
+}
+}
+
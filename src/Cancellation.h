@@ -0,0 +1,77 @@
+//                        Caide C++ inliner
+//
+// This file is distributed under the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version. See LICENSE.TXT for details.
+
+#pragma once
+
+#include "caideInliner.hpp"
+
+#include <chrono>
+#include <cstddef>
+#include <stdexcept>
+
+namespace clang {
+    class DiagnosticsEngine;
+}
+
+namespace caide {
+namespace internal {
+
+// Thrown when the optimizer exceeds its budget (CppInliner::optimizerTimeBudget and
+// CppInliner::optimizerMemoryBudget). Unlike InliningCancelled, it is handled internally.
+class BudgetExceeded: public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
+
+// Cancellation of one CppInliner call: the user's token and the deadline, and optionally the
+// budget of one stage. A default constructed object is never cancelled.
+class Cancellation {
+public:
+    Cancellation() = default;
+    Cancellation(const CancellationToken* token, std::chrono::milliseconds timeout);
+
+    // Returns a copy that is also cancelled when the given time (counting from now) or memory
+    // is exceeded. Zero means no limit.
+    Cancellation withBudget(std::chrono::milliseconds time, std::size_t memoryBytes) const;
+
+    // Cheap enough to be called for every declaration: the clock is polled only once in a while.
+    // Once it returns true, it always returns true.
+    bool isRequested() const;
+
+    bool hasMemoryBudget() const { return memoryBudget != 0; }
+
+    // Requests cancellation if memory usage exceeds the budget.
+    void reportMemoryUsage(std::size_t bytes) const;
+
+    // Throws InliningCancelled or BudgetExceeded if cancellation has been requested.
+    void check() const;
+
+    // Stops compilation by reporting a fatal error, if cancellation has been requested. Clang
+    // skips remaining includes and template instantiations after a fatal error. Called for
+    // every file, top-level declaration or instantiation, so the clock is always checked.
+    bool stopCompilationIfRequested(clang::DiagnosticsEngine& diagnostics) const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    enum class Reason { None, Cancelled, TimedOut, BudgetExceeded };
+
+    const CancellationToken* token = nullptr;
+    bool hasDeadline = false;
+    Clock::time_point deadline;
+    bool hasBudgetDeadline = false;
+    Clock::time_point budgetDeadline;
+    std::size_t memoryBudget = 0;
+
+    mutable Reason reason = Reason::None;
+    mutable unsigned pollsUntilClockCheck = 0;
+
+    bool isRequested(bool checkClock) const;
+};
+
+}
+}
+
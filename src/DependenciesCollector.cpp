@@ -5,10 +5,14 @@
 // option) any later version. See LICENSE.TXT for details.
 
 #include "DependenciesCollector.h"
+#include "caideInliner.hpp"
+#include "Cancellation.h"
+#include "DependencySummaryCache.h"
 #include "clang_compat.h"
 #include "clang_version.h"
 #include "sema_utils.h"
 #include "SourceInfo.h"
+#include "TemplateCosts.h"
 #include "util.h"
 
 // #define CAIDE_DEBUG_MODE
@@ -29,6 +33,22 @@ namespace caide {
 namespace internal {
 
 bool DependenciesCollector::TraverseDecl(Decl* decl) {
+    if (!decl)
+        return true;
+    if (cancellation.isRequested())
+        return false;
+    // Implicit instantiations are separate nodes of the graph; they are traversed when reached.
+    if (isInstantiationOfCurrentTemplate(decl))
+        return true;
+    if (!traversed.insert(decl).second)
+        return true;
+    if (summaryCache && declStack.empty() && replaySummary(decl))
+        return true;
+    ++stats.declsVisited;
+    if (summaryCache)
+        summaryCache->addTraversedDecl(decl);
+
+    TemplateCostScope templateCostScope(templateCosts.get(), decl);
     declStack.push(decl);
     bool ret = RecursiveASTVisitor<DependenciesCollector>::TraverseDecl(decl);
     declStack.pop();
@@ -36,6 +56,9 @@ bool DependenciesCollector::TraverseDecl(Decl* decl) {
 }
 
 void DependenciesCollector::traverseSugaredSignature(const SugaredSignature& sig, bool traverseTypeLocs) {
+    const char* previousContext = referenceContext;
+    referenceContext = "traverseSugaredSignature";
+
     for (const TemplateArgumentLoc& argLoc : sig.templateArgLocs)
         TraverseTemplateArgumentLoc(argLoc);
 
@@ -49,6 +72,8 @@ void DependenciesCollector::traverseSugaredSignature(const SugaredSignature& sig
 
     for (Expr* expr : sig.associatedConstraints)
         TraverseStmt(expr);
+
+    referenceContext = previousContext;
 }
 
 void DependenciesCollector::traverseTemplateSpecializationTypeImpl(
@@ -76,11 +101,12 @@ void DependenciesCollector::traverseTemplateSpecializationTypeImpl(
     }
 
     if (tempDecl) {
+        TemplateCostScope templateCostScope(templateCosts.get(), tempDecl);
         // These will be arguments as written at the point from where the
         // reference comes (e.g. a variable declaration).
         llvm::ArrayRef<TemplateArgument> writtenArgs{
             getArgs(*tempSpecType), getNumArgs(*tempSpecType)};
-        SugaredSignature sig = substituteTemplateArguments(sema, tempDecl, writtenArgs, args);
+        const SugaredSignature& sig = substitutionCache.substitute(tempDecl, writtenArgs, args);
         traverseSugaredSignature(sig, traverseTypeLocs);
     }
 }
@@ -111,10 +137,11 @@ bool DependenciesCollector::TraverseAutoType(AutoType* autoType) {
         // XXX: We might need this in stdlib for transitive dependencies, but
         // substituteTemplateArguments takes too long.
         if (sourceManager.isInMainFile(getBeginLoc(conceptDecl))) {
+            TemplateCostScope templateCostScope(templateCosts.get(), conceptDecl);
             llvm::SmallVector<TemplateArgument, 4> writtenArgs;
             writtenArgs.push_back(TemplateArgument(autoType->getDeducedType()));
             writtenArgs.append(autoType->getTypeConstraintArguments().begin(), autoType->getTypeConstraintArguments().end());
-            SugaredSignature sig = substituteTemplateArguments(sema, conceptDecl, writtenArgs, {});
+            const SugaredSignature& sig = substitutionCache.substitute(conceptDecl, writtenArgs, {});
             traverseSugaredSignature(sig, /*traverseTypeLocs=*/false);
         }
     }
@@ -148,6 +175,33 @@ Decl* DependenciesCollector::getParentDecl(Decl* decl) const {
     return dyn_cast_or_null<Decl>(decl->getLexicalDeclContext());
 }
 
+// Returns the declaration from which decl was instantiated, if clang records such a link
+// for declarations of this kind.
+static Decl* getInstantiationPattern(Decl* decl) {
+    if (auto* partialSpec = dyn_cast<ClassTemplatePartialSpecializationDecl>(decl))
+        return partialSpec->getInstantiatedFromMember();
+    if (auto* recordDecl = dyn_cast<CXXRecordDecl>(decl))
+        return recordDecl->getTemplateInstantiationPattern();
+    if (auto* f = dyn_cast<FunctionDecl>(decl))
+        return f->getTemplateInstantiationPattern();
+    if (auto* varDecl = dyn_cast<VarDecl>(decl))
+        return varDecl->getTemplateInstantiationPattern();
+    if (auto* enumDecl = dyn_cast<EnumDecl>(decl))
+        return enumDecl->getInstantiatedFromMemberEnum();
+    if (auto* templateDecl = dyn_cast<RedeclarableTemplateDecl>(decl))
+        return templateDecl->getInstantiatedFromMemberTemplate();
+    if (auto* usingShadow = dyn_cast<UsingShadowDecl>(decl))
+        return decl->getASTContext().getInstantiatedFromUsingShadowDecl(usingShadow);
+    if (auto* usingDecl = dyn_cast<UsingDecl>(decl))
+        return decl->getASTContext().getInstantiatedFromUsingDecl(usingDecl);
+    return nullptr;
+}
+
+static std::pair<unsigned, unsigned> makeKey(Decl* decl) {
+    return std::make_pair(decl->getLocation().getRawEncoding(),
+                          static_cast<unsigned>(decl->getKind()));
+}
+
 // A declaration in a templated context (such as a method or a field of a class template) is present
 // as multiple instances in the AST: once for the template itself and once for each *implicit*
 // instantiation. Clearly, it doesn't make sense to 'remove' a Decl coming from an implicit
@@ -156,25 +210,113 @@ Decl* DependenciesCollector::getParentDecl(Decl* decl) const {
 // We, therefore, need to add a dependency from each Decl that comes from an implicit instantiation to
 // the one Decl that comes from the template itself; then if the one Decl is unreachable
 // we remove it.
-Decl* DependenciesCollector::getCorrespondingDeclInNonInstantiatedContext(clang::Decl* semanticDecl) const {
-    // The implementation is HACKY. It relies on the assumption that a Decl inside an implicit
-    // instantiation and the corresponding Decl in the non-instantiated context have the same
-    // source range.
-    auto key = SourceInfo::makeKey(semanticDecl);
-    auto it = srcInfo.nonImplicitDecls.find(key);
-    if (it != srcInfo.nonImplicitDecls.end())
-        return it->second;
-    return nullptr;
+Decl* DependenciesCollector::getCorrespondingDeclInNonInstantiatedContext(Decl* decl) {
+    if (Decl* pattern = getInstantiationPattern(decl)) {
+        // Members of nested templates are instantiated from members of partially instantiated
+        // templates; follow the chain up to the declaration written in the source.
+        while (Decl* next = getInstantiationPattern(pattern)) {
+            if (next == pattern)
+                break;
+            pattern = next;
+        }
+        return pattern;
+    }
+
+    // Declarations without a direct link (fields, typedefs, local variables etc.) are found among
+    // the declarations of the pattern of the enclosing context. They are assumed to have the same
+    // location and kind as the declaration in the instantiation.
+    Decl* parent = getParentDecl(decl);
+    if (!parent || isa<TranslationUnitDecl>(parent) || isa<NamespaceDecl>(parent)
+            || isa<LinkageSpecDecl>(parent))
+        return nullptr;
+
+    auto* patternContext = dyn_cast_or_null<DeclContext>(
+        getCorrespondingDeclInNonInstantiatedContext(parent));
+    if (!patternContext)
+        return nullptr;
+
+    auto inserted = patternContexts.try_emplace(patternContext);
+    LexicalDeclIndex& index = inserted.first->second;
+    if (inserted.second) {
+        for (Decl* child : patternContext->decls()) {
+            if (!child->isImplicit())
+                index.try_emplace(makeKey(child), child);
+        }
+    }
+
+    auto it = index.find(makeKey(decl));
+    return it == index.end() ? nullptr : it->second;
+}
+
+// Only declarations from the main file may be removed; other declarations matter only if they
+// may lead to the main file. Code in system headers that doesn't come from a template instantiation
+// can't refer to declarations in the main file, so such declarations are not added to the graph.
+// Namespaces are relevant, as 'using namespace' directives depend on them; see insertEdge for
+// namespaces of system declarations.
+bool DependenciesCollector::isRelevant(Decl* canonicalDecl) {
+    auto cached = relevance.find(canonicalDecl);
+    if (cached != relevance.end())
+        return cached->second;
+
+    bool res = isa<TranslationUnitDecl>(canonicalDecl) || isa<NamespaceDecl>(canonicalDecl)
+        || isa<LinkageSpecDecl>(canonicalDecl);
+
+    for (Decl* redecl : canonicalDecl->redecls()) {
+        if (res)
+            break;
+        res = sourceManager.isInMainFile(getBeginLoc(redecl));
+    }
+
+    for (const Decl* decl = canonicalDecl; decl && !res;
+            decl = dyn_cast_or_null<Decl>(decl->getDeclContext()))
+    {
+        if (isa<NamespaceDecl>(decl) || isa<TranslationUnitDecl>(decl))
+            break;
+        res = isInstantiated(decl);
+    }
+
+    relevance[canonicalDecl] = res;
+    return res;
 }
 
 void DependenciesCollector::insertReference(Decl* from, Decl* to) {
+    if (summaryCache && !declStack.empty())
+        summaryCache->addReference(declStack.top(), from, to);
+    const ReferenceResult result = insertEdge(from, to);
+    if (edgeProvenance)
+        edgeProvenance->addReference(referenceContext, referenceSource, from, to, result);
+}
+
+ReferenceResult DependenciesCollector::insertEdge(Decl*& from, Decl*& to) {
     if (!from || !to)
-        return;
+        return ReferenceResult::Ignored;
     from = from->getCanonicalDecl();
     to = to->getCanonicalDecl();
-    if (from == to)
-        return;
-    srcInfo.uses[from].insert(to);
+    if (from == to || !isRelevant(from))
+        return ReferenceResult::Ignored;
+    if (!isRelevant(to)) {
+        if (sourceManager.isInMainFile(getBeginLoc(from))) {
+            srcInfo.usedSystemDecls.insert(from, to);
+            // The edge from 'to' to its namespace is not added, but a 'using namespace'
+            // directive may be needed to refer to 'to'.
+            for (DeclContext* ctx = to->getDeclContext(); ctx; ctx = ctx->getParent()) {
+                if (isa<NamespaceDecl>(ctx)) {
+                    Decl* user = from;
+                    Decl* ns = cast<NamespaceDecl>(ctx);
+                    insertEdge(user, ns);
+                }
+            }
+        }
+        return ReferenceResult::Ignored;
+    }
+    const bool isNew = srcInfo.uses.insert(from, to);
+    if (isNew) {
+        ++stats.graphEdges;
+        if (templateCosts)
+            templateCosts->addEdge();
+        if (used.count(from) != 0)
+            queue.push_back(to);
+    }
     dbg("Reference   FROM    " << from->getDeclKindName() << " " << from
         << "<" << toString(sourceManager, from).substr(0, 20) << ">"
         << toString(sourceManager, from->getSourceRange())
@@ -182,9 +324,14 @@ void DependenciesCollector::insertReference(Decl* from, Decl* to) {
         << "<" << toString(sourceManager, to).substr(0, 20) << ">"
         << toString(sourceManager, to->getSourceRange())
         << std::endl);
+    return isNew ? ReferenceResult::NewEdge : ReferenceResult::DuplicateEdge;
 }
 
 bool DependenciesCollector::VisitType(Type* T) {
+    ReferenceSource source(*this, "VisitType");
+    ++stats.astNodesVisited;
+    if (templateCosts)
+        templateCosts->addNode();
 #ifdef CAIDE_DEBUG_MODE
     dbg("VisitType " << T->getTypeClassName()
         << " " << QualType(T, 0).getAsString() << std::endl);
@@ -195,11 +342,13 @@ bool DependenciesCollector::VisitType(Type* T) {
 }
 
 bool DependenciesCollector::VisitTypedefType(TypedefType* typedefType) {
+    ReferenceSource source(*this, "VisitTypedefType");
     insertReference(getCurrentDecl(), typedefType->getDecl());
     return true;
 }
 
 bool DependenciesCollector::VisitTemplateSpecializationType(TemplateSpecializationType* tempSpecType) {
+    ReferenceSource source(*this, "VisitTemplateSpecializationType");
     TemplateName templateName = tempSpecType->getTemplateName();
     insertReference(getCurrentDecl(), templateName.getAsTemplateDecl());
     return true;
@@ -207,6 +356,7 @@ bool DependenciesCollector::VisitTemplateSpecializationType(TemplateSpecializati
 
 #if CAIDE_CLANG_VERSION_AT_LEAST(10,0)
 bool DependenciesCollector::VisitAutoType(AutoType* autoType) {
+    ReferenceSource source(*this, "VisitAutoType");
     insertReference(getCurrentDecl(), autoType->getTypeConstraintConcept());
     return true;
 }
@@ -214,13 +364,24 @@ bool DependenciesCollector::VisitAutoType(AutoType* autoType) {
 
 DependenciesCollector::DependenciesCollector(SourceManager& srcMgr,
         Sema& sema_,
-        const std::unordered_set<std::string>& identifiersToKeep_,
-        SourceInfo& srcInfo_)
+        SourceInfo& srcInfo_,
+        DeclSet& usedDecls,
+        Stats& stats_,
+        const Cancellation& cancellation_,
+        DependencySummaryCache* summaryCache_)
     : sourceManager(srcMgr)
     , sema(sema_)
-    , identifiersToKeep(identifiersToKeep_)
     , srcInfo(srcInfo_)
+    , used(usedDecls)
+    , stats(stats_)
+    , cancellation(cancellation_)
+    , summaryCache(summaryCache_)
+    , substitutionCache(sema_, stats_)
 {
+    if (TemplateCosts* costs = TemplateCosts::current())
+        templateCosts.reset(new TemplateCostTracker(*costs, srcMgr));
+    if (EdgeProvenance* provenance = EdgeProvenance::current())
+        edgeProvenance.reset(new EdgeProvenanceTracker(*provenance, used));
 }
 
 bool DependenciesCollector::shouldVisitImplicitCode() const { return true; }
@@ -228,6 +389,10 @@ bool DependenciesCollector::shouldVisitTemplateInstantiations() const { return t
 bool DependenciesCollector::shouldWalkTypesOfTypeLocs() const { return true; }
 
 bool DependenciesCollector::VisitDecl(Decl* decl) {
+    ReferenceSource source(*this, "VisitDecl");
+    ++stats.astNodesVisited;
+    if (templateCosts)
+        templateCosts->addNode();
     dbg("DECL " << decl->getDeclKindName() << " " << decl
         << "<" << toString(sourceManager, decl).substr(0, 30) << ">"
         << toString(sourceManager, getExpansionRange(sourceManager, decl))
@@ -245,62 +410,6 @@ bool DependenciesCollector::VisitDecl(Decl* decl) {
     // declaration in a non-instantiated context.
     insertReference(decl, getCorrespondingDeclInNonInstantiatedContext(decl));
 
-    // Remainder of the function processes special comments.
-    RawComment* comment = decl->getASTContext().getRawCommentForDeclNoCache(decl);
-    if (!comment)
-        return true;
-
-    bool invalid = false;
-    const char* beg = sourceManager.getCharacterData(getBeginLoc(comment), &invalid);
-    if (!beg || invalid)
-        return true;
-
-    const char* end =
-        sourceManager.getCharacterData(getEndLoc(comment), &invalid);
-    if (!end || invalid)
-        return true;
-
-    StringRef haystack(beg, end - beg + 1);
-
-    {
-        static const std::string caideKeepComment = "caide keep";
-        StringRef needle(caideKeepComment);
-        dbg(toString(sourceManager, decl) << ": " << haystack.str() << std::endl);
-        if (haystack.find(needle) != StringRef::npos)
-            srcInfo.declsToKeep.insert(decl);
-    }
-
-    if (ctx) {
-        // The following is useful for classes implementing a standard C++ concept.
-        // For instance, a custom iterator passed to std::shuffle must be a RandomAccessIterator,
-        // which means that it must provide certain member functions/type aliases.
-        // However, there is no way to detect this requirement, unless both the language and
-        // the standard library have full concept support (which we don't want to rely on).
-        // That's because some of the functions/type aliases required by the concept might
-        // not actually be used by a particular implementation of std::shuffle. If we remove
-        // them, the program becomes technically illegal and may not even compile in another
-        // compiler.
-        //
-        // To work around that, it's possible to mark declarations required by some Concept
-        // with a comment '/// caide concept'. This will ensure that these declarations don't
-        // get removed as long as the class containing them is used.
-        static const std::string caideConceptComment = "caide concept";
-        StringRef needle(caideConceptComment);
-        dbg(toString(sourceManager, decl) << ": " << haystack.str() << std::endl);
-        if (haystack.find(needle) != StringRef::npos)
-            insertReference(ctx, decl);
-    }
-
-    return true;
-}
-
-bool DependenciesCollector::VisitNamedDecl(clang::NamedDecl* decl) {
-    if (!sourceManager.isInMainFile(getBeginLoc(decl)))
-        return true;
-
-    if (identifiersToKeep.count(decl->getQualifiedNameAsString()))
-        srcInfo.declsToKeep.insert(decl);
-
     return true;
 }
 
@@ -342,12 +451,14 @@ bool DependenciesCollector::TraverseCallExpr(CallExpr* callExpr) {
     llvm::ArrayRef<TemplateArgument> args = specInfo->TemplateArguments->asArray();
 
     FunctionTemplateDecl* ftemplate = specInfo->getTemplate();
-    SugaredSignature sig = substituteTemplateArguments(sema, ftemplate, writtenArgs, args);
+    TemplateCostScope templateCostScope(templateCosts.get(), ftemplate);
+    const SugaredSignature& sig = substitutionCache.substitute(ftemplate, writtenArgs, args);
     traverseSugaredSignature(sig);
     return true;
 }
 
 bool DependenciesCollector::VisitCallExpr(CallExpr* callExpr) {
+    ReferenceSource source(*this, "VisitCallExpr");
     Expr* callee = callExpr->getCallee();
     Decl* calleeDecl = callExpr->getCalleeDecl();
 
@@ -360,6 +471,7 @@ bool DependenciesCollector::VisitCallExpr(CallExpr* callExpr) {
 }
 
 bool DependenciesCollector::VisitCXXConstructExpr(CXXConstructExpr* constructorExpr) {
+    ReferenceSource source(*this, "VisitCXXConstructExpr");
     insertReference(getCurrentDecl(), constructorExpr->getConstructor());
     return true;
 }
@@ -374,23 +486,26 @@ bool DependenciesCollector::TraverseConceptSpecializationExpr(ConceptSpecializat
         return true;
 
     ConceptDecl* conceptDecl = conceptExpr->getNamedConcept();
+    TemplateCostScope templateCostScope(templateCosts.get(), conceptDecl);
     const ASTTemplateArgumentListInfo* argsInfo = conceptExpr->getTemplateArgsAsWritten();
     llvm::SmallVector<TemplateArgument, 4> writtenArgs;
     for (auto argLoc : argsInfo->arguments())
         writtenArgs.push_back(argLoc.getArgument());
 
-    SugaredSignature sig = substituteTemplateArguments(sema, conceptDecl, writtenArgs, {});
+    const SugaredSignature& sig = substitutionCache.substitute(conceptDecl, writtenArgs, {});
     traverseSugaredSignature(sig);
     return true;
 }
 
 bool DependenciesCollector::VisitConceptSpecializationExpr(ConceptSpecializationExpr* conceptExpr) {
+    ReferenceSource source(*this, "VisitConceptSpecializationExpr");
     insertReference(getCurrentDecl(), conceptExpr->getNamedConcept());
     return true;
 }
 #endif
 
 bool DependenciesCollector::VisitCXXConstructorDecl(CXXConstructorDecl* ctorDecl) {
+    ReferenceSource source(*this, "VisitCXXConstructorDecl");
 #if CAIDE_CLANG_VERSION_AT_LEAST(3,9)
     CXXConstructorDecl* inheritedCtor = ctorDecl->getInheritedConstructor().getConstructor();
 #else
@@ -407,6 +522,7 @@ bool DependenciesCollector::VisitCXXConstructorDecl(CXXConstructorDecl* ctorDecl
 }
 
 bool DependenciesCollector::VisitTemplateTypeParmDecl(TemplateTypeParmDecl* paramDecl) {
+    ReferenceSource source(*this, "VisitTemplateTypeParmDecl");
     // Reference from parent function/class template to its parameter, for transitivity.
     // TODO: This won't do the right thing for type aliases, as they're not a declaration context.
     insertReference(getParentDecl(paramDecl), paramDecl);
@@ -415,6 +531,7 @@ bool DependenciesCollector::VisitTemplateTypeParmDecl(TemplateTypeParmDecl* para
 }
 
 bool DependenciesCollector::VisitDeclRefExpr(DeclRefExpr* ref) {
+    ReferenceSource source(*this, "VisitDeclRefExpr");
     Decl* currentDecl = getCurrentDecl();
     insertReference(currentDecl, ref->getDecl());
     insertReference(currentDecl, ref->getFoundDecl());
@@ -422,6 +539,7 @@ bool DependenciesCollector::VisitDeclRefExpr(DeclRefExpr* ref) {
 }
 
 bool DependenciesCollector::VisitValueDecl(ValueDecl* valueDecl) {
+    ReferenceSource source(*this, "VisitValueDecl");
     // Mark any function as depending on its local variables.
     // TODO: detect unused local variables.
     insertReference(getCurrentFunction(valueDecl), valueDecl);
@@ -429,12 +547,14 @@ bool DependenciesCollector::VisitValueDecl(ValueDecl* valueDecl) {
 }
 
 bool DependenciesCollector::VisitVarDecl(VarDecl* varDecl) {
+    ReferenceSource source(*this, "VisitVarDecl");
     insertReference(varDecl, varDecl->getDescribedVarTemplate());
     return true;
 }
 
 // X->F and X.F
 bool DependenciesCollector::VisitMemberExpr(MemberExpr* memberExpr) {
+    ReferenceSource source(*this, "VisitMemberExpr");
     Decl* currentDecl = getCurrentDecl();
     // getFoundDecl() returns either MemberDecl itself or UsingShadowDecl corresponding to a UsingDecl
     insertReference(currentDecl, memberExpr->getFoundDecl().getDecl());
@@ -444,6 +564,7 @@ bool DependenciesCollector::VisitMemberExpr(MemberExpr* memberExpr) {
 // A using declaration has an additional shadow declaration for each declaration
 // that it brings into scope.
 bool DependenciesCollector::VisitUsingShadowDecl(UsingShadowDecl* usingShadowDecl) {
+    ReferenceSource source(*this, "VisitUsingShadowDecl");
     // Add dependency on the actually written using declaration.
 #if CAIDE_CLANG_VERSION_AT_LEAST(13,0)
     insertReference(usingShadowDecl, usingShadowDecl->getIntroducer());
@@ -456,21 +577,25 @@ bool DependenciesCollector::VisitUsingShadowDecl(UsingShadowDecl* usingShadowDec
 }
 
 bool DependenciesCollector::VisitLambdaExpr(LambdaExpr* lambdaExpr) {
+    ReferenceSource source(*this, "VisitLambdaExpr");
     insertReference(getCurrentDecl(), lambdaExpr->getCallOperator());
     return true;
 }
 
 bool DependenciesCollector::VisitFieldDecl(FieldDecl* field) {
+    ReferenceSource source(*this, "VisitFieldDecl");
     insertReference(field, field->getParent());
     return true;
 }
 
 bool DependenciesCollector::VisitTypeAliasDecl(TypeAliasDecl* aliasDecl) {
+    ReferenceSource source(*this, "VisitTypeAliasDecl");
     insertReference(aliasDecl, aliasDecl->getDescribedAliasTemplate());
     return true;
 }
 
 bool DependenciesCollector::VisitTypeAliasTemplateDecl(TypeAliasTemplateDecl* aliasTemplateDecl) {
+    ReferenceSource source(*this, "VisitTypeAliasTemplateDecl");
     insertReference(aliasTemplateDecl, aliasTemplateDecl->getInstantiatedFromMemberTemplate());
     // Dependency on the single (pattern) TypeAlias associated with this template.
     insertReference(aliasTemplateDecl, aliasTemplateDecl->getTemplatedDecl());
@@ -478,6 +603,7 @@ bool DependenciesCollector::VisitTypeAliasTemplateDecl(TypeAliasTemplateDecl* al
 }
 
 bool DependenciesCollector::VisitClassTemplateDecl(ClassTemplateDecl* templateDecl) {
+    ReferenceSource source(*this, "VisitClassTemplateDecl");
     insertReference(templateDecl, templateDecl->getTemplatedDecl());
     return true;
 }
@@ -499,7 +625,7 @@ bool DependenciesCollector::TraverseClassTemplateSpecializationDecl(ClassTemplat
         //
         // To obtain correct dependencies, substitute instantiatedWithArgs into templateArgsAsWritten.
         const TemplateArgumentList& instantiatedWithArgs = specDecl->getTemplateInstantiationArgs();
-        SugaredSignature sig = substituteTemplateArguments(sema, partial, instantiatedWithArgs.asArray());
+        const SugaredSignature& sig = substitutionCache.substitute(partial, instantiatedWithArgs.asArray());
         traverseSugaredSignature(sig);
     }
 
@@ -507,6 +633,7 @@ bool DependenciesCollector::TraverseClassTemplateSpecializationDecl(ClassTemplat
 }
 
 bool DependenciesCollector::VisitClassTemplateSpecializationDecl(ClassTemplateSpecializationDecl* specDecl) {
+    ReferenceSource source(*this, "VisitClassTemplateSpecializationDecl");
     llvm::PointerUnion<ClassTemplateDecl*, ClassTemplatePartialSpecializationDecl*>
         instantiatedFrom = specDecl->getSpecializedTemplateOrPartial();
 
@@ -520,6 +647,7 @@ bool DependenciesCollector::VisitClassTemplateSpecializationDecl(ClassTemplateSp
 }
 
 bool DependenciesCollector::VisitVarTemplateSpecializationDecl(clang::VarTemplateSpecializationDecl* specDecl) {
+    ReferenceSource source(*this, "VisitVarTemplateSpecializationDecl");
     llvm::PointerUnion<VarTemplateDecl*, VarTemplatePartialSpecializationDecl*>
         instantiatedFrom = specDecl->getSpecializedTemplateOrPartial();
 
@@ -544,12 +672,7 @@ from a FunctionDecl.
 We only use FunctionDecl's for dependency tracking.
  */
 bool DependenciesCollector::VisitFunctionDecl(FunctionDecl* f) {
-    if (f->isMain())
-        srcInfo.declsToKeep.insert(f);
-
-    if (sourceManager.isInMainFile(getBeginLoc(f)) && f->isLateTemplateParsed())
-        srcInfo.delayedParsedFunctions.push_back(f);
-
+    ReferenceSource source(*this, "VisitFunctionDecl");
     if (f->getTemplatedKind() == FunctionDecl::TK_FunctionTemplate) {
         // skip non-instantiated template function
         return true;
@@ -577,12 +700,14 @@ bool DependenciesCollector::VisitFunctionDecl(FunctionDecl* f) {
 }
 
 bool DependenciesCollector::VisitFunctionTemplateDecl(FunctionTemplateDecl* functionTemplate) {
+    ReferenceSource source(*this, "VisitFunctionTemplateDecl");
     insertReference(functionTemplate,
             functionTemplate->getInstantiatedFromMemberTemplate());
     return true;
 }
 
 bool DependenciesCollector::VisitCXXMethodDecl(CXXMethodDecl* method) {
+    ReferenceSource source(*this, "VisitCXXMethodDecl");
     insertReference(method, method->getParent());
     if (method->isVirtual()) {
         // Virtual methods may not be called directly. Assume that
@@ -594,6 +719,7 @@ bool DependenciesCollector::VisitCXXMethodDecl(CXXMethodDecl* method) {
 }
 
 bool DependenciesCollector::VisitCXXRecordDecl(CXXRecordDecl* recordDecl) {
+    ReferenceSource source(*this, "VisitCXXRecordDecl");
     insertReference(recordDecl, recordDecl->getDescribedClassTemplate());
     // No implicit calls to destructors in AST; assume that
     // if a class is used, its destructor is used too.
@@ -602,6 +728,7 @@ bool DependenciesCollector::VisitCXXRecordDecl(CXXRecordDecl* recordDecl) {
 }
 
 bool DependenciesCollector::VisitEnumDecl(EnumDecl* enumDecl) {
+    ReferenceSource source(*this, "VisitEnumDecl");
     // Removing an unused enum constant can change values of used constants of the same enum.
     // So we assume that either the whole enum is used or it is unused. For this purpose, insert
     // bidirectional dependency links connecting the enum and each enum constant.
@@ -615,11 +742,255 @@ bool DependenciesCollector::VisitEnumDecl(EnumDecl* enumDecl) {
 
 bool DependenciesCollector::VisitStmt(clang::Stmt* stmt) {
     (void)stmt;
+    ++stats.astNodesVisited;
+    if (templateCosts)
+        templateCosts->addNode();
     dbg(stmt->getStmtClassName() << std::endl);
     // stmt->dump();
     return true;
 }
 
+// Finds roots of the dependency graph:
+// - int main()
+// - declarations marked with a comment '/// caide keep'
+// (Declarations corresponding to names provided by identifiersToKeep setting are found by
+// IdentifierMatcher.)
+// Also finds some edges that wouldn't be found when expanding the graph from the roots.
+class DependenciesCollector::RootsCollector:
+    public RecursiveASTVisitor<DependenciesCollector::RootsCollector>
+{
+public:
+    explicit RootsCollector(DependenciesCollector& collector_)
+        : collector(collector_)
+        , sourceManager(collector_.sourceManager)
+    {}
+
+    bool shouldVisitImplicitCode() const { return true; }
+    bool shouldVisitTemplateInstantiations() const { return true; }
+
+    bool TraverseDecl(Decl* decl) {
+        // Top-level declarations coming from other files can't contain code of the main file, so
+        // we don't descend into them.
+        if (decl && isa_and_nonnull<TranslationUnitDecl>(decl->getLexicalDeclContext())
+                && !sourceManager.isInMainFile(getBeginLoc(decl)))
+            return true;
+        return RecursiveASTVisitor<DependenciesCollector::RootsCollector>::TraverseDecl(decl);
+    }
+
+    bool VisitDecl(Decl* decl);
+    bool VisitFunctionDecl(FunctionDecl* f);
+    bool VisitTemplateTypeParmDecl(TemplateTypeParmDecl* paramDecl);
+
+private:
+    DependenciesCollector& collector;
+    SourceManager& sourceManager;
+};
+
+bool DependenciesCollector::RootsCollector::VisitDecl(Decl* decl) {
+    ReferenceSource source(collector, "RootsCollector::VisitDecl");
+    if (!sourceManager.isInMainFile(getBeginLoc(decl)))
+        return true;
+
+    Decl* ctx = dyn_cast_or_null<Decl>(decl->getDeclContext());
+
+    // Process special comments.
+    RawComment* comment = decl->getASTContext().getRawCommentForDeclNoCache(decl);
+    if (!comment)
+        return true;
+
+    bool invalid = false;
+    const char* beg = sourceManager.getCharacterData(getBeginLoc(comment), &invalid);
+    if (!beg || invalid)
+        return true;
+
+    const char* end =
+        sourceManager.getCharacterData(getEndLoc(comment), &invalid);
+    if (!end || invalid)
+        return true;
+
+    StringRef haystack(beg, end - beg + 1);
+
+    {
+        static const std::string caideKeepComment = "caide keep";
+        StringRef needle(caideKeepComment);
+        dbg(toString(sourceManager, decl) << ": " << haystack.str() << std::endl);
+        if (haystack.find(needle) != StringRef::npos)
+            collector.srcInfo.declsToKeep.insert(decl);
+    }
+
+    if (ctx) {
+        // The following is useful for classes implementing a standard C++ concept.
+        // For instance, a custom iterator passed to std::shuffle must be a RandomAccessIterator,
+        // which means that it must provide certain member functions/type aliases.
+        // However, there is no way to detect this requirement, unless both the language and
+        // the standard library have full concept support (which we don't want to rely on).
+        // That's because some of the functions/type aliases required by the concept might
+        // not actually be used by a particular implementation of std::shuffle. If we remove
+        // them, the program becomes technically illegal and may not even compile in another
+        // compiler.
+        //
+        // To work around that, it's possible to mark declarations required by some Concept
+        // with a comment '/// caide concept'. This will ensure that these declarations don't
+        // get removed as long as the class containing them is used.
+        static const std::string caideConceptComment = "caide concept";
+        StringRef needle(caideConceptComment);
+        dbg(toString(sourceManager, decl) << ": " << haystack.str() << std::endl);
+        if (haystack.find(needle) != StringRef::npos)
+            collector.insertReference(ctx, decl);
+    }
+
+    return true;
+}
+
+bool DependenciesCollector::RootsCollector::VisitFunctionDecl(FunctionDecl* f) {
+    if (f->isMain())
+        collector.srcInfo.mainFunctions.push_back(f);
+
+    if (sourceManager.isInMainFile(getBeginLoc(f)) && f->isLateTemplateParsed())
+        collector.srcInfo.delayedParsedFunctions.push_back(f);
+
+    return true;
+}
+
+bool DependenciesCollector::RootsCollector::VisitTemplateTypeParmDecl(TemplateTypeParmDecl* paramDecl) {
+    ReferenceSource source(collector, "RootsCollector::VisitTemplateTypeParmDecl");
+    // Template parameters of alias and variable templates belong to the enclosing namespace,
+    // which is not traversed when expanding the graph. \sa DependenciesCollector::expand().
+    Decl* parent = collector.getParentDecl(paramDecl);
+    if (parent && (isa<TranslationUnitDecl>(parent) || isa<NamespaceDecl>(parent)
+                || isa<LinkageSpecDecl>(parent)))
+        collector.insertReference(parent, paramDecl);
+    return true;
+}
+
+void DependenciesCollector::collectRoots(TranslationUnitDecl* tu) {
+    RootsCollector rootsCollector(*this);
+    rootsCollector.TraverseDecl(tu);
+}
+
+void DependenciesCollector::expandReachable(const llvm::SmallPtrSetImpl<Decl*>& roots) {
+    for (Decl* decl : roots)
+        queue.push_back(decl->getCanonicalDecl());
+
+    while (!queue.empty()) {
+        if (cancellation.isRequested()) {
+            queue.clear();
+            return;
+        }
+
+        Decl* decl = queue.pop_back_val();
+        if (!used.insert(decl).second)
+            continue;
+        ++stats.reachableDecls;
+
+        auto it = srcInfo.uses.find(decl);
+        if (it != srcInfo.uses.end())
+            queue.append(it->second.begin(), it->second.end());
+
+        // New references from decl will be added to the queue by insertReference().
+        expand(decl);
+    }
+}
+
+void DependenciesCollector::findReachable(const SourceInfo& srcInfo,
+        const llvm::SmallPtrSetImpl<Decl*>& roots, DeclSet& reachable)
+{
+    llvm::SmallVector<Decl*, 64> stack;
+    for (Decl* decl : roots)
+        stack.push_back(decl->getCanonicalDecl());
+
+    while (!stack.empty()) {
+        Decl* decl = stack.pop_back_val();
+        if (!reachable.insert(decl).second)
+            continue;
+
+        auto it = srcInfo.uses.find(decl);
+        if (it != srcInfo.uses.end())
+            stack.append(it->second.begin(), it->second.end());
+    }
+}
+
+// Template parameters are traversed together with the template, so we start from the template
+// that describes decl, if any.
+static Decl* getDescribingTemplate(Decl* decl) {
+    Decl* templateDecl = nullptr;
+    if (auto* f = dyn_cast<FunctionDecl>(decl))
+        templateDecl = f->getDescribedFunctionTemplate();
+    else if (auto* recordDecl = dyn_cast<CXXRecordDecl>(decl))
+        templateDecl = recordDecl->getDescribedClassTemplate();
+    else if (auto* varDecl = dyn_cast<VarDecl>(decl))
+        templateDecl = varDecl->getDescribedVarTemplate();
+    else if (auto* aliasDecl = dyn_cast<TypeAliasDecl>(decl))
+        templateDecl = aliasDecl->getDescribedAliasTemplate();
+    return templateDecl ? templateDecl : decl;
+}
+
+void DependenciesCollector::expand(Decl* canonicalDecl) {
+    for (Decl* redecl : canonicalDecl->redecls()) {
+        if (isa<TranslationUnitDecl>(redecl) || isa<NamespaceDecl>(redecl)
+                || isa<LinkageSpecDecl>(redecl))
+        {
+            // Don't descend into containers of unrelated declarations.
+            if (traversed.insert(redecl).second)
+                VisitDecl(redecl);
+            continue;
+        }
+
+        TraverseDecl(getDescribingTemplate(redecl));
+    }
+}
+
+// Inserts the references made by a top-level declaration of the main file when it was traversed
+// by a previous call, instead of traversing it.
+bool DependenciesCollector::replaySummary(Decl* decl) {
+    DependencySummary summary;
+    if (!summaryCache->load(decl, summary))
+        return false;
+
+    ReferenceSource source(*this, "DependencySummaryCache");
+    for (Decl* traversedDecl : summary.decls)
+        traversed.insert(traversedDecl);
+    for (const auto& reference : summary.references)
+        insertReference(reference.first, reference.second);
+
+    // Implicit members of classes depend on code after the declaration, so they are not part of
+    // the summary. The same goes for implicit destructors referenced by VisitCXXRecordDecl().
+    for (Decl* traversedDecl : summary.decls) {
+        auto* recordDecl = dyn_cast<CXXRecordDecl>(traversedDecl);
+        if (!recordDecl)
+            continue;
+        insertReference(recordDecl, recordDecl->getDestructor());
+        for (Decl* member : recordDecl->decls()) {
+            if (member->isImplicit())
+                TraverseDecl(member);
+        }
+    }
+    return true;
+}
+
+// Implicit instantiations of a template are traversed as children of the template.
+bool DependenciesCollector::isInstantiationOfCurrentTemplate(Decl* decl) const {
+    Decl* currentDecl = getCurrentDecl();
+    if (!currentDecl)
+        return false;
+    if (isa<ClassTemplateDecl>(currentDecl))
+        return isa<ClassTemplateSpecializationDecl>(decl);
+    if (isa<VarTemplateDecl>(currentDecl))
+        return isa<VarTemplateSpecializationDecl>(decl);
+    if (auto* functionTemplate = dyn_cast<FunctionTemplateDecl>(currentDecl))
+        return isa<FunctionDecl>(decl) && decl != functionTemplate->getTemplatedDecl();
+    return false;
+}
+
+std::uint64_t DependenciesCollector::getMemorySize() const {
+    std::uint64_t size = substitutionCache.getMemorySize() + queue.capacity_in_bytes()
+        + traversed.getMemorySize() + relevance.getMemorySize() + patternContexts.getMemorySize()
+        + (summaryCache ? summaryCache->getMemorySize() : 0);
+    for (const auto& entry : patternContexts)
+        size += entry.second.getMemorySize();
+    return size;
+}
+
 void DependenciesCollector::printGraph(std::ostream& out) const {
     auto locToStr = [&](const SourceLocation loc) {
         std::ostringstream str;
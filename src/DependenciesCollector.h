@@ -7,16 +7,24 @@
 #pragma once
 
 #include "clang_version.h"
+#include "EdgeProvenance.h"
+#include "sema_utils.h"
+#include "SourceInfo.h"
 #include "SourceLocationComparers.h"
+#include "TemplateCosts.h"
 
 #include <clang/AST/RecursiveASTVisitor.h>
 #include <clang/Basic/SourceLocation.h>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/SmallVector.h>
 
+#include <cstdint>
 #include <iosfwd>
+#include <memory>
 #include <set>
 #include <stack>
 #include <map>
-#include <unordered_set>
+#include <utility>
 
 
 namespace clang {
@@ -27,18 +35,39 @@ namespace clang {
 
 
 namespace caide {
-namespace internal {
 
-struct SourceInfo;
-struct SugaredSignature;
+struct Stats;
+
+namespace internal {
 
+class Cancellation;
+class DependencySummaryCache;
 
+// The dependency graph is built on demand: only declarations reachable from the roots are
+// traversed, each of them once.
 class DependenciesCollector: public clang::RecursiveASTVisitor<DependenciesCollector> {
 public:
     DependenciesCollector(clang::SourceManager& srcMgr,
         clang::Sema& sema,
-        const std::unordered_set<std::string>& identifiersToKeep,
-        SourceInfo& srcInfo_);
+        SourceInfo& srcInfo_,
+        DeclSet& usedDecls,
+        Stats& stats_,
+        const Cancellation& cancellation_,
+        DependencySummaryCache* summaryCache_ = nullptr);
+
+    // Finds roots of the dependency graph, except for identifiersToKeep. Only declarations from
+    // the main file are traversed.
+    void collectRoots(clang::TranslationUnitDecl* tu);
+
+    // Expands the dependency graph starting from the given roots. All reachable semantic
+    // declarations are added to usedDecls. May be called several times with different roots.
+    // Stops early if cancellation is requested.
+    void expandReachable(const llvm::SmallPtrSetImpl<clang::Decl*>& roots);
+
+    // Finds semantic declarations reachable from the roots in the graph that has already been
+    // expanded by expandReachable() from a superset of the roots.
+    static void findReachable(const SourceInfo& srcInfo,
+        const llvm::SmallPtrSetImpl<clang::Decl*>& roots, DeclSet& reachable);
 
     bool shouldVisitImplicitCode() const;
     bool shouldVisitTemplateInstantiations() const;
@@ -62,7 +91,6 @@ public:
     bool VisitStmt(clang::Stmt* stmt);
 
     bool VisitDecl(clang::Decl* decl);
-    bool VisitNamedDecl(clang::NamedDecl* namedDecl);
     bool VisitCallExpr(clang::CallExpr* callExpr);
     bool VisitCXXConstructExpr(clang::CXXConstructExpr* constructorExpr);
     bool VisitCXXConstructorDecl(clang::CXXConstructorDecl* ctorDecl);
@@ -92,12 +120,42 @@ public:
 
     void printGraph(std::ostream& out) const;
 
+    // Approximate heap footprint of internal data structures, in bytes. The graph itself and
+    // usedDecls are owned by the caller and are not included.
+    std::uint64_t getMemorySize() const;
+
 private:
+    class RootsCollector;
+
+    // Name of the hook on whose behalf references are inserted while the object exists,
+    // for EdgeProvenance.
+    class ReferenceSource {
+    public:
+        ReferenceSource(DependenciesCollector& collector_, const char* hook)
+            : collector(collector_)
+            , previous(collector_.referenceSource)
+        {
+            collector.referenceSource = hook;
+        }
+
+        ~ReferenceSource() {
+            collector.referenceSource = previous;
+        }
+
+    private:
+        DependenciesCollector& collector;
+        const char* previous;
+    };
+
+    void expand(clang::Decl* canonicalDecl);
+    bool replaySummary(clang::Decl* decl);
+    bool isInstantiationOfCurrentTemplate(clang::Decl* decl) const;
+
     clang::Decl* getCurrentDecl() const;
     clang::FunctionDecl* getCurrentFunction(clang::Decl* decl) const;
     clang::Decl* getParentDecl(clang::Decl* decl) const;
 
-    clang::Decl* getCorrespondingDeclInNonInstantiatedContext(clang::Decl* semanticDecl) const;
+    clang::Decl* getCorrespondingDeclInNonInstantiatedContext(clang::Decl* decl);
 
     void traverseTemplateSpecializationTypeImpl(
             const clang::TemplateSpecializationType*,
@@ -105,17 +163,46 @@ private:
     void traverseSugaredSignature(const SugaredSignature&, bool traverseTypeLocs = true);
 
     void insertReference(clang::Decl* from, clang::Decl* to);
+    // Replaces from and to with canonical declarations.
+    ReferenceResult insertEdge(clang::Decl*& from, clang::Decl*& to);
+    bool isRelevant(clang::Decl* canonicalDecl);
 
 
     clang::SourceManager& sourceManager;
     clang::Sema& sema;
-    const std::unordered_set<std::string>& identifiersToKeep;
     SourceInfo& srcInfo;
+    DeclSet& used;
+    Stats& stats;
+    const Cancellation& cancellation;
+    // Null unless dependency summaries are cached.
+    DependencySummaryCache* summaryCache;
+    TemplateSubstitutionCache substitutionCache;
+    // Null unless template costs are collected.
+    std::unique_ptr<TemplateCostTracker> templateCosts;
+    // Null unless edge provenance is collected.
+    std::unique_ptr<EdgeProvenanceTracker> edgeProvenance;
+    const char* referenceSource = nullptr;
+    const char* referenceContext = nullptr;
+
+    // Semantic declarations that have been reached but not expanded yet.
+    llvm::SmallVector<clang::Decl*, 64> queue;
+
+    // Lexical declarations that have been traversed.
+    DeclSet traversed;
+
+    // Cached results of isRelevant().
+    llvm::DenseMap<const clang::Decl*, bool> relevance;
 
     // There is no getParentDecl(stmt) function, so we maintain the stack of Decls,
     // with inner-most active Decl at the top of the stack.
     // \sa TraverseDecl().
     std::stack<clang::Decl*> declStack;
+
+    // Non-implicit declarations of pattern contexts, keyed by location and kind. Built lazily
+    // for contexts containing declarations that clang doesn't link to their pattern directly.
+    // \sa getCorrespondingDeclInNonInstantiatedContext().
+    using LexicalDeclIndex = llvm::DenseMap<std::pair<unsigned, unsigned>, clang::Decl*>;
+    llvm::DenseMap<const clang::DeclContext*, LexicalDeclIndex> patternContexts;
 };
 
 }
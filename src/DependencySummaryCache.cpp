@@ -0,0 +1,840 @@
+//                        Caide C++ inliner
+//
+// This file is distributed under the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version. See LICENSE.TXT for details.
+
+#include "DependencySummaryCache.h"
+#include "caideInliner.hpp"
+#include "clang_compat.h"
+#include "util.h"
+
+#include <clang/AST/ASTContext.h>
+#include <clang/AST/DeclCXX.h>
+#include <clang/AST/DeclFriend.h>
+#include <clang/AST/DeclTemplate.h>
+#include <clang/Basic/SourceManager.h>
+#include <clang/Basic/Version.h>
+#include <clang/Lex/Lexer.h>
+
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MD5.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <algorithm>
+#include <limits>
+#include <set>
+
+
+using namespace clang;
+
+namespace caide {
+namespace internal {
+
+// First line of summary files. Change it when the format or the meaning of keys changes.
+static const char formatVersion[] = "caide dependency summary 1";
+
+// Keys and records consist of fields prefixed by their length, so that they may contain
+// arbitrary text, e.g. printed template arguments.
+static void appendField(std::string& out, llvm::StringRef field) {
+    out += std::to_string(field.size());
+    out += ':';
+    out.append(field.data(), field.size());
+}
+
+static void appendField(llvm::MD5& hash, llvm::StringRef field) {
+    hash.update(std::to_string(field.size()) + ':');
+    hash.update(field);
+}
+
+// Removes the first field from in.
+static bool takeField(llvm::StringRef& in, llvm::StringRef& field) {
+    const size_t colon = in.find(':');
+    if (colon == llvm::StringRef::npos)
+        return false;
+    unsigned long long size = 0;
+    if (in.substr(0, colon).getAsInteger(10, size) || size > in.size() - colon - 1)
+        return false;
+    field = in.substr(colon + 1, size);
+    in = in.drop_front(colon + 1 + size);
+    return true;
+}
+
+// Implicit special members are declared on demand, so they are identified by their kind.
+static const char* getSpecialMemberName(const Decl* decl) {
+    if (const auto* ctorDecl = dyn_cast<CXXConstructorDecl>(decl)) {
+        if (ctorDecl->isDefaultConstructor())
+            return "default";
+        if (ctorDecl->isCopyConstructor())
+            return "copy";
+        if (ctorDecl->isMoveConstructor())
+            return "move";
+        return nullptr;
+    }
+    if (isa<CXXDestructorDecl>(decl))
+        return "destructor";
+    if (const auto* method = dyn_cast<CXXMethodDecl>(decl)) {
+        if (method->isCopyAssignmentOperator())
+            return "copyAssignment";
+        if (method->isMoveAssignmentOperator())
+            return "moveAssignment";
+    }
+    return nullptr;
+}
+
+static std::string makeLocationKey(llvm::StringRef file, llvm::StringRef offset) {
+    std::string key;
+    appendField(key, file);
+    appendField(key, offset);
+    return key;
+}
+
+static std::string getNameKey(DeclarationName name) {
+    switch (name.getNameKind()) {
+    case DeclarationName::Identifier:
+        if (const IdentifierInfo* identifier = name.getAsIdentifierInfo())
+            return "i" + identifier->getName().str();
+        return std::string();
+    case DeclarationName::CXXOperatorName:
+        return "o" + std::to_string(static_cast<int>(name.getCXXOverloadedOperator()));
+    case DeclarationName::CXXConstructorName:
+        return "c";
+    case DeclarationName::CXXDestructorName:
+        return "d";
+    default:
+        return std::string();
+    }
+}
+
+// Whether the traversal of a declaration is not a part of a summary: instantiations are separate
+// nodes of the graph, and implicit members of classes are traversed anew when a summary is loaded.
+// \sa DependenciesCollector::replaySummary().
+static bool isTraversedSeparately(const Decl* decl) {
+    for (; decl; decl = dyn_cast_or_null<Decl>(decl->getDeclContext())) {
+        if (isInstantiated(decl))
+            return true;
+        if (decl->isImplicit() && isa_and_nonnull<CXXRecordDecl>(decl->getDeclContext()))
+            return true;
+    }
+    return false;
+}
+
+// Writes the file atomically, so that concurrent calls never read a partial summary.
+static bool writeFile(llvm::StringRef path, llvm::StringRef contents) {
+    int fd = -1;
+    llvm::SmallString<256> tempPath;
+    if (llvm::sys::fs::createUniqueFile(path + ".%%%%%%%%.tmp", fd, tempPath))
+        return false;
+
+    bool ok = true;
+    {
+        llvm::raw_fd_ostream out(fd, /*shouldClose=*/true);
+        out << contents;
+        out.close();
+        if (out.has_error()) {
+            out.clear_error();
+            ok = false;
+        }
+    }
+
+    if (ok && llvm::sys::fs::rename(tempPath, path))
+        ok = false;
+    if (!ok)
+        llvm::sys::fs::remove(tempPath);
+    return ok;
+}
+
+// Finds the only canonical declaration among candidates.
+class UniqueDecl {
+public:
+    void add(Decl* decl) {
+        decl = decl->getCanonicalDecl();
+        if (!found)
+            found = decl;
+        else if (found != decl)
+            ambiguous = true;
+    }
+
+    Decl* get() const { return ambiguous ? nullptr : found; }
+
+private:
+    Decl* found = nullptr;
+    bool ambiguous = false;
+};
+
+DependencySummaryCache::DependencySummaryCache(const std::string& directory_,
+        const std::vector<std::string>& cmdLineOptions,
+        SourceManager& sourceManager_,
+        ASTContext& astContext_,
+        Stats& stats_)
+    : directory(directory_)
+    , sourceManager(sourceManager_)
+    , astContext(astContext_)
+    , stats(stats_)
+    , mainFileID(sourceManager_.getMainFileID())
+{
+    indexContext(astContext.getTranslationUnitDecl());
+    collectTopLevelDecls(astContext.getTranslationUnitDecl());
+    computeKeys(cmdLineOptions);
+}
+
+// Implicit members of classes and namespaces are skipped: they may be declared on demand by code
+// anywhere in the file, so their position in the list depends on the rest of the file. Implicit
+// declarations in functions (e.g. closure types of lambdas) are created by the parser.
+void DependencySummaryCache::indexContext(DeclContext* ctx) {
+    const bool inFunction = ctx->isFunctionOrMethod();
+    for (Decl* decl : ctx->decls()) {
+        if (inFunction || !decl->isImplicit())
+            indexDecl(decl);
+    }
+}
+
+void DependencySummaryCache::indexDecl(Decl* decl) {
+    if (!decl || isInstantiated(decl) || !sourceManager.isInMainFile(getBeginLoc(decl)))
+        return;
+    if (!declIndex.insert(std::make_pair(decl, static_cast<unsigned>(decls.size()))).second)
+        return;
+    decls.push_back(decl);
+
+    if (auto* templateDecl = dyn_cast<TemplateDecl>(decl)) {
+        for (NamedDecl* param : *templateDecl->getTemplateParameters())
+            indexDecl(param);
+        indexDecl(templateDecl->getTemplatedDecl());
+    } else if (auto* partialSpec = dyn_cast<ClassTemplatePartialSpecializationDecl>(decl)) {
+        for (NamedDecl* param : *partialSpec->getTemplateParameters())
+            indexDecl(param);
+    } else if (auto* partialSpec = dyn_cast<VarTemplatePartialSpecializationDecl>(decl)) {
+        for (NamedDecl* param : *partialSpec->getTemplateParameters())
+            indexDecl(param);
+    } else if (auto* friendDecl = dyn_cast<FriendDecl>(decl)) {
+        indexDecl(friendDecl->getFriendDecl());
+    }
+
+    if (auto* f = dyn_cast<FunctionDecl>(decl)) {
+        for (ParmVarDecl* param : f->parameters())
+            indexDecl(param);
+    } else if (auto* decompositionDecl = dyn_cast<DecompositionDecl>(decl)) {
+        for (BindingDecl* binding : decompositionDecl->bindings())
+            indexDecl(binding);
+    }
+
+    if (auto* ctx = dyn_cast<DeclContext>(decl))
+        indexContext(ctx);
+}
+
+void DependencySummaryCache::collectTopLevelDecls(DeclContext* ctx) {
+    for (Decl* decl : ctx->decls()) {
+        if (decl->isImplicit() || isInstantiated(decl)
+                || !sourceManager.isInMainFile(getBeginLoc(decl)))
+            continue;
+        if (isa<NamespaceDecl>(decl) || isa<LinkageSpecDecl>(decl)) {
+            collectTopLevelDecls(cast<DeclContext>(decl));
+            continue;
+        }
+
+        const SourceLocation begin = sourceManager.getExpansionLoc(getExpansionStart(sourceManager, decl));
+        const SourceLocation end = sourceManager.getExpansionLoc(getExpansionEnd(sourceManager, decl));
+        if (begin.isInvalid() || end.isInvalid() || sourceManager.getFileID(begin) != mainFileID
+                || sourceManager.getFileID(end) != mainFileID)
+            continue;
+
+        TopLevelDecl topLevelDecl;
+        topLevelDecl.decl = decl;
+        topLevelDecl.begin = sourceManager.getFileOffset(begin);
+        topLevelDecl.end = sourceManager.getFileOffset(end)
+            + Lexer::MeasureTokenLength(end, sourceManager, astContext.getLangOpts()) + 1;
+        topLevelDeclIndex[decl] = static_cast<unsigned>(topLevelDecls.size());
+        topLevelDecls.push_back(std::move(topLevelDecl));
+    }
+}
+
+// The key of a top-level declaration is the hash of the main file up to its end, interleaved
+// with contents of the files included before that point. Buffers that are not included by
+// anything (predefines and scratch space) are skipped: they are determined by the options,
+// the compiler and the main file. Files included from predefines (-include option) come first.
+void DependencySummaryCache::computeKeys(const std::vector<std::string>& cmdLineOptions) {
+    std::vector<std::pair<unsigned, FileID>> includedFiles;
+    for (unsigned i = 0, n = sourceManager.local_sloc_entry_size(); i < n; ++i) {
+        const SrcMgr::SLocEntry& entry = sourceManager.getLocalSLocEntry(i);
+        if (!entry.isFile() || entry.getFile().getIncludeLoc().isInvalid())
+            continue;
+        const FileID fileID = sourceManager.getFileID(SourceLocation::getFromRawEncoding(entry.getOffset()));
+        if (fileID.isInvalid() || fileID == mainFileID)
+            continue;
+
+        // Offset of the include directive in the main file; zero for files included from
+        // predefines (-include option).
+        unsigned offset = 0;
+        SourceLocation includeLoc = sourceManager.getExpansionLoc(entry.getFile().getIncludeLoc());
+        while (includeLoc.isValid() && sourceManager.getFileID(includeLoc) != mainFileID)
+            includeLoc = sourceManager.getExpansionLoc(sourceManager.getIncludeLoc(sourceManager.getFileID(includeLoc)));
+        if (includeLoc.isValid())
+            offset = sourceManager.getFileOffset(includeLoc);
+        includedFiles.emplace_back(offset, fileID);
+    }
+    std::stable_sort(includedFiles.begin(), includedFiles.end(),
+        [](const std::pair<unsigned, FileID>& lhs, const std::pair<unsigned, FileID>& rhs) {
+            return lhs.first < rhs.first;
+        });
+
+    std::vector<TopLevelDecl*> byEnd;
+    for (TopLevelDecl& topLevelDecl : topLevelDecls)
+        byEnd.push_back(&topLevelDecl);
+    std::stable_sort(byEnd.begin(), byEnd.end(), [](const TopLevelDecl* lhs, const TopLevelDecl* rhs) {
+        return lhs->end < rhs->end;
+    });
+
+    llvm::MD5 hash;
+    appendField(hash, formatVersion);
+    appendField(hash, getClangFullVersion());
+    for (const std::string& option : cmdLineOptions)
+        appendField(hash, option);
+
+    const llvm::StringRef text = sourceManager.getBufferData(mainFileID);
+    unsigned hashedEnd = 0;
+    size_t nextFile = 0;
+    for (TopLevelDecl* topLevelDecl : byEnd) {
+        const unsigned end = std::min<unsigned>(topLevelDecl->end, static_cast<unsigned>(text.size()));
+        for (; nextFile < includedFiles.size() && includedFiles[nextFile].first < end; ++nextFile) {
+            const unsigned offset = std::max(hashedEnd, includedFiles[nextFile].first);
+            hash.update(text.substr(hashedEnd, offset - hashedEnd));
+            hashedEnd = offset;
+
+            const FileID fileID = includedFiles[nextFile].second;
+            const SourceLocation fileStart = sourceManager.getLocForStartOfFile(fileID);
+            appendField(hash, "#include");
+            appendField(hash, sourceManager.getBufferName(fileStart));
+            appendField(hash, sourceManager.getBufferData(fileID));
+        }
+        if (end > hashedEnd) {
+            hash.update(text.substr(hashedEnd, end - hashedEnd));
+            hashedEnd = end;
+        }
+
+        llvm::MD5 prefixHash = hash;
+        llvm::MD5::MD5Result result;
+        prefixHash.final(result);
+        topLevelDecl->key = result.digest().str().str();
+    }
+}
+
+// Location that doesn't depend on the path of the main file. end is updated if the location is
+// in the main file.
+std::string DependencySummaryCache::getLocationKey(const Decl* decl, unsigned& end) const {
+    const SourceLocation loc = sourceManager.getExpansionLoc(decl->getLocation());
+    if (loc.isInvalid())
+        return std::string();
+    const unsigned offset = sourceManager.getFileOffset(loc);
+    if (sourceManager.getFileID(loc) != mainFileID)
+        return makeLocationKey(sourceManager.getBufferName(loc), std::to_string(offset));
+    end = std::max(end, offset + 1);
+    return makeLocationKey("", std::to_string(offset));
+}
+
+std::string DependencySummaryCache::printTemplateArguments(llvm::ArrayRef<TemplateArgument> args) const {
+    std::string result;
+    llvm::raw_string_ostream os(result);
+    printTemplateArgumentList(os, args, astContext.getPrintingPolicy());
+    os.flush();
+    return result;
+}
+
+// A key must identify the same declaration when the main file is parsed again, as far as
+// the main file up to DeclKey::end is unchanged. Keys are built from these components:
+//   T                    the translation unit
+//   M ordinal            declaration of the main file
+//   B name               builtin function
+//   K parent kind        implicit special member of a class
+//   P template           templated declaration of a template
+//   C/V/F template args  specialization of a class, variable or function template
+//   I parent kind loc    member of an instantiated class
+//   N parent name kind loc  named declaration from another file
+DependencySummaryCache::DeclKey DependencySummaryCache::getKey(Decl* decl) {
+    auto it = keys.find(decl);
+    if (it != keys.end())
+        return it->second;
+
+    DeclKey key = makeKey(decl);
+    if (!key.key.empty() && resolve(key.key) != decl)
+        key = DeclKey();
+    keys[decl] = key;
+    return key;
+}
+
+DependencySummaryCache::DeclKey DependencySummaryCache::makeCompositeKey(char kind,
+        Decl* parent, const std::string& fields)
+{
+    DeclKey key;
+    if (!parent)
+        return key;
+    DeclKey parentKey = getKey(parent->getCanonicalDecl());
+    if (parentKey.key.empty())
+        return key;
+    key.key = kind;
+    appendField(key.key, parentKey.key);
+    key.key += fields;
+    key.end = parentKey.end;
+    return key;
+}
+
+DependencySummaryCache::DeclKey DependencySummaryCache::makeKey(Decl* decl) {
+    DeclKey key;
+    if (isa<TranslationUnitDecl>(decl)) {
+        key.key = "T";
+        return key;
+    }
+
+    auto index = declIndex.find(decl);
+    if (index != declIndex.end()) {
+        key.key = "M";
+        appendField(key.key, std::to_string(index->second));
+        key.end = sourceManager.getFileOffset(sourceManager.getExpansionLoc(getBeginLoc(decl))) + 1;
+        return key;
+    }
+
+    Decl* parent = dyn_cast_or_null<Decl>(decl->getDeclContext());
+
+    if (decl->isImplicit()) {
+        auto* f = dyn_cast<FunctionDecl>(decl);
+        if (f && f->getBuiltinID() != 0) {
+            key.key = "B";
+            appendField(key.key, f->getName());
+            return key;
+        }
+        const char* specialMember = getSpecialMemberName(decl);
+        if (specialMember && isa_and_nonnull<CXXRecordDecl>(parent)) {
+            std::string fields;
+            appendField(fields, specialMember);
+            return makeCompositeKey('K', parent, fields);
+        }
+        return key;
+    }
+
+    if (TemplateDecl* templateDecl = decl->getDescribedTemplate())
+        return makeCompositeKey('P', templateDecl, std::string());
+
+    if (auto* spec = dyn_cast<ClassTemplateSpecializationDecl>(decl)) {
+        if (isa<ClassTemplatePartialSpecializationDecl>(spec))
+            return key;
+        std::string fields;
+        appendField(fields, printTemplateArguments(spec->getTemplateArgs().asArray()));
+        return makeCompositeKey('C', spec->getSpecializedTemplate(), fields);
+    }
+    if (auto* spec = dyn_cast<VarTemplateSpecializationDecl>(decl)) {
+        if (isa<VarTemplatePartialSpecializationDecl>(spec))
+            return key;
+        std::string fields;
+        appendField(fields, printTemplateArguments(spec->getTemplateArgs().asArray()));
+        return makeCompositeKey('V', spec->getSpecializedTemplate(), fields);
+    }
+    if (auto* f = dyn_cast<FunctionDecl>(decl)) {
+        if (FunctionTemplateDecl* primary = f->getPrimaryTemplate()) {
+            const TemplateArgumentList* args = f->getTemplateSpecializationArgs();
+            if (!args)
+                return key;
+            std::string fields;
+            appendField(fields, printTemplateArguments(args->asArray()));
+            return makeCompositeKey('F', primary, fields);
+        }
+    }
+
+    std::string fields;
+    unsigned end = 0;
+    auto* record = dyn_cast_or_null<CXXRecordDecl>(parent);
+    if (record && isInstantiated(record)) {
+        appendField(fields, decl->getDeclKindName());
+        const std::string location = getLocationKey(decl, end);
+        if (location.empty())
+            return key;
+        fields += location;
+        key = makeCompositeKey('I', record, fields);
+        key.end = std::max(key.end, end);
+        return key;
+    }
+
+    auto* namedDecl = dyn_cast<NamedDecl>(decl);
+    if (!namedDecl || sourceManager.isInMainFile(getBeginLoc(decl)))
+        return key;
+    const std::string name = getNameKey(namedDecl->getDeclName());
+    const std::string location = getLocationKey(decl, end);
+    if (name.empty() || location.empty())
+        return key;
+    // Lookup in other contexts (e.g. functions) is not reliable.
+    auto* lookupContext = dyn_cast<Decl>(decl->getDeclContext()->getRedeclContext());
+    if (!isa<TranslationUnitDecl>(lookupContext) && !isa<NamespaceDecl>(lookupContext)
+            && !isa<TagDecl>(lookupContext))
+        return key;
+    appendField(fields, name);
+    appendField(fields, decl->getDeclKindName());
+    fields += location;
+    key = makeCompositeKey('N', lookupContext, fields);
+    key.end = std::max(key.end, end);
+    return key;
+}
+
+Decl* DependencySummaryCache::resolve(llvm::StringRef key) {
+    auto it = resolvedKeys.find(key);
+    if (it != resolvedKeys.end())
+        return it->second;
+    Decl* decl = resolveImpl(key);
+    resolvedKeys[key] = decl;
+    return decl;
+}
+
+Decl* DependencySummaryCache::resolveImpl(llvm::StringRef key) {
+    if (key == "T")
+        return astContext.getTranslationUnitDecl();
+    if (key.empty())
+        return nullptr;
+
+    const char kind = key.front();
+    llvm::StringRef rest = key.drop_front();
+    llvm::SmallVector<llvm::StringRef, 4> fields;
+    while (!rest.empty()) {
+        llvm::StringRef field;
+        if (!takeField(rest, field))
+            return nullptr;
+        fields.push_back(field);
+    }
+    if (fields.empty())
+        return nullptr;
+
+    UniqueDecl result;
+    if (kind == 'M') {
+        unsigned index = 0;
+        if (fields.size() != 1 || fields[0].getAsInteger(10, index) || index >= decls.size())
+            return nullptr;
+        return decls[index];
+    }
+    if (kind == 'B') {
+        if (fields.size() != 1)
+            return nullptr;
+        DeclarationName name(&astContext.Idents.get(fields[0]));
+        for (NamedDecl* candidate : astContext.getTranslationUnitDecl()->lookup(name)) {
+            auto* f = dyn_cast<FunctionDecl>(candidate);
+            if (f && f->isImplicit() && f->getBuiltinID() != 0)
+                result.add(f);
+        }
+        return result.get();
+    }
+
+    Decl* parent = resolve(fields[0]);
+    if (!parent)
+        return nullptr;
+    unsigned end = 0;
+
+    switch (kind) {
+    case 'K': {
+        auto* record = dyn_cast<CXXRecordDecl>(parent);
+        record = record ? record->getDefinition() : nullptr;
+        if (!record || fields.size() != 2)
+            return nullptr;
+        for (Decl* member : record->decls()) {
+            const char* specialMember = member->isImplicit() ? getSpecialMemberName(member) : nullptr;
+            if (specialMember && fields[1] == specialMember)
+                result.add(member);
+        }
+        return result.get();
+    }
+    case 'P': {
+        auto* templateDecl = dyn_cast<TemplateDecl>(parent);
+        if (!templateDecl || fields.size() != 1 || !templateDecl->getTemplatedDecl())
+            return nullptr;
+        return templateDecl->getTemplatedDecl()->getCanonicalDecl();
+    }
+    case 'C': {
+        auto* templateDecl = dyn_cast<ClassTemplateDecl>(parent);
+        if (!templateDecl || fields.size() != 2)
+            return nullptr;
+        for (ClassTemplateSpecializationDecl* spec : templateDecl->specializations()) {
+            if (printTemplateArguments(spec->getTemplateArgs().asArray()) == fields[1])
+                result.add(spec);
+        }
+        return result.get();
+    }
+    case 'V': {
+        auto* templateDecl = dyn_cast<VarTemplateDecl>(parent);
+        if (!templateDecl || fields.size() != 2)
+            return nullptr;
+        for (VarTemplateSpecializationDecl* spec : templateDecl->specializations()) {
+            if (printTemplateArguments(spec->getTemplateArgs().asArray()) == fields[1])
+                result.add(spec);
+        }
+        return result.get();
+    }
+    case 'F': {
+        auto* templateDecl = dyn_cast<FunctionTemplateDecl>(parent);
+        if (!templateDecl || fields.size() != 2)
+            return nullptr;
+        for (FunctionDecl* spec : templateDecl->specializations()) {
+            const TemplateArgumentList* args = spec->getTemplateSpecializationArgs();
+            if (args && printTemplateArguments(args->asArray()) == fields[1])
+                result.add(spec);
+        }
+        return result.get();
+    }
+    case 'I': {
+        auto* record = dyn_cast<CXXRecordDecl>(parent);
+        record = record ? record->getDefinition() : nullptr;
+        if (!record || fields.size() != 4)
+            return nullptr;
+        for (Decl* member : record->decls()) {
+            if (!member->isImplicit() && fields[1] == member->getDeclKindName()
+                    && getLocationKey(member, end) == makeLocationKey(fields[2], fields[3]))
+                result.add(member);
+        }
+        return result.get();
+    }
+    case 'N': {
+        if (fields.size() != 5)
+            return nullptr;
+        DeclContext* ctx = nullptr;
+        if (auto* tagDecl = dyn_cast<TagDecl>(parent))
+            ctx = tagDecl->getDefinition();
+        else
+            ctx = dyn_cast<DeclContext>(parent);
+        if (!ctx)
+            return nullptr;
+
+        const std::string location = makeLocationKey(fields[3], fields[4]);
+        auto matches = [&](Decl* candidate) {
+            candidate = candidate->getCanonicalDecl();
+            return !candidate->isImplicit() && fields[2] == candidate->getDeclKindName()
+                && getLocationKey(candidate, end) == location;
+        };
+
+        const llvm::StringRef name = fields[1];
+        auto* record = dyn_cast<CXXRecordDecl>(ctx);
+        if (name == "c" || name == "d") {
+            if (!record)
+                return nullptr;
+            if (name == "c") {
+                for (CXXConstructorDecl* ctorDecl : record->ctors()) {
+                    if (matches(ctorDecl))
+                        result.add(ctorDecl);
+                }
+            } else if (CXXDestructorDecl* dtorDecl = record->getDestructor()) {
+                if (matches(dtorDecl))
+                    result.add(dtorDecl);
+            }
+            return result.get();
+        }
+
+        DeclarationName declName;
+        if (name.front() == 'i') {
+            declName = DeclarationName(&astContext.Idents.get(name.drop_front()));
+        } else if (name.front() == 'o') {
+            unsigned op = 0;
+            if (name.drop_front().getAsInteger(10, op) || op == OO_None
+                    || op >= NUM_OVERLOADED_OPERATORS)
+                return nullptr;
+            declName = astContext.DeclarationNames.getCXXOperatorName(
+                static_cast<OverloadedOperatorKind>(op));
+        } else {
+            return nullptr;
+        }
+
+        for (NamedDecl* candidate : ctx->lookup(declName)) {
+            if (matches(candidate))
+                result.add(candidate);
+        }
+        return result.get();
+    }
+    default:
+        return nullptr;
+    }
+}
+
+bool DependencySummaryCache::load(Decl* decl, DependencySummary& summary) {
+    auto it = topLevelDeclIndex.find(decl);
+    if (it == topLevelDeclIndex.end())
+        return false;
+    TopLevelDecl& topLevelDecl = topLevelDecls[it->second];
+
+    llvm::SmallString<256> path(directory);
+    llvm::sys::path::append(path, topLevelDecl.key);
+    auto buffer = llvm::MemoryBuffer::getFile(path);
+    if (!buffer)
+        return false;
+
+    DependencySummary result;
+    if (!parse((*buffer)->getBuffer(), result))
+        return false;
+
+    for (Decl* loadedDecl : result.decls) {
+        loadedOffsets.push_back(sourceManager.getFileOffset(
+            sourceManager.getExpansionLoc(getBeginLoc(loadedDecl))));
+    }
+    topLevelDecl.loaded = true;
+    summary = std::move(result);
+    ++stats.dependencySummariesLoaded;
+    return true;
+}
+
+bool DependencySummaryCache::parse(llvm::StringRef contents, DependencySummary& summary) {
+    if (!contents.consume_front(formatVersion) || !contents.consume_front("\n"))
+        return false;
+
+    while (!contents.empty()) {
+        const char kind = contents.front();
+        contents = contents.drop_front();
+        llvm::StringRef first, second;
+        if (kind == 'D') {
+            if (!takeField(contents, first))
+                return false;
+            Decl* decl = resolve(first);
+            if (!decl)
+                return false;
+            summary.decls.push_back(decl);
+        } else if (kind == 'R') {
+            if (!takeField(contents, first) || !takeField(contents, second))
+                return false;
+            Decl* from = resolve(first);
+            Decl* to = resolve(second);
+            if (!from || !to)
+                return false;
+            summary.references.emplace_back(from, to);
+        } else {
+            return false;
+        }
+
+        if (!contents.consume_front("\n"))
+            return false;
+    }
+
+    return true;
+}
+
+void DependencySummaryCache::addTraversedDecl(Decl* decl) {
+    traversed[decl];
+}
+
+void DependencySummaryCache::addReference(Decl* traversedDecl, Decl* from, Decl* to) {
+    if (!from || !to)
+        return;
+    from = from->getCanonicalDecl();
+    to = to->getCanonicalDecl();
+    if (from != to)
+        traversed[traversedDecl].emplace_back(from, to);
+}
+
+bool DependencySummaryCache::serialize(const TopLevelDecl& topLevelDecl,
+        const std::vector<std::pair<unsigned, Decl*>>& traversedDecls, std::string& contents)
+{
+    contents = formatVersion;
+    contents += '\n';
+
+    std::set<std::pair<std::string, std::string>> references;
+    auto it = std::lower_bound(traversedDecls.begin(), traversedDecls.end(), topLevelDecl.begin,
+        [](const std::pair<unsigned, Decl*>& entry, unsigned offset) {
+            return entry.first < offset;
+        });
+    for (; it != traversedDecls.end() && it->first < topLevelDecl.end; ++it) {
+        Decl* decl = it->second;
+        if (declIndex.count(decl) == 0) {
+            if (isTraversedSeparately(decl))
+                continue;
+            return false;
+        }
+
+        const DeclKey key = getKey(decl);
+        if (key.key.empty())
+            return false;
+        contents += 'D';
+        appendField(contents, key.key);
+        contents += '\n';
+
+        for (const auto& reference : traversed.find(decl)->second) {
+            // Destructors may be declared implicitly after the class.
+            // \sa DependenciesCollector::replaySummary().
+            if (isa<CXXRecordDecl>(reference.first) && isa<CXXDestructorDecl>(reference.second)
+                    && reference.second->isImplicit())
+                continue;
+            const DeclKey from = getKey(reference.first);
+            const DeclKey to = getKey(reference.second);
+            if (from.key.empty() || to.key.empty() || from.end > topLevelDecl.end
+                    || to.end > topLevelDecl.end)
+                return false;
+            references.emplace(from.key, to.key);
+        }
+    }
+
+    for (const auto& reference : references) {
+        contents += 'R';
+        appendField(contents, reference.first);
+        appendField(contents, reference.second);
+        contents += '\n';
+    }
+    return true;
+}
+
+void DependencySummaryCache::save() {
+    std::vector<std::pair<unsigned, Decl*>> traversedDecls;
+    for (const auto& entry : traversed) {
+        const SourceLocation loc = sourceManager.getExpansionLoc(getBeginLoc(entry.first));
+        if (loc.isValid() && sourceManager.getFileID(loc) == mainFileID)
+            traversedDecls.emplace_back(sourceManager.getFileOffset(loc), entry.first);
+    }
+    // Summaries must not depend on addresses of declarations.
+    auto ordinal = [this](const Decl* decl) {
+        auto it = declIndex.find(decl);
+        return it == declIndex.end() ? std::numeric_limits<unsigned>::max() : it->second;
+    };
+    std::sort(traversedDecls.begin(), traversedDecls.end(),
+        [&ordinal](const std::pair<unsigned, Decl*>& lhs, const std::pair<unsigned, Decl*>& rhs) {
+            if (lhs.first != rhs.first)
+                return lhs.first < rhs.first;
+            return ordinal(lhs.second) < ordinal(rhs.second);
+        });
+    std::sort(loadedOffsets.begin(), loadedOffsets.end());
+
+    bool directoryExists = false;
+    for (const TopLevelDecl& topLevelDecl : topLevelDecls) {
+        if (topLevelDecl.loaded || traversed.count(topLevelDecl.decl) == 0)
+            continue;
+        // Declarations inside the range whose summaries have been loaded have not been traversed.
+        auto loaded = std::lower_bound(loadedOffsets.begin(), loadedOffsets.end(), topLevelDecl.begin);
+        if (loaded != loadedOffsets.end() && *loaded < topLevelDecl.end)
+            continue;
+
+        llvm::SmallString<256> path(directory);
+        llvm::sys::path::append(path, topLevelDecl.key);
+        if (llvm::sys::fs::exists(path))
+            continue;
+
+        std::string contents;
+        if (!serialize(topLevelDecl, traversedDecls, contents))
+            continue;
+
+        if (!directoryExists) {
+            if (llvm::sys::fs::create_directories(directory))
+                return;
+            directoryExists = true;
+        }
+        if (writeFile(path, contents))
+            ++stats.dependencySummariesSaved;
+    }
+}
+
+std::uint64_t DependencySummaryCache::getMemorySize() const {
+    std::uint64_t size = decls.capacity() * sizeof(Decl*) + declIndex.getMemorySize()
+        + topLevelDecls.capacity() * sizeof(TopLevelDecl) + topLevelDeclIndex.getMemorySize()
+        + keys.getMemorySize() + resolvedKeys.getNumBuckets() * sizeof(void*)
+        + traversed.getMemorySize() + loadedOffsets.capacity() * sizeof(unsigned);
+    for (const TopLevelDecl& topLevelDecl : topLevelDecls)
+        size += topLevelDecl.key.capacity();
+    for (const auto& entry : keys)
+        size += entry.second.key.capacity();
+    for (const auto& entry : resolvedKeys)
+        size += sizeof(entry) + entry.getKeyLength();
+    for (const auto& entry : traversed)
+        size += entry.second.capacity() * sizeof(entry.second[0]);
+    return size;
+}
+
+}
+}
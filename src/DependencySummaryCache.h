@@ -0,0 +1,138 @@
+//                        Caide C++ inliner
+//
+// This file is distributed under the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version. See LICENSE.TXT for details.
+
+#pragma once
+
+#include <clang/Basic/SourceLocation.h>
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/ADT/StringRef.h>
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace clang {
+    class ASTContext;
+    class Decl;
+    class DeclContext;
+    class SourceManager;
+    class TemplateArgument;
+}
+
+namespace caide {
+
+struct Stats;
+
+namespace internal {
+
+// Declarations traversed by DependenciesCollector as part of one top-level declaration of the
+// main file, and the references they made. All declarations are canonical, except for the
+// traversed (lexical) ones.
+struct DependencySummary {
+    std::vector<clang::Decl*> decls;
+    std::vector<std::pair<clang::Decl*, clang::Decl*>> references;
+};
+
+// On-disk cache of dependency summaries of top-level declarations (CppInliner::dependencySummaryCache).
+//
+// The AST of a top-level declaration depends only on what the parser has seen up to its end:
+// compilation options, the main file up to that point and the headers it has included. A summary
+// is stored in a file named by the hash of all that, so a summary saved by a previous call is
+// valid as long as nothing before the declaration has changed. Declarations referenced by the
+// summary are stored by keys that survive reparsing: the ordinal of a declaration among
+// declarations of the main file, name and location of a declaration from a header, or template
+// and printed template arguments of a specialization. Summaries that can't be expressed this way
+// are not saved, and summaries that can't be resolved are not used.
+class DependencySummaryCache {
+public:
+    DependencySummaryCache(const std::string& directory_,
+        const std::vector<std::string>& cmdLineOptions,
+        clang::SourceManager& sourceManager_,
+        clang::ASTContext& astContext_,
+        Stats& stats_);
+    DependencySummaryCache(const DependencySummaryCache&) = delete;
+    DependencySummaryCache& operator=(const DependencySummaryCache&) = delete;
+
+    // Reads the summary of a top-level declaration. Returns false if decl is not a top-level
+    // declaration of the main file or its summary has not been saved.
+    bool load(clang::Decl* decl, DependencySummary& summary);
+
+    // Records a declaration traversed anew, and a reference made while traversedDecl is
+    // the innermost traversed declaration.
+    void addTraversedDecl(clang::Decl* decl);
+    void addReference(clang::Decl* traversedDecl, clang::Decl* from, clang::Decl* to);
+
+    // Saves summaries of top-level declarations that have been traversed anew. Errors are
+    // ignored: the cache is only an optimization.
+    void save();
+
+    // Approximate heap footprint, in bytes.
+    std::uint64_t getMemorySize() const;
+
+private:
+    struct TopLevelDecl {
+        clang::Decl* decl;
+        // Offsets of the beginning and of the end of the declaration in the main file. The end
+        // includes one character after the last token, which may change its meaning.
+        unsigned begin;
+        unsigned end;
+        // Name of the summary file.
+        std::string key;
+        bool loaded = false;
+    };
+
+    struct DeclKey {
+        // Empty if the declaration can't be stored.
+        std::string key;
+        // The key is valid only if the main file up to this offset is unchanged.
+        unsigned end = 0;
+    };
+
+    void indexContext(clang::DeclContext* ctx);
+    void indexDecl(clang::Decl* decl);
+    void collectTopLevelDecls(clang::DeclContext* ctx);
+    void computeKeys(const std::vector<std::string>& cmdLineOptions);
+
+    std::string getLocationKey(const clang::Decl* decl, unsigned& end) const;
+    std::string printTemplateArguments(llvm::ArrayRef<clang::TemplateArgument> args) const;
+    DeclKey getKey(clang::Decl* decl);
+    DeclKey makeKey(clang::Decl* decl);
+    DeclKey makeCompositeKey(char kind, clang::Decl* parent, const std::string& fields);
+    clang::Decl* resolve(llvm::StringRef key);
+    clang::Decl* resolveImpl(llvm::StringRef key);
+
+    bool parse(llvm::StringRef contents, DependencySummary& summary);
+    bool serialize(const TopLevelDecl& topLevelDecl,
+        const std::vector<std::pair<unsigned, clang::Decl*>>& traversedDecls, std::string& contents);
+
+    const std::string directory;
+    clang::SourceManager& sourceManager;
+    clang::ASTContext& astContext;
+    Stats& stats;
+    clang::FileID mainFileID;
+
+    // Declarations of the main file, in the order in which the parser has added them.
+    std::vector<clang::Decl*> decls;
+    llvm::DenseMap<const clang::Decl*, unsigned> declIndex;
+
+    std::vector<TopLevelDecl> topLevelDecls;
+    llvm::DenseMap<const clang::Decl*, unsigned> topLevelDeclIndex;
+
+    llvm::DenseMap<const clang::Decl*, DeclKey> keys;
+    llvm::StringMap<clang::Decl*> resolvedKeys;
+
+    // References made by declarations traversed anew, keyed by traversed declaration.
+    llvm::DenseMap<clang::Decl*, std::vector<std::pair<clang::Decl*, clang::Decl*>>> traversed;
+
+    // Offsets of declarations whose summary has been loaded.
+    std::vector<unsigned> loadedOffsets;
+};
+
+}
+}
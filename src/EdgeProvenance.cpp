@@ -0,0 +1,97 @@
+//                        Caide C++ inliner
+//
+// This file is distributed under the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version. See LICENSE.TXT for details.
+
+#include "EdgeProvenance.h"
+#include "caideInliner.hpp"
+
+#include <algorithm>
+
+
+using std::string;
+using std::vector;
+
+
+namespace caide {
+namespace internal {
+
+static thread_local EdgeProvenance* currentProvenance = nullptr;
+
+EdgeProvenance::EdgeProvenance(bool enable)
+    : enabled(enable)
+{
+    if (enabled) {
+        previous = currentProvenance;
+        currentProvenance = this;
+    }
+}
+
+EdgeProvenance::~EdgeProvenance() {
+    if (enabled)
+        currentProvenance = previous;
+}
+
+vector<EdgeStats> EdgeProvenance::getResults() const {
+    vector<EdgeStats> results;
+    results.reserve(hooks.size());
+    for (const auto& entry : hooks)
+        results.push_back(entry.second);
+    // Stable sort keeps hooks with equal counts ordered by name.
+    std::stable_sort(results.begin(), results.end(),
+        [](const EdgeStats& lhs, const EdgeStats& rhs) {
+            return lhs.newEdges > rhs.newEdges;
+        });
+    return results;
+}
+
+EdgeProvenance* EdgeProvenance::current() {
+    return currentProvenance;
+}
+
+EdgeProvenanceTracker::EdgeProvenanceTracker(EdgeProvenance& provenance_,
+        const DeclSet& reachable_)
+    : provenance(provenance_)
+    , reachable(reachable_)
+{}
+
+EdgeProvenanceTracker::~EdgeProvenanceTracker() {
+    for (const auto& entry : edgeSources) {
+        if (reachable.count(entry.first.first) != 0)
+            ++entry.second->reachableEdges;
+    }
+
+    for (const auto& entry : counts) {
+        const char* context = entry.first.first;
+        const char* hook = entry.first.second;
+        string name = hook ? hook : "(unknown)";
+        if (context)
+            name = string(context) + "/" + name;
+
+        EdgeStats& total = provenance.hooks[name];
+        if (total.hook.empty())
+            total.hook = std::move(name);
+        total.references += entry.second.references;
+        total.newEdges += entry.second.newEdges;
+        total.duplicateEdges += entry.second.duplicateEdges;
+        total.reachableEdges += entry.second.reachableEdges;
+    }
+}
+
+void EdgeProvenanceTracker::addReference(const char* context, const char* hook,
+        clang::Decl* from, clang::Decl* to, ReferenceResult result)
+{
+    EdgeStats& hookCounts = counts[std::make_pair(context, hook)];
+    ++hookCounts.references;
+    if (result == ReferenceResult::NewEdge) {
+        ++hookCounts.newEdges;
+        edgeSources[std::make_pair(from, to)] = &hookCounts;
+    } else if (result == ReferenceResult::DuplicateEdge) {
+        ++hookCounts.duplicateEdges;
+    }
+}
+
+}
+}
+
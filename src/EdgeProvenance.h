@@ -0,0 +1,88 @@
+//                        Caide C++ inliner
+//
+// This file is distributed under the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version. See LICENSE.TXT for details.
+
+#pragma once
+
+#include "caideInliner.hpp"
+#include "SourceInfo.h"
+
+#include <llvm/ADT/DenseMap.h>
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace clang {
+    class Decl;
+}
+
+namespace caide {
+namespace internal {
+
+// Outcome of DependenciesCollector::insertReference().
+enum class ReferenceResult {
+    // Self reference, reference to or from a declaration that is not part of the graph, etc.
+    Ignored,
+    NewEdge,
+    DuplicateEdge,
+};
+
+// Counts of references inserted into the dependency graph by DependenciesCollector hooks
+// (CppInliner::edgeStats). While an enabled object exists, it is used by DependenciesCollector
+// objects created on the same thread.
+class EdgeProvenance {
+public:
+    // If enable is false, the object is not used.
+    explicit EdgeProvenance(bool enable);
+    ~EdgeProvenance();
+    EdgeProvenance(const EdgeProvenance&) = delete;
+    EdgeProvenance& operator=(const EdgeProvenance&) = delete;
+
+    // Hooks in order of decreasing number of new edges.
+    std::vector<EdgeStats> getResults() const;
+
+    // The enabled object of the calling thread, or null.
+    static EdgeProvenance* current();
+
+private:
+    friend class EdgeProvenanceTracker;
+
+    bool enabled;
+    EdgeProvenance* previous = nullptr;
+    // key: name of the hook.
+    std::map<std::string, EdgeStats> hooks;
+};
+
+// Counts references inserted by one DependenciesCollector. Results are added to EdgeProvenance
+// on destruction, when the set of reachable declarations is final.
+class EdgeProvenanceTracker {
+public:
+    EdgeProvenanceTracker(EdgeProvenance& provenance_, const DeclSet& reachable_);
+    ~EdgeProvenanceTracker();
+    EdgeProvenanceTracker(const EdgeProvenanceTracker&) = delete;
+    EdgeProvenanceTracker& operator=(const EdgeProvenanceTracker&) = delete;
+
+    // hook is the name of the hook making the reference, or null if it is not known. context is
+    // the name of the enclosing traversal that the hook has been called from, or null.
+    // For a new edge, from and to must be canonical declarations.
+    void addReference(const char* context, const char* hook,
+                      clang::Decl* from, clang::Decl* to, ReferenceResult result);
+
+private:
+    EdgeProvenance& provenance;
+    const DeclSet& reachable;
+
+    // key: context and hook; string literals are compared by address.
+    std::map<std::pair<const char*, const char*>, EdgeStats> counts;
+    // The hook that inserted each edge.
+    llvm::DenseMap<std::pair<clang::Decl*, clang::Decl*>, EdgeStats*> edgeSources;
+};
+
+}
+}
+
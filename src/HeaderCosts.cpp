@@ -0,0 +1,148 @@
+//                        Caide C++ inliner
+//
+// This file is distributed under the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version. See LICENSE.TXT for details.
+
+#include "HeaderCosts.h"
+#include "caideInliner.hpp"
+
+#include <clang/AST/Decl.h>
+#include <clang/AST/DeclBase.h>
+#include <clang/AST/DeclTemplate.h>
+#include <clang/Basic/SourceManager.h>
+
+#include <algorithm>
+
+
+using namespace clang;
+using std::string;
+using std::vector;
+
+
+namespace caide {
+namespace internal {
+
+static thread_local HeaderCosts* currentCosts = nullptr;
+
+HeaderCosts::HeaderCosts(bool enable)
+    : enabled(enable)
+{
+    if (enabled) {
+        previous = currentCosts;
+        currentCosts = this;
+    }
+}
+
+HeaderCosts::~HeaderCosts() {
+    if (enabled)
+        currentCosts = previous;
+}
+
+vector<HeaderStats> HeaderCosts::getResults() const {
+    vector<HeaderStats> results;
+    results.reserve(headers.size());
+    for (const auto& entry : headers)
+        results.push_back(entry.second);
+    // Stable sort keeps headers with equal costs ordered by path.
+    std::stable_sort(results.begin(), results.end(),
+        [](const HeaderStats& lhs, const HeaderStats& rhs) {
+            return lhs.preprocessingTime + lhs.parseTime > rhs.preprocessingTime + rhs.parseTime;
+        });
+    return results;
+}
+
+HeaderCosts* HeaderCosts::current() {
+    return currentCosts;
+}
+
+HeaderCostTracker::HeaderCostTracker(HeaderCosts& costs_, const SourceManager& sourceManager_,
+        TimeField time_)
+    : costs(costs_)
+    , sourceManager(sourceManager_)
+    , time(time_)
+    , lastEvent(Clock::now())
+{}
+
+void HeaderCostTracker::FileChanged(SourceLocation Loc, FileChangeReason Reason,
+        SrcMgr::CharacteristicKind /*FileType*/, FileID /*PrevFID*/)
+{
+    if (Reason == PPCallbacks::EnterFile) {
+        updateTime();
+        stack.push_back(getHeader(sourceManager.getFileID(Loc)));
+    } else if (Reason == PPCallbacks::ExitFile) {
+        updateTime();
+        if (!stack.empty())
+            stack.pop_back();
+    }
+}
+
+void HeaderCostTracker::EndOfMainFile() {
+    updateTime();
+    stack.clear();
+}
+
+void HeaderCostTracker::addDecl(const Decl* decl) {
+    if (!decl->isImplicit()) {
+        if (HeaderStats* header = getHeader(decl->getLocation()))
+            ++header->decls;
+    }
+    // Members of a template are nested in the templated declaration, which is not a child of
+    // any context and is not counted separately.
+    if (const auto* templateDecl = dyn_cast<TemplateDecl>(decl)) {
+        if (templateDecl->getTemplatedDecl())
+            decl = templateDecl->getTemplatedDecl();
+    }
+    if (const auto* declContext = dyn_cast<DeclContext>(decl)) {
+        for (const Decl* child : declContext->decls())
+            addDecl(child);
+    }
+}
+
+void HeaderCostTracker::addInstantiation(const Decl* pattern) {
+    if (!pattern)
+        return;
+    if (HeaderStats* header = getHeader(pattern->getLocation()))
+        ++header->instantiations;
+}
+
+HeaderStats* HeaderCostTracker::getHeader(SourceLocation loc) {
+    if (loc.isInvalid())
+        return nullptr;
+    return getHeader(sourceManager.getFileID(sourceManager.getExpansionLoc(loc)));
+}
+
+HeaderStats* HeaderCostTracker::getHeader(FileID fileID) {
+    auto it = headerByFileID.find(fileID);
+    if (it != headerByFileID.end())
+        return it->second;
+
+    HeaderStats* header = nullptr;
+    const FileEntry* entry = sourceManager.getFileEntryForID(fileID);
+    SourceLocation includeLoc = sourceManager.getIncludeLoc(fileID);
+    if (entry && fileID != sourceManager.getMainFileID() && includeLoc.isValid()) {
+        SourceLocation fileStart = sourceManager.getLocForStartOfFile(fileID);
+        string path = sourceManager.getFilename(fileStart).str();
+        header = &costs.headers[path];
+        if (header->path.empty()) {
+            header->path = std::move(path);
+            header->includedFrom = sourceManager.getFilename(includeLoc).str();
+            header->isSystem = sourceManager.isInSystemHeader(fileStart);
+            header->bytes = static_cast<std::uint64_t>(entry->getSize());
+        }
+    }
+
+    headerByFileID[fileID] = header;
+    return header;
+}
+
+void HeaderCostTracker::updateTime() {
+    const Clock::time_point now = Clock::now();
+    if (!stack.empty() && stack.back())
+        stack.back()->*time += std::chrono::duration_cast<std::chrono::nanoseconds>(now - lastEvent);
+    lastEvent = now;
+}
+
+}
+}
+
@@ -0,0 +1,100 @@
+//                        Caide C++ inliner
+//
+// This file is distributed under the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version. See LICENSE.TXT for details.
+
+#pragma once
+
+#include "caideInliner.hpp"
+
+#include <clang/Basic/SourceLocation.h>
+#include <clang/Lex/PPCallbacks.h>
+
+#include <llvm/ADT/DenseMap.h>
+
+#include <chrono>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace clang {
+    class Decl;
+    class SourceManager;
+}
+
+namespace caide {
+namespace internal {
+
+// Costs of individual headers (CppInliner::headerStats), accumulated over both stages. While
+// an enabled object exists, it is used by the inliner and the optimizer running on the same
+// thread.
+class HeaderCosts {
+public:
+    // If enable is false, the object is not used.
+    explicit HeaderCosts(bool enable);
+    ~HeaderCosts();
+    HeaderCosts(const HeaderCosts&) = delete;
+    HeaderCosts& operator=(const HeaderCosts&) = delete;
+
+    // Headers in order of decreasing cost.
+    std::vector<HeaderStats> getResults() const;
+
+    // The enabled object of the calling thread, or null.
+    static HeaderCosts* current();
+
+private:
+    friend class HeaderCostTracker;
+
+    bool enabled;
+    HeaderCosts* previous = nullptr;
+    // key: path of the header.
+    std::map<std::string, HeaderStats> headers;
+};
+
+// Attributes costs of one compilation to the headers. Time is attributed to the file at the top
+// of the include stack, as seen by preprocessor callbacks. Nothing is attributed to the main file.
+class HeaderCostTracker: public clang::PPCallbacks {
+public:
+    using TimeField = std::chrono::nanoseconds HeaderStats::*;
+
+    // Time spent in headers is added to the given field of HeaderStats.
+    HeaderCostTracker(HeaderCosts& costs_, const clang::SourceManager& sourceManager_,
+                      TimeField time_);
+
+    void FileChanged(clang::SourceLocation Loc, FileChangeReason Reason,
+                     clang::SrcMgr::CharacteristicKind FileType,
+                     clang::FileID PrevFID) override;
+
+    void EndOfMainFile() override;
+
+    // Counts the declaration and the declarations nested in it.
+    void addDecl(const clang::Decl* decl);
+
+    // Counts an implicit instantiation of a template whose pattern is the given declaration.
+    void addInstantiation(const clang::Decl* pattern);
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    // Header containing the location, or null for the main file and builtins.
+    HeaderStats* getHeader(clang::SourceLocation loc);
+    HeaderStats* getHeader(clang::FileID fileID);
+
+    // Attributes time since the last event to the top of the stack.
+    void updateTime();
+
+    HeaderCosts& costs;
+    const clang::SourceManager& sourceManager;
+    const TimeField time;
+
+    // Include stack; null entries are files that are not reported.
+    std::vector<HeaderStats*> stack;
+    Clock::time_point lastEvent;
+
+    llvm::DenseMap<clang::FileID, HeaderStats*> headerByFileID;
+};
+
+}
+}
+
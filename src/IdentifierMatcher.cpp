@@ -0,0 +1,261 @@
+//                        Caide C++ inliner
+//
+// This file is distributed under the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version. See LICENSE.TXT for details.
+
+#include "IdentifierMatcher.h"
+#include "clang_compat.h"
+
+#include <clang/AST/ASTContext.h>
+#include <clang/AST/Decl.h>
+#include <clang/AST/DeclCXX.h>
+#include <clang/AST/DeclTemplate.h>
+#include <clang/AST/RecursiveASTVisitor.h>
+#include <clang/Basic/SourceManager.h>
+
+#include <llvm/ADT/SmallString.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <cctype>
+#include <tuple>
+
+
+using namespace clang;
+
+namespace caide {
+namespace internal {
+
+namespace {
+
+const char anonymousNamespace[] = "(anonymous namespace)";
+
+bool isIdentifier(StringRef name) {
+    if (name.empty() || std::isdigit(static_cast<unsigned char>(name[0])))
+        return false;
+    for (char c : name) {
+        if (!std::isalnum(static_cast<unsigned char>(c)) && c != '_')
+            return false;
+    }
+    return true;
+}
+
+// Whether a trailing '*' of the name component is part of an operator name.
+bool isOperatorName(StringRef component) {
+    return component == "operator*" || component == "operator->*";
+}
+
+// Whether the qualified name contains a '<' that is not part of an operator name.
+bool hasTemplateArguments(StringRef qualifiedName) {
+    for (size_t i = 0; i < qualifiedName.size(); ++i) {
+        if (qualifiedName[i] != '<')
+            continue;
+        size_t start = i;
+        while (start > 0 && qualifiedName[start - 1] == '<')
+            --start;
+        if (qualifiedName.substr(0, start).rtrim().take_back(8) != "operator")
+            return true;
+    }
+    return false;
+}
+
+// Compares qualified names of main file declarations, including those in template
+// instantiations, with the given names.
+class PrintedNameMatcher: public RecursiveASTVisitor<PrintedNameMatcher> {
+public:
+    PrintedNameMatcher(const std::set<std::string>& names_, SourceManager& sourceManager_,
+            llvm::SmallPtrSetImpl<Decl*>& decls_)
+        : names(names_)
+        , sourceManager(sourceManager_)
+        , decls(decls_)
+    {}
+
+    bool shouldVisitImplicitCode() const { return true; }
+    bool shouldVisitTemplateInstantiations() const { return true; }
+
+    bool TraverseDecl(Decl* decl) {
+        // Top-level declarations coming from other files can't contain code of the main file.
+        if (decl && isa_and_nonnull<TranslationUnitDecl>(decl->getLexicalDeclContext())
+                && !sourceManager.isInMainFile(getBeginLoc(decl)))
+            return true;
+        return RecursiveASTVisitor<PrintedNameMatcher>::TraverseDecl(decl);
+    }
+
+    bool VisitNamedDecl(NamedDecl* decl) {
+        if (sourceManager.isInMainFile(getBeginLoc(decl))
+                && names.count(decl->getQualifiedNameAsString()) != 0)
+            decls.insert(decl);
+        return true;
+    }
+
+private:
+    const std::set<std::string>& names;
+    SourceManager& sourceManager;
+    llvm::SmallPtrSetImpl<Decl*>& decls;
+};
+
+// Declaration context in which members of decl are looked up.
+DeclContext* getMemberContext(NamedDecl* decl) {
+    if (auto* nsDecl = dyn_cast<NamespaceDecl>(decl))
+        return nsDecl;
+    if (auto* templateDecl = dyn_cast<ClassTemplateDecl>(decl))
+        decl = templateDecl->getTemplatedDecl();
+    if (auto* recordDecl = dyn_cast<CXXRecordDecl>(decl))
+        return recordDecl->getDefinition();
+    if (auto* enumDecl = dyn_cast<EnumDecl>(decl))
+        return enumDecl->getDefinition();
+    return nullptr;
+}
+
+// Calls f for members of dc whose name is equal to (or, if isPrefix is true, starts with) name.
+template<typename F>
+void forEachMember(DeclContext* dc, StringRef name, bool isPrefix, F f) {
+    if (!isPrefix && name == anonymousNamespace) {
+        NamespaceDecl* nsDecl = nullptr;
+        if (auto* tu = dyn_cast<TranslationUnitDecl>(dc))
+            nsDecl = tu->getAnonymousNamespace();
+        else if (auto* parentNs = dyn_cast<NamespaceDecl>(dc))
+            nsDecl = parentNs->getAnonymousNamespace();
+        if (nsDecl)
+            f(nsDecl);
+        return;
+    }
+
+    // Constructors have the same name as their class; they are not found by identifier lookup.
+    auto* recordDecl = dyn_cast<CXXRecordDecl>(dc);
+    const bool isConstructorName = recordDecl && recordDecl->getIdentifier()
+        && recordDecl->getName() == name;
+
+    if (!isPrefix && !isConstructorName && isIdentifier(name)) {
+        IdentifierTable& idents = cast<Decl>(dc)->getASTContext().Idents;
+        auto it = idents.find(name);
+        if (it == idents.end())
+            return;
+        for (NamedDecl* decl : dc->lookup(DeclarationName(it->getValue())))
+            f(decl);
+        return;
+    }
+
+    // Operators, destructors, constructors and wildcards: compare printed names.
+    llvm::SmallString<64> printedName;
+    for (DeclContextLookupResult result : dc->getPrimaryContext()->lookups()) {
+        for (NamedDecl* decl : result) {
+            printedName.clear();
+            llvm::raw_svector_ostream os(printedName);
+            os << decl->getDeclName();
+            const StringRef declName = os.str();
+            if (isPrefix ? declName.substr(0, name.size()) == name : declName == name)
+                f(decl);
+        }
+    }
+}
+
+void insertMainFileRedecls(Decl* decl, SourceManager& sourceManager,
+        llvm::SmallPtrSetImpl<Decl*>& decls)
+{
+    for (Decl* redecl : decl->redecls()) {
+        if (sourceManager.isInMainFile(getBeginLoc(redecl)))
+            decls.insert(redecl);
+    }
+}
+
+}
+
+IdentifierMatcher::IdentifierMatcher(const std::vector<std::string>& qualifiedNames) {
+    for (const std::string& qualifiedName : qualifiedNames) {
+        StringRef rest(qualifiedName);
+        rest = rest.trim();
+        if (rest.substr(0, 2) == "::")
+            rest = rest.drop_front(2);
+        if (rest.empty())
+            continue;
+
+        if (hasTemplateArguments(rest)) {
+            printedNames.insert(rest.str());
+            continue;
+        }
+
+        Node* node = &root;
+        while (true) {
+            StringRef component, tail;
+            std::tie(component, tail) = rest.split("::");
+            component = component.trim();
+
+            std::unique_ptr<Node>* child = nullptr;
+            if (!component.empty() && component.back() == '*' && !isOperatorName(component)) {
+                const std::string prefix = component.drop_back().str();
+                for (auto& wildcard : node->wildcardChildren) {
+                    if (wildcard.first == prefix)
+                        child = &wildcard.second;
+                }
+                if (!child) {
+                    node->wildcardChildren.emplace_back(prefix, nullptr);
+                    child = &node->wildcardChildren.back().second;
+                }
+            } else {
+                child = &node->children[component.str()];
+            }
+
+            if (!*child)
+                child->reset(new Node);
+            node = child->get();
+
+            if (tail.empty())
+                break;
+            rest = tail;
+        }
+        node->isTerminal = true;
+    }
+}
+
+bool IdentifierMatcher::empty() const {
+    return root.children.empty() && root.wildcardChildren.empty() && printedNames.empty();
+}
+
+void IdentifierMatcher::findDecls(TranslationUnitDecl* tu, llvm::SmallPtrSetImpl<Decl*>& decls) const {
+    if (empty())
+        return;
+    SourceManager& sourceManager = tu->getASTContext().getSourceManager();
+    findDecls(root, tu, sourceManager, decls);
+    if (!printedNames.empty()) {
+        PrintedNameMatcher matcher(printedNames, sourceManager, decls);
+        matcher.TraverseDecl(tu);
+    }
+}
+
+void IdentifierMatcher::findDecls(const Node& node, DeclContext* dc, SourceManager& sourceManager,
+        llvm::SmallPtrSetImpl<Decl*>& decls) const
+{
+    for (const auto& child : node.children) {
+        forEachMember(dc, child.first, /*isPrefix*/false, [&](NamedDecl* decl) {
+            onMatch(*child.second, decl, sourceManager, decls);
+        });
+    }
+    for (const auto& child : node.wildcardChildren) {
+        forEachMember(dc, child.first, /*isPrefix*/true, [&](NamedDecl* decl) {
+            onMatch(*child.second, decl, sourceManager, decls);
+        });
+    }
+}
+
+void IdentifierMatcher::onMatch(const Node& node, NamedDecl* decl, SourceManager& sourceManager,
+        llvm::SmallPtrSetImpl<Decl*>& decls) const
+{
+    if (node.isTerminal) {
+        insertMainFileRedecls(decl, sourceManager, decls);
+        if (auto* templateDecl = dyn_cast<TemplateDecl>(decl)) {
+            if (Decl* templatedDecl = templateDecl->getTemplatedDecl())
+                insertMainFileRedecls(templatedDecl, sourceManager, decls);
+        }
+    }
+
+    if (node.children.empty() && node.wildcardChildren.empty())
+        return;
+
+    if (DeclContext* memberContext = getMemberContext(decl))
+        findDecls(node, memberContext, sourceManager, decls);
+}
+
+}
+}
+
@@ -0,0 +1,72 @@
+//                        Caide C++ inliner
+//
+// This file is distributed under the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version. See LICENSE.TXT for details.
+
+#pragma once
+
+#include <llvm/ADT/SmallPtrSet.h>
+#include <llvm/ADT/StringRef.h>
+
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace clang {
+    class Decl;
+    class DeclContext;
+    class NamedDecl;
+    class SourceManager;
+    class TranslationUnitDecl;
+}
+
+namespace caide {
+namespace internal {
+
+// Fully qualified names from identifiersToKeep setting, parsed into a trie of name components.
+// A component ending with '*' matches all names starting with the rest of the component,
+// e.g. "ns::*" or "Class::get*". Names of operators ending with '*' (operator* and operator->*)
+// denote the operator, not a wildcard.
+//
+// Names with template arguments (e.g. "C<int>::f") can't be resolved by lookup; they are compared
+// with qualified names of all declarations in the main file, as before.
+class IdentifierMatcher {
+public:
+    IdentifierMatcher() = default;
+    explicit IdentifierMatcher(const std::vector<std::string>& qualifiedNames);
+    IdentifierMatcher(IdentifierMatcher&&) = default;
+    IdentifierMatcher& operator=(IdentifierMatcher&&) = default;
+    IdentifierMatcher(const IdentifierMatcher&) = delete;
+    IdentifierMatcher& operator=(const IdentifierMatcher&) = delete;
+
+    bool empty() const;
+
+    // Resolves the names by lookup, starting from the translation unit, and inserts
+    // main file redeclarations of the found declarations into decls.
+    void findDecls(clang::TranslationUnitDecl* tu, llvm::SmallPtrSetImpl<clang::Decl*>& decls) const;
+
+private:
+    struct Node {
+        // Whether some qualified name ends at this node.
+        bool isTerminal = false;
+        std::map<std::string, std::unique_ptr<Node>> children;
+        // Keys are prefixes of wildcard components.
+        std::vector<std::pair<std::string, std::unique_ptr<Node>>> wildcardChildren;
+    };
+
+    void findDecls(const Node& node, clang::DeclContext* dc, clang::SourceManager& sourceManager,
+            llvm::SmallPtrSetImpl<clang::Decl*>& decls) const;
+    void onMatch(const Node& node, clang::NamedDecl* decl, clang::SourceManager& sourceManager,
+            llvm::SmallPtrSetImpl<clang::Decl*>& decls) const;
+
+    Node root;
+    std::set<std::string> printedNames;
+};
+
+}
+}
+
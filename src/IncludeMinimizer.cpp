@@ -0,0 +1,310 @@
+//                        Caide C++ inliner
+//
+// This file is distributed under the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version. See LICENSE.TXT for details.
+
+#include "IncludeMinimizer.h"
+#include "SmartRewriter.h"
+
+#include <clang/AST/Decl.h>
+#include <clang/AST/DeclCXX.h>
+#include <clang/AST/DeclTemplate.h>
+#include <clang/Basic/SourceManager.h>
+#include <clang/Lex/MacroInfo.h>
+
+#include <llvm/ADT/DenseSet.h>
+#include <llvm/ADT/SmallVector.h>
+
+#include <map>
+#include <set>
+
+
+using namespace clang;
+using std::string;
+using std::vector;
+
+
+namespace caide {
+namespace internal {
+
+namespace {
+
+// Public standard headers have neither an extension nor a directory: <vector>, <cstdio>.
+bool looksLikePublicHeader(const string& spelledName) {
+    return !spelledName.empty() && spelledName[0] != '_'
+        && spelledName.find_first_of("./\\") == string::npos;
+}
+
+const Decl* getDefinition(const Decl* decl) {
+    if (const auto* tagDecl = dyn_cast<TagDecl>(decl))
+        return tagDecl->getDefinition();
+    if (const auto* functionDecl = dyn_cast<FunctionDecl>(decl)) {
+        const FunctionDecl* definition = nullptr;
+        return functionDecl->isDefined(definition) ? definition : nullptr;
+    }
+    if (const auto* varDecl = dyn_cast<VarDecl>(decl))
+        return varDecl->getDefinition();
+    if (const auto* templateDecl = dyn_cast<TemplateDecl>(decl)) {
+        if (const NamedDecl* templatedDecl = templateDecl->getTemplatedDecl())
+            return getDefinition(templatedDecl);
+    }
+    return nullptr;
+}
+
+class HeaderSelection {
+public:
+    HeaderSelection(const SourceManager& sourceManager_,
+            const llvm::DenseMap<const FileEntry*, string>& spelledNames_,
+            const vector<HoistedInclude>& hoistedIncludes)
+        : sourceManager(sourceManager_)
+        , mainFileID(sourceManager.getMainFileID())
+        , spelledNames(spelledNames_)
+    {
+        for (const HoistedInclude& include : hoistedIncludes) {
+            if (include.file)
+                hoistedDirectives.insert(std::make_pair(include.file, &include.directive));
+        }
+    }
+
+    void addDecl(const Decl* decl) {
+        if (const Decl* definition = getDefinition(decl)) {
+            if (addLocation(definition->getLocation()))
+                return;
+        }
+        for (const Decl* redecl : decl->redecls()) {
+            if (addLocation(redecl->getLocation()))
+                return;
+        }
+    }
+
+    // Returns false if the location is not in the main file and can't be attributed to a header.
+    bool addLocation(SourceLocation loc) {
+        if (loc.isInvalid())
+            return false;
+        FileID fileID = sourceManager.getFileID(sourceManager.getExpansionLoc(loc));
+        if (fileID == mainFileID)
+            return true;
+        FileID header = chooseHeader(fileID);
+        if (header.isInvalid())
+            return false;
+        selectedHeaders.insert(header);
+        return true;
+    }
+
+    string getPreamble() const {
+        string preamble;
+        llvm::DenseSet<const FileEntry*> emitted;
+        // FileIDs are allocated in the order of inclusion.
+        for (FileID header : selectedHeaders) {
+            const FileEntry* entry = sourceManager.getFileEntryForID(header);
+            if (!emitted.insert(entry).second)
+                continue;
+            if (isIncludedFromMainFile(header)) {
+                preamble += *hoistedDirectives.find(entry)->second;
+            } else {
+                preamble += "#include <";
+                preamble += spelledNames.find(entry)->second;
+                preamble += ">\n";
+            }
+        }
+        return preamble;
+    }
+
+private:
+    bool isIncludedFromMainFile(FileID fileID) const {
+        return sourceManager.getFileID(sourceManager.getIncludeLoc(fileID)) == mainFileID;
+    }
+
+    bool isPublicHeader(FileID fileID) const {
+        auto it = spelledNames.find(sourceManager.getFileEntryForID(fileID));
+        return it != spelledNames.end() && looksLikePublicHeader(it->second);
+    }
+
+    // The header to include for declarations in the given file, or an invalid FileID if the file
+    // is not included by a hoisted include directive (e.g. it is included with -include option
+    // or from an active preprocessor block, which is kept in place).
+    FileID chooseHeader(FileID fileID) {
+        auto it = chosenHeaders.find(fileID);
+        if (it != chosenHeaders.end())
+            return it->second;
+
+        // Include chain, from the given file to the file included from the main file.
+        llvm::SmallVector<FileID, 8> chain;
+        for (FileID cur = fileID; ; ) {
+            SourceLocation includeLoc = sourceManager.getIncludeLoc(cur);
+            if (includeLoc.isInvalid()) {
+                chain.clear();
+                break;
+            }
+            chain.push_back(cur);
+            FileID parent = sourceManager.getFileID(includeLoc);
+            if (parent == mainFileID)
+                break;
+            cur = parent;
+        }
+
+        FileID header;
+        if (!chain.empty() && hoistedDirectives.count(sourceManager.getFileEntryForID(chain.back()))) {
+            for (FileID candidate : chain) {
+                if (candidate == chain.back() || isPublicHeader(candidate)) {
+                    header = candidate;
+                    break;
+                }
+            }
+        }
+
+        chosenHeaders[fileID] = header;
+        return header;
+    }
+
+    const SourceManager& sourceManager;
+    const FileID mainFileID;
+    const llvm::DenseMap<const FileEntry*, string>& spelledNames;
+
+    // First hoisted directive for each included file.
+    llvm::DenseMap<const FileEntry*, const string*> hoistedDirectives;
+
+    std::map<FileID, FileID> chosenHeaders;
+    std::set<FileID> selectedHeaders;
+};
+
+}
+
+IncludeMinimizer::IncludeMinimizer(SourceManager& sourceManager_)
+    : sourceManager(sourceManager_)
+{}
+
+void IncludeMinimizer::onMacroUsage(const MacroInfo* info, SourceLocation loc) {
+    if (!info)
+        return;
+    const FileID mainFileID = sourceManager.getMainFileID();
+    loc = sourceManager.getExpansionLoc(loc);
+    if (sourceManager.getFileID(loc) != mainFileID)
+        return;
+    SourceLocation definitionLoc = info->getDefinitionLoc();
+    if (definitionLoc.isInvalid() || sourceManager.getFileID(definitionLoc) == mainFileID)
+        return;
+    macroUsages.emplace_back(loc, definitionLoc);
+}
+
+#if CAIDE_CLANG_VERSION_AT_LEAST(3,7)
+void IncludeMinimizer::MacroExpands(const Token& MacroNameTok, const MacroDefinition& MD,
+        SourceRange /*Range*/, const MacroArgs* /*Args*/)
+{
+    onMacroUsage(MD.getMacroInfo(), MacroNameTok.getLocation());
+}
+
+void IncludeMinimizer::Defined(const Token& MacroNameTok, const MacroDefinition& MD,
+        SourceRange /*Range*/)
+{
+    onMacroUsage(MD.getMacroInfo(), MacroNameTok.getLocation());
+}
+
+void IncludeMinimizer::Ifdef(SourceLocation /*Loc*/, const Token& MacroNameTok,
+        const MacroDefinition& MD)
+{
+    onMacroUsage(MD.getMacroInfo(), MacroNameTok.getLocation());
+}
+
+void IncludeMinimizer::Ifndef(SourceLocation /*Loc*/, const Token& MacroNameTok,
+        const MacroDefinition& MD)
+{
+    onMacroUsage(MD.getMacroInfo(), MacroNameTok.getLocation());
+}
+#else
+void IncludeMinimizer::MacroExpands(const Token& MacroNameTok, const MacroDirective* MD,
+        SourceRange /*Range*/, const MacroArgs* /*Args*/)
+{
+    onMacroUsage(MD ? MD->getMacroInfo() : nullptr, MacroNameTok.getLocation());
+}
+
+void IncludeMinimizer::Defined(const Token& MacroNameTok, const MacroDirective* MD,
+        SourceRange /*Range*/)
+{
+    onMacroUsage(MD ? MD->getMacroInfo() : nullptr, MacroNameTok.getLocation());
+}
+
+void IncludeMinimizer::Ifdef(SourceLocation /*Loc*/, const Token& MacroNameTok,
+        const MacroDirective* MD)
+{
+    onMacroUsage(MD ? MD->getMacroInfo() : nullptr, MacroNameTok.getLocation());
+}
+
+void IncludeMinimizer::Ifndef(SourceLocation /*Loc*/, const Token& MacroNameTok,
+        const MacroDirective* MD)
+{
+    onMacroUsage(MD ? MD->getMacroInfo() : nullptr, MacroNameTok.getLocation());
+}
+#endif
+
+void IncludeMinimizer::InclusionDirective(
+    SourceLocation /*HashLoc*/,
+    const Token& /*IncludeTok*/,
+    StringRef FileName,
+    bool IsAngled,
+    CharSourceRange /*FilenameRange*/,
+#if CAIDE_CLANG_VERSION_AT_LEAST(16, 0)
+    clang::OptionalFileEntryRef File,
+#elif CAIDE_CLANG_VERSION_AT_LEAST(15, 0)
+    llvm::Optional<FileEntryRef> File,
+#else
+    const FileEntry* File,
+#endif
+    StringRef /*SearchPath*/,
+    StringRef /*RelativePath*/,
+    const Module* /*SuggestedModule*/
+#if CAIDE_CLANG_VERSION_AT_LEAST(19, 0)
+    , bool /*ModuleImported*/
+#endif
+#if CAIDE_CLANG_VERSION_AT_LEAST(7, 0)
+    , SrcMgr::CharacteristicKind /*FileType*/
+#endif
+    )
+{
+#if CAIDE_CLANG_VERSION_AT_LEAST(15, 0)
+    const FileEntry* file = File.has_value() ? &File->getFileEntry() : nullptr;
+#else
+    const FileEntry* file = File;
+#endif
+    if (IsAngled && file)
+        spelledNames.insert(std::make_pair(file, FileName.str()));
+}
+
+string IncludeMinimizer::selectIncludes(const vector<HoistedInclude>& hoistedIncludes,
+        const SourceInfo& srcInfo, const DeclSet& usedDecls, const SmartRewriter& output) const
+{
+    HeaderSelection selection(sourceManager, spelledNames, hoistedIncludes);
+
+    const FileID mainFileID = sourceManager.getMainFileID();
+    for (const auto& entry : srcInfo.uses) {
+        Decl* from = entry.first;
+        if (usedDecls.count(from) == 0)
+            continue;
+        if (sourceManager.getFileID(sourceManager.getExpansionLoc(from->getLocation())) != mainFileID)
+            continue;
+        for (const Decl* to : entry.second) {
+            // Every header may (re)open a namespace.
+            if (!isa<NamespaceDecl>(to) && !isa<TranslationUnitDecl>(to) && !isa<LinkageSpecDecl>(to))
+                selection.addDecl(to);
+        }
+    }
+
+    for (const auto& entry : srcInfo.usedSystemDecls) {
+        if (usedDecls.count(entry.first) == 0)
+            continue;
+        for (const Decl* to : entry.second)
+            selection.addDecl(to);
+    }
+
+    for (const auto& usage : macroUsages) {
+        if (!output.isPartOfRangeRemoved(SourceRange(usage.first, usage.first)))
+            selection.addLocation(usage.second);
+    }
+
+    return selection.getPreamble();
+}
+
+}
+}
+
@@ -0,0 +1,109 @@
+//                        Caide C++ inliner
+//
+// This file is distributed under the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version. See LICENSE.TXT for details.
+
+#pragma once
+
+#include "clang_version.h"
+#include "RemoveInactivePreprocessorBlocks.h"
+#include "SourceInfo.h"
+
+#include <clang/Basic/SourceLocation.h>
+#include <clang/Lex/PPCallbacks.h>
+
+#include <llvm/ADT/DenseMap.h>
+
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace clang {
+    class FileEntry;
+    class MacroInfo;
+    class SourceManager;
+}
+
+namespace caide {
+namespace internal {
+
+class SmartRewriter;
+
+// Chooses system headers that supply declarations and macros used by the optimized code.
+//
+// A used declaration or macro is attributed to the deepest header in its include chain that
+// looks like a public standard header (<vector>, <cstdio>, but not <bits/stl_vector.h>), or to
+// the header included from the main file if there is no such header. The selection is a
+// heuristic; the optimizer checks that the result compiles.
+class IncludeMinimizer: public clang::PPCallbacks {
+public:
+    explicit IncludeMinimizer(clang::SourceManager& sourceManager_);
+
+#if CAIDE_CLANG_VERSION_AT_LEAST(3,7)
+    void MacroExpands(const clang::Token& MacroNameTok, const clang::MacroDefinition& MD,
+                      clang::SourceRange /*Range*/, const clang::MacroArgs* /*Args*/) override;
+    void Defined(const clang::Token& MacroNameTok, const clang::MacroDefinition& MD,
+                 clang::SourceRange /*Range*/) override;
+    void Ifdef(clang::SourceLocation /*Loc*/, const clang::Token& MacroNameTok,
+               const clang::MacroDefinition& MD) override;
+    void Ifndef(clang::SourceLocation /*Loc*/, const clang::Token& MacroNameTok,
+                const clang::MacroDefinition& MD) override;
+#else
+    void MacroExpands(const clang::Token& MacroNameTok, const clang::MacroDirective* MD,
+                      clang::SourceRange /*Range*/, const clang::MacroArgs* /*Args*/) override;
+    void Defined(const clang::Token& MacroNameTok, const clang::MacroDirective* MD,
+                 clang::SourceRange /*Range*/) override;
+    void Ifdef(clang::SourceLocation /*Loc*/, const clang::Token& MacroNameTok,
+               const clang::MacroDirective* MD) override;
+    void Ifndef(clang::SourceLocation /*Loc*/, const clang::Token& MacroNameTok,
+                const clang::MacroDirective* MD) override;
+#endif
+
+    void InclusionDirective(clang::SourceLocation /*HashLoc*/,
+                            const clang::Token& /*IncludeTok*/,
+                            llvm::StringRef FileName,
+                            bool IsAngled,
+                            clang::CharSourceRange /*FilenameRange*/,
+#if CAIDE_CLANG_VERSION_AT_LEAST(16, 0)
+                            clang::OptionalFileEntryRef File,
+#elif CAIDE_CLANG_VERSION_AT_LEAST(15, 0)
+                            llvm::Optional<clang::FileEntryRef> File,
+#else
+                            const clang::FileEntry *File,
+#endif
+                            llvm::StringRef /*SearchPath*/,
+                            llvm::StringRef /*RelativePath*/,
+                            const clang::Module* /*SuggestedModule*/
+#if CAIDE_CLANG_VERSION_AT_LEAST(19, 0)
+                            , bool /*ModuleImported*/
+#endif
+#if CAIDE_CLANG_VERSION_AT_LEAST(7, 0)
+                            , clang::SrcMgr::CharacteristicKind /*FileType*/
+#endif
+                            ) override;
+
+    // Returns the preamble for the output: include directives for headers that supply what
+    // main file declarations from usedDecls reference, and macros used outside of code removed
+    // in the output. Each directive is either a hoisted one or an angled include of a public
+    // header found inside a hoisted one. Directives are in the order of inclusion.
+    std::string selectIncludes(const std::vector<HoistedInclude>& hoistedIncludes,
+                               const SourceInfo& srcInfo, const DeclSet& usedDecls,
+                               const SmartRewriter& output) const;
+
+private:
+    void onMacroUsage(const clang::MacroInfo* info, clang::SourceLocation loc);
+
+    clang::SourceManager& sourceManager;
+
+    // Names of angled includes, as written in the directive.
+    llvm::DenseMap<const clang::FileEntry*, std::string> spelledNames;
+
+    // Usages in the main file of macros defined in other files: location of the usage and
+    // location of the definition.
+    std::vector<std::pair<clang::SourceLocation, clang::SourceLocation>> macroUsages;
+};
+
+}
+}
+
@@ -6,6 +6,7 @@
 
 #pragma once
 
+#include <cstddef>
 #include <functional>
 #include <map>
 
@@ -34,6 +35,10 @@ public:
         return intervals.end();
     }
 
+    std::size_t size() const {
+        return intervals.size();
+    }
+
     /// Add an interval [left, right], both ends inclusive.
     /// Assumes left <= right.
     void add(const Key& left, const Key& right) {
@@ -0,0 +1,147 @@
+//                        Caide C++ inliner
+//
+// This file is distributed under the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version. See LICENSE.TXT for details.
+
+#include "MainFileIndex.h"
+#include "caideInliner.hpp"
+#include "util.h"
+
+#include <clang/AST/ASTContext.h>
+#include <clang/Basic/SourceManager.h>
+#include <clang/Lex/Lexer.h>
+
+#include <algorithm>
+
+using namespace clang;
+
+namespace caide {
+namespace internal {
+
+MainFileIndex::MainFileIndex(SourceManager& sourceManager_, const LangOptions& langOptions_,
+        Stats& stats_)
+    : sourceManager(sourceManager_)
+    , langOptions(langOptions_)
+    , stats(stats_)
+{}
+
+void MainFileIndex::build() {
+    isBuilt = true;
+    mainFileID = sourceManager.getMainFileID();
+    fileStart = sourceManager.getLocForStartOfFile(mainFileID);
+
+    bool invalid = false;
+    buffer = sourceManager.getBufferData(mainFileID, &invalid);
+    if (invalid) {
+        buffer = StringRef();
+        return;
+    }
+
+    Lexer lexer(fileStart, langOptions, buffer.begin(), buffer.begin(), buffer.end());
+    Token tok;
+    while (true) {
+        lexer.LexFromRawLexer(tok);
+        ++stats.lexerCalls;
+        if (tok.is(tok::eof))
+            break;
+        tokenOffsets.push_back(sourceManager.getFileOffset(tok.getLocation()));
+        tokenKinds.push_back(tok.getKind());
+    }
+
+    // Line terminators are \n, \r, \r\n and \n\r, as in SourceManager.
+    lineOffsets.push_back(0);
+    const size_t n = buffer.size();
+    for (size_t i = 0; i < n; ++i) {
+        const char c = buffer[i];
+        if (c != '\n' && c != '\r')
+            continue;
+        if (i + 1 < n && (buffer[i + 1] == '\n' || buffer[i + 1] == '\r') && buffer[i + 1] != c)
+            ++i;
+        lineOffsets.push_back(static_cast<unsigned>(i + 1));
+    }
+}
+
+SourceLocation MainFileIndex::findTokenAfterLocation(SourceLocation loc, ASTContext& ctx,
+        tok::TokenKind tokenType)
+{
+    return findTokenAfterLocation(loc, ctx, tokenType, false);
+}
+
+SourceLocation MainFileIndex::findSemiAfterLocation(SourceLocation loc, ASTContext& ctx, bool isDecl) {
+    return findTokenAfterLocation(loc, ctx, tok::semi, isDecl);
+}
+
+SourceLocation MainFileIndex::findTokenAfterLocation(SourceLocation loc, ASTContext& ctx,
+        tok::TokenKind tokenType, bool isDecl)
+{
+    auto fallback = [&] {
+        ++stats.lexerCalls;
+        return tokenType == tok::semi
+            ? caide::internal::findSemiAfterLocation(loc, ctx, isDecl)
+            : caide::internal::findTokenAfterLocation(loc, ctx, tokenType);
+    };
+
+    if (!isBuilt)
+        build();
+
+    SourceLocation fileLoc = loc;
+    if (fileLoc.isMacroID() &&
+            !Lexer::isAtEndOfMacroExpansion(fileLoc, sourceManager, langOptions, &fileLoc))
+        return SourceLocation();
+
+    if (!fileLoc.isValid() || tokenOffsets.empty())
+        return fallback();
+
+    std::pair<FileID, unsigned> decomposed = sourceManager.getDecomposedLoc(fileLoc);
+    if (decomposed.first != mainFileID)
+        return fallback();
+
+    auto it = std::lower_bound(tokenOffsets.begin(), tokenOffsets.end(), decomposed.second);
+    if (it == tokenOffsets.end() || *it != decomposed.second) {
+        // Not a start of a token.
+        return fallback();
+    }
+
+    // A declaration may be followed by other tokens (e.g. __attribute__) before the semicolon.
+    for (size_t i = (it - tokenOffsets.begin()) + 1; i < tokenOffsets.size(); ++i) {
+        if (tokenKinds[i] == tokenType)
+            return fileStart.getLocWithOffset(tokenOffsets[i]);
+        if (!isDecl)
+            break;
+    }
+
+    return SourceLocation();
+}
+
+SourceLocation MainFileIndex::changeColumn(SourceLocation loc, unsigned col) {
+    if (!isBuilt)
+        build();
+
+    std::pair<FileID, unsigned> decomposedLoc = sourceManager.getDecomposedLoc(loc);
+    FileID fileId = decomposedLoc.first;
+    unsigned filePos = decomposedLoc.second;
+
+    if (fileId != mainFileID || lineOffsets.empty()) {
+        unsigned line = sourceManager.getLineNumber(fileId, filePos);
+        return sourceManager.translateLineCol(fileId, line, col);
+    }
+
+    // Same as SourceManager::translateLineCol.
+    auto it = std::upper_bound(lineOffsets.begin(), lineOffsets.end(), filePos);
+    const unsigned lineStart = *std::prev(it);
+    const size_t bufLength = buffer.size() - lineStart;
+    if (bufLength == 0)
+        return fileStart.getLocWithOffset(lineStart);
+
+    unsigned i = 0;
+    while (i < bufLength - 1 && i + 1 < col && buffer[lineStart + i] != '\n'
+            && buffer[lineStart + i] != '\r')
+        ++i;
+
+    return fileStart.getLocWithOffset(lineStart + i);
+}
+
+}
+}
+
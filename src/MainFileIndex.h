@@ -0,0 +1,71 @@
+//                        Caide C++ inliner
+//
+// This file is distributed under the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version. See LICENSE.TXT for details.
+
+#pragma once
+
+#include <clang/Basic/SourceLocation.h>
+#include <clang/Basic/TokenKinds.h>
+
+#include <llvm/ADT/StringRef.h>
+
+#include <vector>
+
+namespace clang {
+    class ASTContext;
+    class LangOptions;
+    class SourceManager;
+}
+
+namespace caide {
+
+struct Stats;
+
+namespace internal {
+
+// Raw tokens and line starts of the main file, computed once (on first use).
+// Queries about locations outside of the main file are forwarded to functions from util.h.
+class MainFileIndex {
+public:
+    MainFileIndex(clang::SourceManager& sourceManager, const clang::LangOptions& langOptions,
+            Stats& stats);
+    MainFileIndex(const MainFileIndex&) = delete;
+    MainFileIndex& operator=(const MainFileIndex&) = delete;
+
+    // Same as the corresponding functions from util.h.
+    clang::SourceLocation findTokenAfterLocation(clang::SourceLocation loc, clang::ASTContext& ctx,
+            clang::tok::TokenKind tokenType);
+    clang::SourceLocation findSemiAfterLocation(clang::SourceLocation loc, clang::ASTContext& ctx,
+            bool isDecl);
+
+    // Location in the same line as loc, with the given (1-based) column. If the line is too short,
+    // returns location of the end of line.
+    clang::SourceLocation changeColumn(clang::SourceLocation loc, unsigned col);
+
+private:
+    clang::SourceLocation findTokenAfterLocation(clang::SourceLocation loc, clang::ASTContext& ctx,
+            clang::tok::TokenKind tokenType, bool isDecl);
+    void build();
+
+    clang::SourceManager& sourceManager;
+    const clang::LangOptions& langOptions;
+    Stats& stats;
+
+    bool isBuilt = false;
+    clang::FileID mainFileID;
+    clang::SourceLocation fileStart;
+    llvm::StringRef buffer;
+
+    // Offsets and kinds of raw tokens, in increasing order of offsets.
+    std::vector<unsigned> tokenOffsets;
+    std::vector<clang::tok::TokenKind> tokenKinds;
+
+    // Offsets of line starts.
+    std::vector<unsigned> lineOffsets;
+};
+
+}
+}
+
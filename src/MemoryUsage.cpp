@@ -0,0 +1,63 @@
+//                        Caide C++ inliner
+//
+// This file is distributed under the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version. See LICENSE.TXT for details.
+
+#include "MemoryUsage.h"
+
+#include <clang/Basic/SourceManager.h>
+
+#if defined(__linux__) || defined(__APPLE__)
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+#include <cstdio>
+
+
+namespace caide {
+namespace internal {
+
+std::int64_t getResidentSetSize() {
+#ifdef __linux__
+    // Second field is the number of resident pages.
+    std::FILE* statm = std::fopen("/proc/self/statm", "r");
+    if (!statm)
+        return -1;
+    long long size = 0, resident = 0;
+    const int numRead = std::fscanf(statm, "%lld %lld", &size, &resident);
+    std::fclose(statm);
+    if (numRead != 2)
+        return -1;
+    return static_cast<std::int64_t>(resident) * sysconf(_SC_PAGESIZE);
+#else
+    return -1;
+#endif
+}
+
+std::int64_t getPeakResidentSetSize() {
+#if defined(__linux__) || defined(__APPLE__)
+    rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return -1;
+#ifdef __APPLE__
+    return static_cast<std::int64_t>(usage.ru_maxrss);
+#else
+    // Kilobytes on Linux.
+    return static_cast<std::int64_t>(usage.ru_maxrss) * 1024;
+#endif
+#else
+    return -1;
+#endif
+}
+
+std::uint64_t getSourceManagerMemory(const clang::SourceManager& sourceManager) {
+    const clang::SourceManager::MemoryBufferSizes buffers = sourceManager.getMemoryBufferSizes();
+    return buffers.malloc_bytes + buffers.mmap_bytes + sourceManager.getContentCacheSize()
+        + sourceManager.getDataStructureSizes();
+}
+
+}
+}
+
@@ -0,0 +1,44 @@
+//                        Caide C++ inliner
+//
+// This file is distributed under the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version. See LICENSE.TXT for details.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace clang {
+    class SourceManager;
+}
+
+namespace caide {
+namespace internal {
+
+// Resident set size of the process in bytes, or -1 if it is not available on this platform.
+std::int64_t getResidentSetSize();
+
+// Peak resident set size of the process in bytes, or -1 if it is not available on this platform.
+std::int64_t getPeakResidentSetSize();
+
+// Memory used by file buffers and internal tables of the SourceManager.
+std::uint64_t getSourceManagerMemory(const clang::SourceManager& sourceManager);
+
+// Approximate heap footprint of a node-based standard container (std::map, std::set):
+// each node holds the value, three pointers and the color.
+template<typename Value>
+std::uint64_t getNodeContainerMemory(std::size_t size) {
+    return size * (sizeof(Value) + 4 * sizeof(void*));
+}
+
+// Approximate heap footprint of a standard unordered container: the bucket array and
+// a node with the value, the next pointer and the cached hash for each element.
+template<typename Value>
+std::uint64_t getHashContainerMemory(std::size_t size, std::size_t bucketCount) {
+    return bucketCount * sizeof(void*) + size * (sizeof(Value) + 2 * sizeof(void*));
+}
+
+}
+}
+
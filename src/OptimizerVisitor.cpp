@@ -6,8 +6,11 @@
 
 #include "OptimizerVisitor.h"
 
+#include "caideInliner.hpp"
+#include "Cancellation.h"
 #include "clang_compat.h"
 #include "clang_version.h"
+#include "MainFileIndex.h"
 #include "SmartRewriter.h"
 #include "util.h"
 
@@ -29,11 +32,16 @@ namespace caide {
 namespace internal {
 
 
-OptimizerVisitor::OptimizerVisitor(SourceManager& srcManager, const std::unordered_set<Decl*>& usedDecls,
-            std::unordered_set<Decl*>& removedDecls, SmartRewriter& rewriter_)
+OptimizerVisitor::OptimizerVisitor(SourceManager& srcManager, const SourceInfo& srcInfo_,
+            const DeclSet& usedDecls, DeclSet& removedDecls, SmartRewriter& rewriter_,
+            MainFileIndex& mainFileIndex_, Stats& stats_, const Cancellation& cancellation_)
     : sourceManager(srcManager)
+    , srcInfo(srcInfo_)
     , usedDeclarations(usedDecls)
     , rewriter(rewriter_)
+    , mainFileIndex(mainFileIndex_)
+    , stats(stats_)
+    , cancellation(cancellation_)
     , removed(removedDecls)
 {}
 
@@ -43,6 +51,17 @@ bool OptimizerVisitor::shouldVisitImplicitCode() const { return false; }
 bool OptimizerVisitor::shouldVisitTemplateInstantiations() const { return false; }
 
 bool OptimizerVisitor::TraverseDecl(Decl* decl) {
+    if (cancellation.isRequested())
+        return false;
+
+    // Top-level declarations coming from other files can't contain code of the main file, so
+    // we don't descend into them.
+    if (decl && isa_and_nonnull<TranslationUnitDecl>(decl->getLexicalDeclContext())
+            && !sourceManager.isInMainFile(getBeginLoc(decl)))
+        return true;
+    if (decl)
+        ++stats.declsVisitedForRemoval;
+
 #ifdef CAIDE_DEBUG_MODE
     if (decl && sourceManager.isInMainFile(getBeginLoc(decl))) {
         dbg("DECL " << decl->getDeclKindName() << " " << decl
@@ -58,23 +77,96 @@ bool OptimizerVisitor::TraverseDecl(Decl* decl) {
         // We need to visit NamespaceDecl *after* visiting it children. Tree traversal is in
         // pre-order, so processing NamespaceDecl is done here instead of in VisitNamespaceDecl.
         if (auto* nsDecl = dyn_cast<NamespaceDecl>(decl)) {
-            if (nonEmptyLexicalNamespaces.find(nsDecl) == nonEmptyLexicalNamespaces.end())
+            if (nonEmptyLexicalNamespaces.count(nsDecl) == 0)
                 removeDecl(nsDecl);
         }
 
         if (auto* lexicalNamespace = dyn_cast_or_null<NamespaceDecl>(decl->getLexicalDeclContext())) {
             // Lexical context of template parameters of template type aliases is the namespace
-            if (removed.find(decl) == removed.end() && !isa<TemplateTypeParmDecl>(decl))
+            if (removed.count(decl) == 0 && !isa<TemplateTypeParmDecl>(decl))
             {
                 dbg("Marking the parent namespace as non-empty" << std::endl);
                 nonEmptyLexicalNamespaces.insert(lexicalNamespace);
             }
         }
+
+        // At this point, it is known whether decl is removed.
+        if (removed.count(decl) == 0)
+            onDeclClosed(decl);
+        else if (auto* nsDecl = dyn_cast<NamespaceDecl>(decl))
+            onNamespaceRemoved(nsDecl);
     }
 
     return ret;
 }
 
+// Adjacent namespaces with the same name are merged:
+//
+//     namespace ns { ... }            namespace ns {
+//     /* removed code */      ==>         ...
+//     namespace ns { ... }                ...
+//                                     }
+//
+// We maintain the stack of non-removed namespaces that were closed most recently 'in a row' (without
+// non-removed declarations between closing braces). When a namespace is opened, it is merged with
+// the namespace at the top of the stack. Whether the opened namespace itself is removed is only known
+// after traversal of its children, so the merge is recorded as pending until then.
+void OptimizerVisitor::onNamespaceOpened(NamespaceDecl* nsDecl) {
+    if (removed.count(nsDecl) != 0 || closedNamespaces.empty())
+        return;
+
+    NamespaceDecl* previous = closedNamespaces.back();
+    if (previous->getCanonicalDecl() == nsDecl->getCanonicalDecl()) {
+        closedNamespaces.pop_back();
+        pendingMerges.push_back(std::make_pair(nsDecl, previous));
+    }
+}
+
+void OptimizerVisitor::onDeclClosed(Decl* decl) {
+    if (auto* nsDecl = dyn_cast<NamespaceDecl>(decl)) {
+        if (!pendingMerges.empty() && pendingMerges.back().first == nsDecl) {
+            mergeWithPreviousNamespace(nsDecl, pendingMerges.back().second);
+            pendingMerges.pop_back();
+        }
+        closedNamespaces.push_back(nsDecl);
+        return;
+    }
+
+    auto* parentContext = decl->getLexicalDeclContext();
+    // Note: a type alias is not a declaration context, so the lexical context of its template
+    // arguments is the enclosing namespace/class/function etc. It means that this check may give a
+    // false positive. So we skip TemplateTypeParmDecl (it's always attached to another Decl anyway).
+    // We also skip non-top-level Decls (they might have been removed as part of a parent Decl).
+    if (!isa<TemplateTypeParmDecl>(decl) &&
+        (isa<NamespaceDecl>(parentContext) || isa<TranslationUnitDecl>(parentContext)))
+    {
+        // A non-removed declaration interrupts the chain of closed namespaces
+        closedNamespaces.clear();
+    }
+}
+
+void OptimizerVisitor::onNamespaceRemoved(NamespaceDecl* nsDecl) {
+    // A removed namespace doesn't contain non-removed declarations, so the stack hasn't changed
+    // since the namespace was opened. Undo the pending merge.
+    if (!pendingMerges.empty() && pendingMerges.back().first == nsDecl) {
+        closedNamespaces.push_back(pendingMerges.back().second);
+        pendingMerges.pop_back();
+    }
+}
+
+void OptimizerVisitor::mergeWithPreviousNamespace(NamespaceDecl* nsDecl, NamespaceDecl* previous) {
+    SourceLocation closingBraceLoc = previous->getRBraceLoc();
+    rewriter.removeRange(closingBraceLoc, closingBraceLoc);
+
+    ASTContext& astContext = nsDecl->getASTContext();
+    SourceLocation thisNamespaceNameStart =
+        mainFileIndex.findTokenAfterLocation(getBeginLoc(nsDecl), astContext, tok::raw_identifier);
+    SourceLocation thisNamespaceOpeningBrace =
+        mainFileIndex.findTokenAfterLocation(thisNamespaceNameStart, astContext, tok::l_brace);
+
+    rewriter.removeRange(getBeginLoc(nsDecl), thisNamespaceOpeningBrace);
+}
+
 bool OptimizerVisitor::VisitEmptyDecl(EmptyDecl* decl) {
     if (sourceManager.isInMainFile(getBeginLoc(decl)))
         removeDecl(decl);
@@ -127,13 +219,15 @@ bool OptimizerVisitor::VisitVarTemplateDecl(VarTemplateDecl* varTemplateDecl) {
 }
 
 bool OptimizerVisitor::VisitNamespaceDecl(NamespaceDecl* nsDecl) {
-    if (sourceManager.isInMainFile(getBeginLoc(nsDecl))
-        && usedDeclarations.count(nsDecl->getCanonicalDecl()) == 0)
-    {
+    if (!sourceManager.isInMainFile(getBeginLoc(nsDecl)))
+        return true;
+
+    if (usedDeclarations.count(nsDecl->getCanonicalDecl()) == 0)
         removeDecl(nsDecl);
-    }
     // The case when nsDecl is semantically used but this specific decl must be removed
     // is handled in TraverseDecl
+
+    onNamespaceOpened(nsDecl);
     return true;
 }
 
@@ -178,7 +272,7 @@ bool OptimizerVisitor::needToRemoveFunction(FunctionDecl* functionDecl) const {
     FunctionDecl* canonicalDecl = functionDecl->getCanonicalDecl();
     const bool funcIsUnused = usedDeclarations.count(canonicalDecl) == 0;
     const bool thisIsRedeclaration = !functionDecl->doesThisDeclarationHaveABody()
-            && declared.find(canonicalDecl) != declared.end();
+            && declared.count(canonicalDecl) != 0;
     const bool thisIsFriendDeclaration = functionDecl->getFriendObjectKind() != Decl::FOK_None;
     // TODO: Are we actually used by this friend?
     return funcIsUnused || (thisIsRedeclaration && !thisIsFriendDeclaration);
@@ -217,7 +311,7 @@ bool OptimizerVisitor::VisitCXXRecordDecl(CXXRecordDecl* recordDecl) {
     dbg(CAIDE_FUNC);
 
     if (ClassTemplateDecl* classTemplate = recordDecl->getDescribedClassTemplate()) {
-        if (removed.find(classTemplate) != removed.end())
+        if (removed.count(classTemplate) != 0)
             removeDecl(recordDecl);
         const TemplateSpecializationKind specKind = recordDecl->getTemplateSpecializationKind();
         if (specKind == TSK_Undeclared) {
@@ -230,7 +324,7 @@ bool OptimizerVisitor::VisitCXXRecordDecl(CXXRecordDecl* recordDecl) {
     CXXRecordDecl* canonicalDecl = recordDecl->getCanonicalDecl();
     const bool classIsUnused = usedDeclarations.count(canonicalDecl) == 0;
     const bool thisIsRedeclaration = !recordDecl->isCompleteDefinition()
-        && declared.find(canonicalDecl) != declared.end();
+        && declared.count(canonicalDecl) != 0;
 
     if (classIsUnused || thisIsRedeclaration)
         removeDecl(recordDecl);
@@ -247,7 +341,7 @@ bool OptimizerVisitor::VisitClassTemplateDecl(ClassTemplateDecl* templateDecl) {
     ClassTemplateDecl* canonicalDecl = templateDecl->getCanonicalDecl();
     const bool classIsUnused = usedDeclarations.count(canonicalDecl) == 0;
     const bool thisIsRedeclaration = !templateDecl->isThisDeclarationADefinition()
-        && declared.find(canonicalDecl) != declared.end();
+        && declared.count(canonicalDecl) != 0;
     const bool thisIsFriendDeclaration = templateDecl->getFriendObjectKind() != Decl::FOK_None;
 
     // TODO: Are we actually used by this friend?
@@ -369,7 +463,7 @@ bool OptimizerVisitor::VisitVarDecl(VarDecl* varDecl) {
         return true;
     }
 
-    variables[start].push_back(varDecl);
+    variables[start.getRawEncoding()].push_back(varDecl);
     /*
     Technically, we cannot remove global static variables because
     their initializers may have side effects.
@@ -399,7 +493,7 @@ bool OptimizerVisitor::VisitFieldDecl(clang::FieldDecl* fieldDecl) {
         return true;
 
     // Note: comments from VisitVarDecl apply to fields too.
-    variables[start].push_back(fieldDecl);
+    variables[start.getRawEncoding()].push_back(fieldDecl);
     if (usedDeclarations.count(fieldDecl) == 0)
         removed.insert(fieldDecl);
     return true;
@@ -416,17 +510,26 @@ void OptimizerVisitor::removeDecl(Decl* decl) {
     // HACK: End locations of some decls (FunctionDecl in particular) may be wrong.
     // Since most decls are terminated by a semicolon, we use it as end location.
     bool forwardToSemicolon = true;
+    FunctionDecl* functionDecl = nullptr;
     if (isa<NamespaceDecl>(decl) || isa<EmptyDecl>(decl)) {
         forwardToSemicolon = false;
-    } else if (auto* functionDecl = dyn_cast<FunctionDecl>(decl)) {
+    } else if ((functionDecl = dyn_cast<FunctionDecl>(decl))) {
         forwardToSemicolon = !functionDecl->isThisDeclarationADefinition();
     } else if (auto* functionTemplateDecl = dyn_cast<FunctionTemplateDecl>(decl)) {
         forwardToSemicolon = !functionTemplateDecl->isThisDeclarationADefinition();
+        functionDecl = functionTemplateDecl->getTemplatedDecl();
+    }
+
+    if (functionDecl) {
+        // Source range of a delayed parsed function that hasn't been parsed doesn't include the body.
+        auto it = srcInfo.unparsedBodyEnds.find(functionDecl);
+        if (it != srcInfo.unparsedBodyEnds.end())
+            end = sourceManager.getExpansionLoc(it->second);
     }
 
     SourceLocation semicolonAfterDefinition;
     if (forwardToSemicolon) {
-        semicolonAfterDefinition = findSemiAfterLocation(end, decl->getASTContext(), true);
+        semicolonAfterDefinition = mainFileIndex.findSemiAfterLocation(end, decl->getASTContext(), true);
     }
 
     dbg("REMOVE " << decl->getDeclKindName() << " "
@@ -444,8 +547,8 @@ void OptimizerVisitor::removeDecl(Decl* decl) {
 
 void OptimizerVisitor::Finalize(ASTContext& ctx) {
     for (const auto& kv : variables) {
-        SourceLocation startOfType = kv.first;
-        const vector<DeclaratorDecl*>& vars = kv.second;
+        SourceLocation startOfType = SourceLocation::getFromRawEncoding(kv.first);
+        const auto& vars = kv.second;
 
         const size_t n = vars.size();
         vector<bool> isUsed(n, true);
@@ -460,7 +563,7 @@ void OptimizerVisitor::Finalize(ASTContext& ctx) {
 
         if (lastUsed == n) {
             // all variables are unused
-            SourceLocation semiColon = findSemiAfterLocation(endOfLastVar, ctx, true);
+            SourceLocation semiColon = mainFileIndex.findSemiAfterLocation(endOfLastVar, ctx, true);
             rewriter.removeRange(startOfType, semiColon);
         } else {
             for (size_t i = 0; i < lastUsed; ++i) if (!isUsed[i]) {
@@ -472,7 +575,7 @@ void OptimizerVisitor::Finalize(ASTContext& ctx) {
 
                 if (i+1 < n) {
                     // comma
-                    end = findTokenAfterLocation(end, ctx, tok::comma);
+                    end = mainFileIndex.findTokenAfterLocation(end, ctx, tok::comma);
                 }
 
                 if (beg.isValid() && end.isValid())
@@ -481,7 +584,7 @@ void OptimizerVisitor::Finalize(ASTContext& ctx) {
             if (lastUsed + 1 != n) {
                 // clear all remaining variables, starting with comma
                 SourceLocation end = getExpansionEnd(sourceManager, vars[lastUsed]);
-                SourceLocation comma = findTokenAfterLocation(end, ctx, tok::comma);
+                SourceLocation comma = mainFileIndex.findTokenAfterLocation(end, ctx, tok::comma);
                 rewriter.removeRange(comma, endOfLastVar);
             }
         }
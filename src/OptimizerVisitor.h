@@ -7,15 +7,17 @@
 #pragma once
 
 #include "clang_version.h"
+#include "SourceInfo.h"
 
 #include <clang/AST/RecursiveASTVisitor.h>
 #include <clang/Basic/SourceLocation.h>
 
-#include <map>
-#include <string>
-#include <unordered_map>
-#include <unordered_set>
-#include <vector>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/MapVector.h>
+#include <llvm/ADT/SmallPtrSet.h>
+#include <llvm/ADT/SmallVector.h>
+
+#include <utility>
 
 
 namespace clang {
@@ -24,16 +26,22 @@ namespace clang {
 }
 
 namespace caide {
+
+struct Stats;
+
 namespace internal {
 
 
+class Cancellation;
+class MainFileIndex;
 class SmartRewriter;
 
 
 class OptimizerVisitor: public clang::RecursiveASTVisitor<OptimizerVisitor> {
 public:
-    OptimizerVisitor(clang::SourceManager& srcManager, const std::unordered_set<clang::Decl*>& usedDecls,
-            std::unordered_set<clang::Decl*>& removedDecls, SmartRewriter& rewriter_);
+    OptimizerVisitor(clang::SourceManager& srcManager, const SourceInfo& srcInfo_,
+            const DeclSet& usedDecls, DeclSet& removedDecls, SmartRewriter& rewriter_,
+            MainFileIndex& mainFileIndex_, Stats& stats_, const Cancellation& cancellation_);
 
     bool shouldVisitImplicitCode() const;
     bool shouldVisitTemplateInstantiations() const;
@@ -74,25 +82,44 @@ private:
     // Return value is true when this using declaration is redundant.
     bool processUsingDirective(clang::Decl* canonicalDecl, clang::DeclContext* declContext);
 
+    // Merging of adjacent namespaces. \sa onNamespaceOpened().
+    void onNamespaceOpened(clang::NamespaceDecl* nsDecl);
+    void onNamespaceRemoved(clang::NamespaceDecl* nsDecl);
+    void onDeclClosed(clang::Decl* nonRemovedDecl);
+    void mergeWithPreviousNamespace(clang::NamespaceDecl* nsDecl, clang::NamespaceDecl* previous);
+
 
     clang::SourceManager& sourceManager;
-    const std::unordered_set<clang::Decl*>& usedDeclarations;
+    const SourceInfo& srcInfo;
+    const DeclSet& usedDeclarations;
     SmartRewriter& rewriter;
+    MainFileIndex& mainFileIndex;
+    Stats& stats;
+    const Cancellation& cancellation;
 
-    std::unordered_set<clang::Decl*> declared;
-    std::unordered_set<clang::Decl*>& removed;
+    DeclSet declared;
+    DeclSet& removed;
 
     // Parent namespaces of non-removed Decls
-    std::unordered_set<clang::NamespaceDecl*> nonEmptyLexicalNamespaces;
+    llvm::SmallPtrSet<clang::NamespaceDecl*, 16> nonEmptyLexicalNamespaces;
 
     // For each semantic declaraction context, keep track of which namespaces have been seen in
     // 'using namespace ns;' directives in this declaraction context (TODO: and which identifiers
     // have been seen in 'using ns::identifier' declaractions).
-    std::unordered_map<clang::DeclContext*, std::unordered_set<clang::Decl*>> seenInUsingDirectives;
+    llvm::DenseMap<clang::DeclContext*, llvm::SmallPtrSet<clang::Decl*, 4>> seenInUsingDirectives;
+
+    // Declarations of fields and static variables, grouped by the raw encoding of their start
+    // location (so comma separated declarations go into the same group). Groups are in traversal
+    // order; Finalize() handles each group independently, so their order doesn't matter.
+    llvm::MapVector<unsigned, llvm::SmallVector<clang::DeclaratorDecl*, 2>> variables;
+
+    // The stack of non-removed lexical namespaces that were closed most recently 'in a row' (without
+    // non-removed declarations between closing braces).
+    llvm::SmallVector<clang::NamespaceDecl*, 8> closedNamespaces;
 
-    // Declarations of fields and static variables, grouped by their start location
-    // (so comma separated declarations go into the same group).
-    std::map<clang::SourceLocation, std::vector<clang::DeclaratorDecl*>> variables;
+    // Namespaces that are being traversed and will be merged with the previous namespace
+    // (second element of the pair) unless they are removed.
+    llvm::SmallVector<std::pair<clang::NamespaceDecl*, clang::NamespaceDecl*>, 8> pendingMerges;
 };
 
 
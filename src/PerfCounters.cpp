@@ -0,0 +1,115 @@
+//                        Caide C++ inliner
+//
+// This file is distributed under the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version. See LICENSE.TXT for details.
+
+#include "PerfCounters.h"
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cstring>
+#endif
+
+
+namespace caide {
+namespace internal {
+
+static thread_local const PerfCounters* currentCounters = nullptr;
+
+#ifdef __linux__
+
+static int openCounter(std::uint64_t config, int groupFd) {
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config;
+    attr.read_format = PERF_FORMAT_GROUP;
+    // User space only: this is allowed with the default perf_event_paranoid setting.
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, groupFd, 0));
+}
+
+PerfCounters::PerfCounters(bool enable) {
+    static const std::uint64_t configs[NUM_COUNTERS] = {PERF_COUNT_HW_CPU_CYCLES,
+        PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+    for (int i = 0; i < NUM_COUNTERS; ++i) {
+        fds[i] = -1;
+        positions[i] = -1;
+    }
+    if (!enable)
+        return;
+
+    for (int i = 0; i < NUM_COUNTERS; ++i) {
+        fds[i] = openCounter(configs[i], fds[CYCLES]);
+        if (fds[i] >= 0)
+            positions[i] = numOpened++;
+        else if (i == CYCLES)
+            return;
+    }
+
+    previous = currentCounters;
+    currentCounters = this;
+}
+
+PerfCounters::~PerfCounters() {
+    if (!isAvailable())
+        return;
+    currentCounters = previous;
+    for (int fd : fds) {
+        if (fd >= 0)
+            close(fd);
+    }
+}
+
+bool PerfCounters::read(PerfCounterValues& values) const {
+    if (!isAvailable())
+        return false;
+
+    // PERF_FORMAT_GROUP layout: number of counters, followed by their values.
+    std::uint64_t buf[1 + NUM_COUNTERS];
+    const ssize_t expectedSize = static_cast<ssize_t>(sizeof(std::uint64_t) * (1 + numOpened));
+    if (::read(fds[CYCLES], buf, sizeof(buf)) != expectedSize)
+        return false;
+
+    auto get = [&](int counter) -> std::uint64_t {
+        return positions[counter] >= 0 ? buf[1 + positions[counter]] : 0;
+    };
+    values.cycles = get(CYCLES);
+    values.instructions = get(INSTRUCTIONS);
+    values.cacheMisses = get(CACHE_MISSES);
+    values.branchMisses = get(BRANCH_MISSES);
+    return true;
+}
+
+#else
+
+PerfCounters::PerfCounters(bool /*enable*/) {
+    for (int i = 0; i < NUM_COUNTERS; ++i) {
+        fds[i] = -1;
+        positions[i] = -1;
+    }
+    (void)numOpened;
+    (void)previous;
+}
+
+PerfCounters::~PerfCounters() = default;
+
+bool PerfCounters::read(PerfCounterValues& /*values*/) const {
+    return false;
+}
+
+#endif
+
+const PerfCounters* PerfCounters::current() {
+    return currentCounters;
+}
+
+}
+}
+
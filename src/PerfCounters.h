@@ -0,0 +1,55 @@
+//                        Caide C++ inliner
+//
+// This file is distributed under the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version. See LICENSE.TXT for details.
+
+#pragma once
+
+#include <cstdint>
+
+namespace caide {
+namespace internal {
+
+struct PerfCounterValues {
+    std::uint64_t cycles = 0;
+    std::uint64_t instructions = 0;
+    std::uint64_t cacheMisses = 0;
+    std::uint64_t branchMisses = 0;
+};
+
+// Hardware performance counters of the calling thread (perf_event_open on Linux). While an
+// object exists, it is used by ScopedTimer objects created on the same thread. If counters are
+// not supported or not permitted (e.g. perf_event_paranoid in a container), the object is
+// unavailable and timers record wall time only.
+class PerfCounters {
+public:
+    // If enable is false, the object is unavailable.
+    explicit PerfCounters(bool enable);
+    ~PerfCounters();
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    bool isAvailable() const { return fds[0] >= 0; }
+
+    // Current values, counting from an arbitrary moment. Counters that could not be opened
+    // are zero. Returns false if the object is unavailable or reading fails.
+    bool read(PerfCounterValues& values) const;
+
+    // The available object of the calling thread, or null.
+    static const PerfCounters* current();
+
+private:
+    enum { CYCLES, INSTRUCTIONS, CACHE_MISSES, BRANCH_MISSES, NUM_COUNTERS };
+
+    // fds[CYCLES] is the group leader; other counters are optional.
+    int fds[NUM_COUNTERS];
+    // Position of each counter in the group, or -1.
+    int positions[NUM_COUNTERS];
+    int numOpened = 0;
+    const PerfCounters* previous = nullptr;
+};
+
+}
+}
+
@@ -5,20 +5,23 @@
 // option) any later version. See LICENSE.TXT for details.
 
 #include "RemoveInactivePreprocessorBlocks.h"
+#include "caideInliner.hpp"
+#include "MainFileIndex.h"
 #include "SmartRewriter.h"
 #include "util.h"
 
 #include <clang/Basic/SourceManager.h>
 #include <clang/Lex/Preprocessor.h>
 
-#include <map>
+#include <llvm/ADT/DenseMap.h>
+
+#include <algorithm>
 #include <set>
 #include <string>
 #include <vector>
 
 
 using namespace clang;
-using std::map;
 using std::set;
 using std::string;
 using std::vector;
@@ -46,9 +49,22 @@ struct IfDefClause {
 
 struct Macro {
     SourceRange definition;
-    vector<SourceRange> usages;
     SourceLocation undefinition;
     bool isWhitelisted = false;
+    // Some usage is not in the main file, so we can't track whether it's removed.
+    bool hasUntrackedUsages = false;
+};
+
+// Expansion of a macro, as offsets in the main file (both ends inclusive).
+struct MacroUsage {
+    unsigned begin;
+    unsigned end;
+    // Index of the macro in RemoveInactivePreprocessorBlocksImpl::macros.
+    unsigned macroIndex;
+
+    bool operator<(const MacroUsage& other) const {
+        return begin < other.begin;
+    }
 };
 
 struct RemoveInactivePreprocessorBlocks::RemoveInactivePreprocessorBlocksImpl {
@@ -56,15 +72,24 @@ private:
     SourceManager& sourceManager;
     const LangOptions& langOptions;
     SmartRewriter& rewriter;
+    MainFileIndex& mainFileIndex;
     const set<string>& macrosToKeep;
+    Stats& stats;
 
     vector<IfDefClause> activeClauses;
 
-    // Currently defined macros
-    map<const MacroDirective*, Macro> definedMacros;
+    // All macros defined in the main file.
+    vector<Macro> macros;
+
+    // Currently defined macros; values are indices in macros vector.
+    llvm::DenseMap<const MacroDirective*, unsigned> definedMacros;
+
+    // Usages of all macros, in the order of expansion.
+    vector<MacroUsage> usages;
+
+public:
+    vector<HoistedInclude> hoistedIncludes;
 
-    // Macros that were #defined, and then #undefined.
-    vector<Macro> undefinedMacros;
 private:
     bool isWhitelistedMacro(const string& macroName) const {
         return macrosToKeep.find(macroName) != macrosToKeep.end();
@@ -78,11 +103,14 @@ private:
 public:
     RemoveInactivePreprocessorBlocksImpl(
             SourceManager& sourceManager_, const LangOptions& langOptions_,
-            SmartRewriter& rewriter_, const set<string>& macrosToKeep_)
+            SmartRewriter& rewriter_, MainFileIndex& mainFileIndex_, const set<string>& macrosToKeep_,
+            Stats& stats_)
         : sourceManager(sourceManager_)
         , langOptions(langOptions_)
         , rewriter(rewriter_)
+        , mainFileIndex(mainFileIndex_)
         , macrosToKeep(macrosToKeep_)
+        , stats(stats_)
     {
     }
 
@@ -102,7 +130,9 @@ public:
             Macro macro;
             macro.definition = SourceRange(b, e);
             macro.isWhitelisted = isWhitelisted;
-            definedMacros[MD] = std::move(macro);
+            definedMacros[MD] = static_cast<unsigned>(macros.size());
+            macros.push_back(std::move(macro));
+            ++stats.macrosTracked;
         }
     }
 
@@ -112,8 +142,7 @@ public:
 
         auto it = definedMacros.find(MD);
         if (it != definedMacros.end()) {
-            it->second.undefinition = MacroNameTok.getLocation();
-            undefinedMacros.push_back(it->second);
+            macros[it->second].undefinition = MacroNameTok.getLocation();
             definedMacros.erase(it);
         }
     }
@@ -122,7 +151,30 @@ public:
         if (!MD || !isInMainFile(MD->getLocation()))
             return;
 
-        definedMacros[MD].usages.push_back(Range);
+        auto it = definedMacros.find(MD);
+        if (it == definedMacros.end())
+            return;
+
+        const unsigned macroIndex = it->second;
+        std::pair<FileID, unsigned> b = sourceManager.getDecomposedExpansionLoc(Range.getBegin());
+        std::pair<FileID, unsigned> e = sourceManager.getDecomposedExpansionLoc(Range.getEnd());
+        const FileID mainFileID = sourceManager.getMainFileID();
+        if (b.first != mainFileID || e.first != mainFileID)
+            macros[macroIndex].hasUntrackedUsages = true;
+        else
+            usages.push_back(MacroUsage{b.second, e.second, macroIndex});
+    }
+
+    std::uint64_t getMemorySize() const {
+        std::uint64_t size = activeClauses.capacity() * sizeof(IfDefClause)
+            + macros.capacity() * sizeof(Macro) + definedMacros.getMemorySize()
+            + usages.capacity() * sizeof(MacroUsage)
+            + hoistedIncludes.capacity() * sizeof(HoistedInclude);
+        for (const IfDefClause& clause : activeClauses)
+            size += clause.locations.capacity() * sizeof(SourceLocation);
+        for (const HoistedInclude& include : hoistedIncludes)
+            size += include.directive.capacity();
+        return size;
     }
 
     // This is where we remove unused macros.
@@ -130,34 +182,45 @@ public:
     // (e.g. it could be referenced in an unused function.)
     // There is PPCallbacks::EndOfMainFile(), however it seems to be called only after
     // some required resources have been deallocated. So we call this method manually instead.
-    void Finalize() {
-        auto removeMacroIfUnused = [this](const Macro& macro) {
-            if (macro.isWhitelisted)
-                return;
-
-            for (const SourceRange& usageRange : macro.usages) {
-                if (!rewriter.isPartOfRangeRemoved(usageRange)) {
-                    // The usage of the macro has not been removed, so
-                    // we can't remove the definition.
-                    return;
-                }
+    // Removals are made in the output rewriter, which may be a fork of the one that received
+    // changes during preprocessing.
+    void Finalize(SmartRewriter& output) {
+        // A macro is used if any of its usages doesn't intersect removed code. Both usages and
+        // removed ranges are sorted, so we check all usages in one pass.
+        vector<bool> isUsed(macros.size(), false);
+        for (size_t i = 0; i < macros.size(); ++i)
+            isUsed[i] = macros[i].isWhitelisted || macros[i].hasUntrackedUsages;
+
+        if (!std::is_sorted(usages.begin(), usages.end()))
+            std::stable_sort(usages.begin(), usages.end());
+
+        const vector<std::pair<unsigned, unsigned>> removed =
+            output.getRemovedOffsets(sourceManager.getMainFileID());
+        auto removedIt = removed.begin();
+        for (const MacroUsage& usage : usages) {
+            if (isUsed[usage.macroIndex])
+                continue;
+            while (removedIt != removed.end() && removedIt->second < usage.begin)
+                ++removedIt;
+            if (removedIt == removed.end() || usage.end < removedIt->first) {
+                // The usage of the macro has not been removed, so
+                // we can't remove the definition.
+                isUsed[usage.macroIndex] = true;
             }
+        }
 
-            rewriter.removeRange(macro.definition);
+        for (size_t i = 0; i < macros.size(); ++i) {
+            if (isUsed[i])
+                continue;
+            const Macro& macro = macros[i];
+            output.removeRange(macro.definition);
 
             if (macro.undefinition.isValid()) {
                 SourceLocation b = changeColumn(macro.undefinition, 1);
                 SourceLocation e = changeColumn(macro.undefinition, 10000);
-                rewriter.removeRange(b, e);
+                output.removeRange(b, e);
             }
-        };
-
-        // Remove unused #defines that don't have a corresponding #undef
-        for (const auto& kv : definedMacros)
-            removeMacroIfUnused(kv.second);
-        // Remove previously #defined macros.
-        for (const Macro& macro : undefinedMacros)
-            removeMacroIfUnused(macro);
+        }
     }
 
     void If(SourceLocation Loc, SourceRange ConditionRange, ConditionValueKind ConditionValue) {
@@ -237,7 +300,7 @@ public:
         activeClauses.pop_back();
     }
 
-    void InclusionDirective(SourceLocation HashLoc, CharSourceRange FilenameRange)
+    void InclusionDirective(SourceLocation HashLoc, CharSourceRange FilenameRange, const FileEntry* file)
     {
         if (!isInMainFile(HashLoc))
             return;
@@ -250,8 +313,7 @@ public:
         if (!s || !e)
             return;
 
-        rewriter.appendToPreamble(string(s, e));
-        rewriter.appendToPreamble("\n");
+        hoistedIncludes.push_back(HoistedInclude{string(s, e) + "\n", file});
         rewriter.removeRange(HashLoc, end);
     }
 
@@ -264,11 +326,7 @@ private:
     }
 
     SourceLocation changeColumn(SourceLocation loc, unsigned col) const {
-        std::pair<FileID, unsigned> decomposedLoc = sourceManager.getDecomposedLoc(loc);
-        FileID fileId = decomposedLoc.first;
-        unsigned filePos = decomposedLoc.second;
-        unsigned line = sourceManager.getLineNumber(fileId, filePos);
-        return sourceManager.translateLineCol(fileId, line, col);
+        return mainFileIndex.changeColumn(loc, col);
     }
 
     bool containsWhitelistedString(SourceRange range) const {
@@ -287,8 +345,10 @@ private:
 
 RemoveInactivePreprocessorBlocks::RemoveInactivePreprocessorBlocks(
         SourceManager& sourceManager, const LangOptions& langOptions,
-        SmartRewriter& rewriter, const set<string>& macrosToKeep)
-    : impl(new RemoveInactivePreprocessorBlocksImpl(sourceManager, langOptions, rewriter, macrosToKeep))
+        SmartRewriter& rewriter, MainFileIndex& mainFileIndex, const set<string>& macrosToKeep,
+        Stats& stats)
+    : impl(new RemoveInactivePreprocessorBlocksImpl(sourceManager, langOptions, rewriter, mainFileIndex,
+            macrosToKeep, stats))
 {
 }
 
@@ -339,8 +399,8 @@ void RemoveInactivePreprocessorBlocks::MacroExpands(
 }
 #endif
 
-void RemoveInactivePreprocessorBlocks::Finalize() {
-    impl->Finalize();
+void RemoveInactivePreprocessorBlocks::Finalize(SmartRewriter& output) {
+    impl->Finalize(output);
 }
 
 void RemoveInactivePreprocessorBlocks::If(
@@ -394,11 +454,11 @@ void RemoveInactivePreprocessorBlocks::InclusionDirective(
     bool /*IsAngled*/,
     CharSourceRange FilenameRange,
 #if CAIDE_CLANG_VERSION_AT_LEAST(16, 0)
-    clang::OptionalFileEntryRef /*File*/,
+    clang::OptionalFileEntryRef File,
 #elif CAIDE_CLANG_VERSION_AT_LEAST(15, 0)
-    llvm::Optional<FileEntryRef> /*File*/,
+    llvm::Optional<FileEntryRef> File,
 #else
-    const FileEntry* /*File*/,
+    const FileEntry* File,
 #endif
     StringRef /*SearchPath*/,
     StringRef /*RelativePath*/,
@@ -411,7 +471,20 @@ void RemoveInactivePreprocessorBlocks::InclusionDirective(
 #endif
     )
 {
-    impl->InclusionDirective(HashLoc, FilenameRange);
+#if CAIDE_CLANG_VERSION_AT_LEAST(15, 0)
+    const FileEntry* file = File.has_value() ? &File->getFileEntry() : nullptr;
+#else
+    const FileEntry* file = File;
+#endif
+    impl->InclusionDirective(HashLoc, FilenameRange, file);
+}
+
+const vector<HoistedInclude>& RemoveInactivePreprocessorBlocks::getHoistedIncludes() const {
+    return impl->hoistedIncludes;
+}
+
+std::uint64_t RemoveInactivePreprocessorBlocks::getMemorySize() const {
+    return impl->getMemorySize();
 }
 
 }
@@ -11,21 +11,36 @@
 #include <clang/Basic/SourceLocation.h>
 #include <clang/Lex/PPCallbacks.h>
 
+#include <cstdint>
 #include <memory>
 #include <set>
 #include <string>
+#include <vector>
 
 namespace clang {
+    class FileEntry;
     class LangOptions;
     class SourceManager;
     class MacroDirective;
 }
 
 namespace caide {
+
+struct Stats;
+
 namespace internal {
 
+class MainFileIndex;
 class SmartRewriter;
 
+// An #include directive in the main file that is moved to the beginning of the output.
+struct HoistedInclude {
+    // Text of the directive, followed by a newline.
+    std::string directive;
+    // Null if the file was not found.
+    const clang::FileEntry* file;
+};
+
 class RemoveInactivePreprocessorBlocks: public clang::PPCallbacks {
 private:
     struct RemoveInactivePreprocessorBlocksImpl;
@@ -33,7 +48,8 @@ private:
 
 public:
     RemoveInactivePreprocessorBlocks(clang::SourceManager& sourceManager_, const clang::LangOptions& langOptions,
-           SmartRewriter& rewriter_, const std::set<std::string>& macrosToKeep_);
+           SmartRewriter& rewriter_, MainFileIndex& mainFileIndex_, const std::set<std::string>& macrosToKeep_,
+           Stats& stats_);
     ~RemoveInactivePreprocessorBlocks();
 
     void MacroDefined(const clang::Token& MacroNameTok, const clang::MacroDirective* MD) override;
@@ -91,7 +107,15 @@ public:
                             ) override;
 
     // EndOfMainFile() is called too late; instead, we call this one manually in the consumer.
-    void Finalize();
+    // May be called several times, with different rewriters.
+    void Finalize(SmartRewriter& output);
+
+    // Include directives removed from the main file, in order of appearance. The caller
+    // decides which of them to add to the preamble of the output.
+    const std::vector<HoistedInclude>& getHoistedIncludes() const;
+
+    // Approximate heap footprint of tracked macros, usages and preprocessor clauses, in bytes.
+    std::uint64_t getMemorySize() const;
 };
 
 }
@@ -5,6 +5,8 @@
 // option) any later version. See LICENSE.TXT for details.
 
 #include "SmartRewriter.h"
+#include "caideInliner.hpp"
+#include "MemoryUsage.h"
 #include "SourceLocationComparers.h"
 
 #include <clang/Basic/SourceManager.h>
@@ -16,11 +18,13 @@ using namespace clang;
 namespace caide {
 namespace internal {
 
-SmartRewriter::SmartRewriter(SourceManager& srcManager, const LangOptions& langOptions)
+SmartRewriter::SmartRewriter(SourceManager& srcManager, const LangOptions& langOptions,
+        Stats& stats_)
     : rewriter(srcManager, langOptions)
     , comparer(srcManager)
     , removed(comparer)
     , changesApplied(false)
+    , stats(stats_)
 {
 }
 
@@ -29,6 +33,7 @@ void SmartRewriter::appendToPreamble(std::string s) {
 }
 
 void SmartRewriter::removeRange(SourceLocation begin, SourceLocation end) {
+    ++stats.intervalSetOperations;
     removed.add(begin, end);
 }
 
@@ -37,9 +42,30 @@ void SmartRewriter::removeRange(const SourceRange& range) {
 }
 
 bool SmartRewriter::isPartOfRangeRemoved(const SourceRange& range) const {
+    ++stats.intervalSetOperations;
     return removed.intersects(range.getBegin(), range.getEnd());
 }
 
+std::vector<std::pair<unsigned, unsigned>> SmartRewriter::getRemovedOffsets(FileID fileID) const {
+    const SourceManager& srcManager = rewriter.getSourceMgr();
+    std::vector<std::pair<unsigned, unsigned>> offsets;
+    for (const auto& range : removed) {
+        std::pair<FileID, unsigned> b = srcManager.getDecomposedExpansionLoc(range.first);
+        std::pair<FileID, unsigned> e = srcManager.getDecomposedExpansionLoc(range.second);
+        if (b.first != fileID || e.first != fileID)
+            continue;
+        if (!offsets.empty() && b.second <= offsets.back().second) {
+            // Ranges that were disjoint may overlap after macro locations are mapped to their
+            // expansion locations.
+            if (offsets.back().second < e.second)
+                offsets.back().second = e.second;
+        } else {
+            offsets.emplace_back(b.second, e.second);
+        }
+    }
+    return offsets;
+}
+
 bool SmartRewriter::getRewriteBufferFor(FileID fileID, std::string& rewriteBuf) const {
     const auto* rewriteBuffer = rewriter.getRewriteBufferFor(fileID);
     if (rewriteBuffer == nullptr) {
@@ -55,14 +81,35 @@ void SmartRewriter::applyChanges() {
     changesApplied = true;
 
     Rewriter::RewriteOptions opts;
-    for (const auto& range : removed)
+    for (const auto& range : removed) {
         rewriter.RemoveText(SourceRange(range.first, range.second), opts);
+        ++stats.removedRanges;
+    }
 
     SourceManager& srcManager = rewriter.getSourceMgr();
     SourceLocation Loc = srcManager.getLocForStartOfFile(srcManager.getMainFileID());
     rewriter.InsertText(Loc, preamble);
 }
 
+std::unique_ptr<SmartRewriter> SmartRewriter::fork() const {
+    if (changesApplied)
+        throw std::logic_error("Rewriter changes have already been applied");
+
+    std::unique_ptr<SmartRewriter> copy(
+        new SmartRewriter(rewriter.getSourceMgr(), rewriter.getLangOpts(), stats));
+    copy->preamble = preamble;
+    for (const auto& range : removed) {
+        ++stats.intervalSetOperations;
+        copy->removed.add(range.first, range.second);
+    }
+    return copy;
+}
+
+std::uint64_t SmartRewriter::getMemorySize() const {
+    return getNodeContainerMemory<std::pair<const SourceLocation, SourceLocation>>(removed.size())
+        + preamble.capacity();
+}
+
 }
 }
 
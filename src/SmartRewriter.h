@@ -11,7 +11,11 @@
 
 #include <clang/Rewrite/Core/Rewriter.h>
 
+#include <cstdint>
+#include <memory>
 #include <string>
+#include <utility>
+#include <vector>
 
 namespace clang {
     class LangOptions;
@@ -19,29 +23,47 @@ namespace clang {
 }
 
 namespace caide {
+
+struct Stats;
+
 namespace internal {
 
 class SmartRewriter {
 public:
-    SmartRewriter(clang::SourceManager& sourceManager, const clang::LangOptions& langOptions);
+    SmartRewriter(clang::SourceManager& sourceManager, const clang::LangOptions& langOptions,
+                  Stats& stats);
     SmartRewriter(const SmartRewriter&) = delete;
     SmartRewriter& operator=(const SmartRewriter&) = delete;
     SmartRewriter(SmartRewriter&&) = delete;
     SmartRewriter& operator=(SmartRewriter&&) = delete;
 
     bool isPartOfRangeRemoved(const clang::SourceRange& range) const;
+
+    // Removed ranges that lie in the given file, as pairs of offsets (both ends inclusive).
+    // Ranges are pairwise disjoint and sorted.
+    std::vector<std::pair<unsigned, unsigned>> getRemovedOffsets(clang::FileID fileID) const;
+
     void appendToPreamble(std::string s);
     void removeRange(clang::SourceLocation begin, clang::SourceLocation end);
     void removeRange(const clang::SourceRange& range);
     bool getRewriteBufferFor(clang::FileID fileID, std::string& rewriteBuf) const;
     void applyChanges();
 
+    // Creates a rewriter with the same pending changes. Changes made to the copy don't affect
+    // this rewriter and vice versa.
+    std::unique_ptr<SmartRewriter> fork() const;
+
+    // Approximate heap footprint of removed ranges and the preamble, in bytes. Rewrite buffers
+    // are not included.
+    std::uint64_t getMemorySize() const;
+
 private:
     clang::Rewriter rewriter;
     std::string preamble;
     SourceLocationComparer comparer;
     IntervalSet<clang::SourceLocation, SourceLocationComparer> removed;
     bool changesApplied;
+    Stats& stats;
 };
 
 }
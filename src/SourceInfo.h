@@ -9,8 +9,14 @@
 #include <clang/AST/DeclBase.h>
 #include <clang/Basic/SourceLocation.h>
 
-#include <map>
-#include <set>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/DenseSet.h>
+#include <llvm/ADT/SmallPtrSet.h>
+#include <llvm/Support/Allocator.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
 #include <utility>
 #include <vector>
 
@@ -24,24 +30,92 @@ namespace clang {
 namespace caide {
 namespace internal {
 
+// Sets of declarations used during one optimizer run. Open addressing tables keep all
+// elements in a single allocation that is released at once at the end of the run.
+using DeclSet = llvm::DenseSet<clang::Decl*>;
+
+// Directed graph of declarations. Edge lists of all nodes are allocated from one arena, which
+// is released at once with the graph.
+class DeclGraph {
+public:
+    // Targets of the edges from one node, in insertion order.
+    class Edges {
+    public:
+        clang::Decl* const* begin() const { return targets; }
+        clang::Decl* const* end() const { return targets + count; }
+        std::size_t size() const { return count; }
+
+    private:
+        friend class DeclGraph;
+        clang::Decl** targets = nullptr;
+        unsigned count = 0;
+        unsigned capacity = 0;
+    };
+
+    using const_iterator = llvm::DenseMap<clang::Decl*, Edges>::const_iterator;
+
+    DeclGraph() = default;
+    DeclGraph(const DeclGraph&) = delete;
+    DeclGraph& operator=(const DeclGraph&) = delete;
+
+    // Returns false if the edge already exists.
+    bool insert(clang::Decl* from, clang::Decl* to) {
+        if (!edges.insert(std::make_pair(from, to)).second)
+            return false;
+        Edges& list = nodes[from];
+        if (list.count == list.capacity) {
+            // Arrays that have been outgrown stay in the arena; they take at most as much
+            // memory as the current ones.
+            const unsigned capacity = list.capacity == 0 ? 4 : 2 * list.capacity;
+            clang::Decl** targets = arena.Allocate<clang::Decl*>(capacity);
+            std::copy(list.begin(), list.end(), targets);
+            list.targets = targets;
+            list.capacity = capacity;
+        }
+        list.targets[list.count++] = to;
+        return true;
+    }
+
+    const_iterator begin() const { return nodes.begin(); }
+    const_iterator end() const { return nodes.end(); }
+    const_iterator find(clang::Decl* from) const { return nodes.find(from); }
+
+    // Number of nodes with outgoing edges.
+    std::size_t size() const { return nodes.size(); }
+
+    std::uint64_t getMemorySize() const {
+        return nodes.getMemorySize() + edges.getMemorySize() + arena.getTotalMemory();
+    }
+
+private:
+    llvm::DenseMap<clang::Decl*, Edges> nodes;
+    llvm::DenseSet<std::pair<clang::Decl*, clang::Decl*>> edges;
+    llvm::BumpPtrAllocator arena;
+};
+
 // Contains dependency graph and other information shared between optimizer stages.
 struct SourceInfo {
     // key: Decl, value: what the key uses.
-    std::map<clang::Decl*, std::set<clang::Decl*>> uses;
+    DeclGraph uses;
 
-    // 'Roots of the dependency graph':
-    // - int main()
-    // - declarations marked with a comment '/// caide keep'
-    // - declarations corresponding to names provided by identifiersToKeep setting.
-    std::set<clang::Decl*> declsToKeep;
+    // key: Decl in the main file, value: what the key uses among declarations in system headers
+    // that are not part of the dependency graph.
+    DeclGraph usedSystemDecls;
+
+    // Roots of the dependency graph that are common for all root specifications: declarations
+    // marked with a comment '/// caide keep'. Other roots are int main() and declarations
+    // corresponding to names provided by identifiersToKeep setting.
+    llvm::SmallPtrSet<clang::Decl*, 16> declsToKeep;
+
+    // Declarations of main function.
+    std::vector<clang::FunctionDecl*> mainFunctions;
 
     // Delayed parsed functions.
     std::vector<clang::FunctionDecl*> delayedParsedFunctions;
 
-    // value: non-implicit Decl, key: location and kind of the decl.
-    std::map<std::pair<clang::SourceLocation, clang::Decl::Kind>, clang::Decl*> nonImplicitDecls;
-
-    static std::pair<clang::SourceLocation, clang::Decl::Kind> makeKey(clang::Decl* nonImplicitDecl);
+    // Location of the closing brace of delayed parsed functions that were not parsed
+    // because they are unused.
+    llvm::DenseMap<clang::FunctionDecl*, clang::SourceLocation> unparsedBodyEnds;
 };
 
 }
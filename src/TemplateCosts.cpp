@@ -0,0 +1,138 @@
+//                        Caide C++ inliner
+//
+// This file is distributed under the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version. See LICENSE.TXT for details.
+
+#include "TemplateCosts.h"
+#include "caideInliner.hpp"
+
+#include <clang/AST/Decl.h>
+#include <clang/AST/DeclCXX.h>
+#include <clang/AST/DeclTemplate.h>
+#include <clang/Basic/SourceManager.h>
+
+#include <algorithm>
+
+
+using namespace clang;
+using std::string;
+using std::vector;
+
+
+namespace caide {
+namespace internal {
+
+static thread_local TemplateCosts* currentCosts = nullptr;
+
+TemplateCosts::TemplateCosts(bool enable)
+    : enabled(enable)
+{
+    if (enabled) {
+        previous = currentCosts;
+        currentCosts = this;
+    }
+}
+
+TemplateCosts::~TemplateCosts() {
+    if (enabled)
+        currentCosts = previous;
+}
+
+vector<TemplateStats> TemplateCosts::getResults() const {
+    vector<TemplateStats> results;
+    results.reserve(templates.size());
+    for (const auto& entry : templates)
+        results.push_back(entry.second);
+    // Stable sort keeps templates with equal costs ordered by name.
+    std::stable_sort(results.begin(), results.end(),
+        [](const TemplateStats& lhs, const TemplateStats& rhs) {
+            return lhs.traversalTime > rhs.traversalTime;
+        });
+    return results;
+}
+
+TemplateCosts* TemplateCosts::current() {
+    return currentCosts;
+}
+
+static const TemplateDecl* getPrimaryTemplate(const Decl* decl) {
+    const TemplateDecl* primary = nullptr;
+    if (const auto* partialSpec = dyn_cast<ClassTemplatePartialSpecializationDecl>(decl))
+        primary = partialSpec->getSpecializedTemplate();
+    else if (const auto* classSpec = dyn_cast<ClassTemplateSpecializationDecl>(decl))
+        primary = classSpec->getSpecializedTemplate();
+    else if (const auto* varSpec = dyn_cast<VarTemplateSpecializationDecl>(decl))
+        primary = varSpec->getSpecializedTemplate();
+    else if (const auto* function = dyn_cast<FunctionDecl>(decl)) {
+        primary = function->getPrimaryTemplate();
+        if (!primary)
+            primary = function->getDescribedFunctionTemplate();
+    } else if (const auto* record = dyn_cast<CXXRecordDecl>(decl))
+        primary = record->getDescribedClassTemplate();
+    else
+        primary = dyn_cast<TemplateDecl>(decl);
+
+    if (!primary) {
+        // Members of class templates and of their specializations.
+        if (const auto* record = dyn_cast_or_null<CXXRecordDecl>(decl->getDeclContext()))
+            return getPrimaryTemplate(record);
+        return nullptr;
+    }
+    return cast<TemplateDecl>(primary->getCanonicalDecl());
+}
+
+TemplateCostTracker::TemplateCostTracker(TemplateCosts& costs_,
+        const SourceManager& sourceManager_)
+    : costs(costs_)
+    , sourceManager(sourceManager_)
+    , lastEvent(Clock::now())
+{}
+
+TemplateCostTracker::~TemplateCostTracker() {
+    for (const auto& entry : templates) {
+        const TemplateDecl* templateDecl = entry.first;
+        string name = templateDecl->getQualifiedNameAsString();
+        string location;
+        PresumedLoc loc = sourceManager.getPresumedLoc(
+            sourceManager.getExpansionLoc(templateDecl->getLocation()));
+        if (loc.isValid())
+            location = string(loc.getFilename()) + ":" + std::to_string(loc.getLine());
+
+        TemplateStats& total = costs.templates[std::make_pair(name, location)];
+        if (total.name.empty()) {
+            total.name = std::move(name);
+            total.location = std::move(location);
+        }
+        total.traversalTime += entry.second.traversalTime;
+        total.nodesVisited += entry.second.nodesVisited;
+        total.edges += entry.second.edges;
+    }
+}
+
+bool TemplateCostTracker::enter(const Decl* decl) {
+    const TemplateDecl* primary = getPrimaryTemplate(decl);
+    if (!primary)
+        return false;
+    updateTime();
+    stack.push_back(&templates[primary]);
+    return true;
+}
+
+void TemplateCostTracker::leave() {
+    updateTime();
+    stack.pop_back();
+}
+
+void TemplateCostTracker::updateTime() {
+    const Clock::time_point now = Clock::now();
+    if (!stack.empty()) {
+        stack.back()->traversalTime +=
+            std::chrono::duration_cast<std::chrono::nanoseconds>(now - lastEvent);
+    }
+    lastEvent = now;
+}
+
+}
+}
+
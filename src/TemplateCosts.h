@@ -0,0 +1,114 @@
+//                        Caide C++ inliner
+//
+// This file is distributed under the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version. See LICENSE.TXT for details.
+
+#pragma once
+
+#include "caideInliner.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace clang {
+    class Decl;
+    class SourceManager;
+    class TemplateDecl;
+}
+
+namespace caide {
+namespace internal {
+
+// Costs of building the dependency graph attributed to templates (CppInliner::templateStats).
+// While an enabled object exists, it is used by DependenciesCollector objects created on the
+// same thread.
+class TemplateCosts {
+public:
+    // If enable is false, the object is not used.
+    explicit TemplateCosts(bool enable);
+    ~TemplateCosts();
+    TemplateCosts(const TemplateCosts&) = delete;
+    TemplateCosts& operator=(const TemplateCosts&) = delete;
+
+    // Templates in order of decreasing traversal time.
+    std::vector<TemplateStats> getResults() const;
+
+    // The enabled object of the calling thread, or null.
+    static TemplateCosts* current();
+
+private:
+    friend class TemplateCostTracker;
+
+    bool enabled;
+    TemplateCosts* previous = nullptr;
+    // key: name and location of the template.
+    std::map<std::pair<std::string, std::string>, TemplateStats> templates;
+};
+
+// Attributes work of one DependenciesCollector to primary templates. Work is attributed to the
+// innermost template being traversed or substituted into. Results are added to TemplateCosts
+// on destruction, so the AST must still exist at that point.
+class TemplateCostTracker {
+public:
+    TemplateCostTracker(TemplateCosts& costs_, const clang::SourceManager& sourceManager_);
+    ~TemplateCostTracker();
+    TemplateCostTracker(const TemplateCostTracker&) = delete;
+    TemplateCostTracker& operator=(const TemplateCostTracker&) = delete;
+
+    // If the declaration is a template or a specialization of a template, makes its primary
+    // template current until the matching leave() and returns true.
+    bool enter(const clang::Decl* decl);
+    void leave();
+
+    void addNode() {
+        if (!stack.empty())
+            ++stack.back()->nodesVisited;
+    }
+
+    void addEdge() {
+        if (!stack.empty())
+            ++stack.back()->edges;
+    }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    // Attributes time since the last event to the current template.
+    void updateTime();
+
+    TemplateCosts& costs;
+    const clang::SourceManager& sourceManager;
+
+    // Costs in this run; name and location are filled on destruction.
+    std::map<const clang::TemplateDecl*, TemplateStats> templates;
+    std::vector<TemplateStats*> stack;
+    Clock::time_point lastEvent;
+};
+
+// Attributes work done in the scope to the template of the declaration, if any.
+class TemplateCostScope {
+public:
+    TemplateCostScope(TemplateCostTracker* tracker_, const clang::Decl* decl)
+        : tracker(tracker_ && decl && tracker_->enter(decl) ? tracker_ : nullptr)
+    {}
+
+    ~TemplateCostScope() {
+        if (tracker)
+            tracker->leave();
+    }
+
+    TemplateCostScope(const TemplateCostScope&) = delete;
+    TemplateCostScope& operator=(const TemplateCostScope&) = delete;
+
+private:
+    TemplateCostTracker* tracker;
+};
+
+}
+}
+
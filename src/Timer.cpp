@@ -5,9 +5,64 @@
 // option) any later version. See LICENSE.TXT for details.
 
 #include "Timer.h"
+#include "caideInliner.hpp"
+#include "MemoryUsage.h"
 
 // #define CAIDE_TIMER
 
+namespace caide { namespace internal {
+
+static void addCounters(PhaseStats& phase, const PerfCounterValues& delta) {
+    phase.cycles += delta.cycles;
+    phase.instructions += delta.instructions;
+    phase.cacheMisses += delta.cacheMisses;
+    phase.branchMisses += delta.branchMisses;
+}
+
+bool ScopedTimer::readCounters(PerfCounterValues& delta) {
+    if (!counters || !counters->read(delta))
+        return false;
+    delta.cycles -= startCounters.cycles;
+    delta.instructions -= startCounters.instructions;
+    delta.cacheMisses -= startCounters.cacheMisses;
+    delta.branchMisses -= startCounters.branchMisses;
+    return true;
+}
+
+void ScopedTimer::startMeasurements() {
+    counters = PerfCounters::current();
+    if (counters && !counters->read(startCounters))
+        counters = nullptr;
+    // Reading RSS is a system call, so it is measured only for phases reported in Stats.
+    startResidentSetSize = phase ? getResidentSetSize() : -1;
+}
+
+void ScopedTimer::stopMeasurements() {
+    PerfCounterValues delta;
+    if (readCounters(delta)) {
+        if (phase)
+            addCounters(*phase, delta);
+        if (reportCounters) {
+            reportCounters->cycles += delta.cycles;
+            reportCounters->instructions += delta.instructions;
+            reportCounters->cacheMisses += delta.cacheMisses;
+            reportCounters->branchMisses += delta.branchMisses;
+        }
+    }
+
+    if (startResidentSetSize >= 0) {
+        const std::int64_t residentSetSize = getResidentSetSize();
+        if (residentSetSize >= 0) {
+            const std::int64_t rssDelta = residentSetSize - startResidentSetSize;
+            phase->residentSetSizeDelta += rssDelta;
+            if (reportResidentSetSizeDelta)
+                *reportResidentSetSizeDelta += rssDelta;
+        }
+    }
+}
+
+}}
+
 #ifdef CAIDE_TIMER
 
 #include <iomanip>
@@ -25,6 +80,8 @@ struct TimeReport {
     using Duration = std::chrono::steady_clock::duration;
     Duration duration;
     uint64_t count = 0;
+    PerfCounterValues counters;
+    std::int64_t residentSetSizeDelta = 0;
 
     std::map<std::string, TimeReport> children;
 };
@@ -41,24 +98,38 @@ struct ReportPrinter {
         auto durationMs = std::chrono::duration_cast<std::chrono::milliseconds>(node.duration);
         auto other = durationMs;
         if (indent >= 0)
-            print(durationMs, name, indent, node.count);
+            print(durationMs, name, indent, node.count, &node);
 
         for (const auto& kv : node.children)
             other -= print(kv.second, kv.first, indent + INDENT);
 
         if (indent >= 0 && !node.children.empty() && other > std::chrono::milliseconds{0})
-            print(other, "Other", indent + INDENT, node.count);
+            print(other, "Other", indent + INDENT, node.count, nullptr);
 
         return durationMs;
     }
 
-    void print(std::chrono::milliseconds duration, const std::string& name, int indent, int count) {
+    // node is null for time not covered by children.
+    void print(std::chrono::milliseconds duration, const std::string& name, int indent, int count,
+            const TimeReport* node) {
         std::string durationStr = std::to_string(duration.count()) + " ms";
         std::cerr << std::right << std::setw(12) << durationStr;
 
         std::string countStr = "/" + std::to_string(count);
         std::cerr << std::setw(10) << countStr << " |";
 
+        if (node && node->counters.cycles != 0) {
+            // Millions of cycles and instructions, thousands of misses.
+            const PerfCounterValues& counters = node->counters;
+            std::cerr << std::setw(8) << counters.cycles / 1000000 << "Mc"
+                << std::setw(8) << counters.instructions / 1000000 << "Mi"
+                << std::setw(8) << counters.cacheMisses / 1000 << "Kcm"
+                << std::setw(8) << counters.branchMisses / 1000 << "Kbm |";
+        }
+
+        if (node && node->residentSetSizeDelta != 0)
+            std::cerr << std::setw(10) << node->residentSetSizeDelta / 1024 << " KB RSS |";
+
         for (int i = 0; i < indent; ++i)
             std::cerr << ' ';
         std::cerr << name << '\n';
@@ -67,12 +138,16 @@ struct ReportPrinter {
 
 }
 
-ScopedTimer::ScopedTimer(const char* name) {
+ScopedTimer::ScopedTimer(const char* name, PhaseStats* phase_)
+    : phase(phase_)
+{
     TimeReport* prev = printer.cur.top();
     TimeReport& cur = prev->children[std::string(name)];
     printer.cur.push(&cur);
     cur.count++;
     duration = &cur.duration;
+    reportCounters = &cur.counters;
+    reportResidentSetSizeDelta = &cur.residentSetSizeDelta;
     resume();
 }
 
@@ -83,12 +158,17 @@ ScopedTimer::~ScopedTimer() {
 
 void ScopedTimer::pause() {
     if (start != Clock::time_point::min()) {
-        *duration += Clock::now() - start;
+        const Clock::duration elapsed = Clock::now() - start;
+        *duration += elapsed;
+        if (phase)
+            phase->wallTime += elapsed;
+        stopMeasurements();
         start = Clock::time_point::min();
     }
 }
 
 void ScopedTimer::resume() {
+    startMeasurements();
     start = Clock::now();
 }
 
@@ -98,13 +178,31 @@ void ScopedTimer::resume() {
 
 namespace caide { namespace internal {
 
-ScopedTimer::ScopedTimer(const char*) {
-    (void)start;
+ScopedTimer::ScopedTimer(const char*, PhaseStats* phase_)
+    : phase(phase_)
+{
     (void)duration;
+    resume();
+}
+
+ScopedTimer::~ScopedTimer() {
+    pause();
+}
+
+void ScopedTimer::pause() {
+    if (phase && start != Clock::time_point::min()) {
+        phase->wallTime += Clock::now() - start;
+        stopMeasurements();
+        start = Clock::time_point::min();
+    }
+}
+
+void ScopedTimer::resume() {
+    if (!phase)
+        return;
+    startMeasurements();
+    start = Clock::now();
 }
-ScopedTimer::~ScopedTimer() = default;
-void ScopedTimer::pause() { }
-void ScopedTimer::resume() { }
 
 }}
 
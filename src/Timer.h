@@ -4,13 +4,24 @@
 // the Free Software Foundation, either version 3 of the License, or (at your
 // option) any later version. See LICENSE.TXT for details.
 
+#include "PerfCounters.h"
+
 #include <chrono>
+#include <cstdint>
+
+namespace caide {
+
+struct PhaseStats;
 
-namespace caide { namespace internal {
+namespace internal {
 
+// Measures a phase of the pipeline. Nested timers are reported as a tree on exit if CAIDE_TIMER
+// is defined. Regardless of that, a timer for a phase that is reported in Stats also adds to
+// the corresponding PhaseStats. Hardware counters are measured too if PerfCounters are
+// available on this thread.
 class ScopedTimer {
 public:
-    explicit ScopedTimer(const char* name);
+    explicit ScopedTimer(const char* name, PhaseStats* phase = nullptr);
     ~ScopedTimer();
 
     void pause();
@@ -18,8 +29,22 @@ public:
 
 private:
     using Clock = std::chrono::steady_clock;
-    Clock::time_point start;
+    Clock::time_point start = Clock::time_point::min();
     Clock::duration* duration = nullptr;
+    PerfCounterValues* reportCounters = nullptr;
+    std::int64_t* reportResidentSetSizeDelta = nullptr;
+    PhaseStats* phase;
+    const PerfCounters* counters = nullptr;
+    PerfCounterValues startCounters;
+    // Negative if not measured.
+    std::int64_t startResidentSetSize = -1;
+
+    // Called at the start and at the end of a measured interval.
+    void startMeasurements();
+    void stopMeasurements();
+
+    // Reads counters at the end of a measured interval and returns the difference.
+    bool readCounters(PerfCounterValues& delta);
 };
 
 } }
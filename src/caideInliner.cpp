@@ -7,11 +7,18 @@
 #include "caideInliner.hpp"
 #include "caideInliner.h"
 
+#include "Cancellation.h"
 #include "detect_options.h"
+#include "EdgeProvenance.h"
+#include "HeaderCosts.h"
 #include "inliner.h"
+#include "MemoryUsage.h"
 #include "optimizer.h"
+#include "PerfCounters.h"
+#include "TemplateCosts.h"
 
 #include <algorithm>
+#include <cstdint>
 #include <iostream>
 #include <limits>
 #include <fstream>
@@ -48,19 +55,55 @@ CppInliner::CppInliner(const string& temporaryDirectory_)
         "_WIN32", "_WIN64", "_M_AMD64", "__linux", "__linux__", "__APPLE__",
         "__GNUC__", "__GLIBC__", "__clang__", "_MSC_VER"}
     , maxConsequentEmptyLines{2}
+    , opaqueSystemHeaders{false}
+    , minimizeIncludes{false}
+    , timeout{0}
+    , optimizerTimeBudget{0}
+    , optimizerMemoryBudget{0}
+    , hardwareCounters{false}
+    , headerStats{false}
+    , templateStats{false}
+    , edgeStats{false}
     , temporaryDirectory{trimEndPathSeparators(temporaryDirectory_)}
 {
 }
 
-static void concatFiles(const vector<string>& cppFilePaths, const string& outputFilePath) {
+// Fills statistics that are known only at the end of a call.
+static void finishStats(Stats& stats, const internal::HeaderCosts& headerCosts,
+        const internal::TemplateCosts& templateCosts, const internal::EdgeProvenance& edgeProvenance)
+{
+    const std::int64_t peak = internal::getPeakResidentSetSize();
+    if (peak >= 0)
+        stats.peakResidentSetSize = static_cast<std::uint64_t>(peak);
+    stats.headers = headerCosts.getResults();
+    stats.templates = templateCosts.getResults();
+    stats.edges = edgeProvenance.getResults();
+}
+
+// Returns the total size of the files.
+static std::uint64_t concatFiles(const vector<string>& cppFilePaths, const string& outputFilePath) {
     ofstream out{outputFilePath};
+    std::uint64_t totalSize = 0;
     for (const string& filePath : cppFilePaths) {
         std::ifstream in{filePath};
         if (!in)
             throw std::runtime_error(string("File not found: " + filePath));
+        in.seekg(0, std::ios::end);
+        totalSize += static_cast<std::uint64_t>(in.tellg());
+        in.seekg(0, std::ios::beg);
         out << in.rdbuf();
         out << '\n'; // in case there was no return at end of file
     }
+    return totalSize;
+}
+
+static string readFile(const string& filePath) {
+    std::ifstream in{filePath, std::ios::binary};
+    if (!in)
+        throw std::runtime_error(string("File not found: " + filePath));
+    std::ostringstream contents;
+    contents << in.rdbuf();
+    return contents.str();
 }
 
 // Certain directives become invalid after the first stage (inliner) runs. Those include:
@@ -92,9 +135,10 @@ static bool isWhitespaceOnly(const string& text) {
     return text.find_first_not_of(" \t\r") == string::npos;
 }
 
-static void removeEmptyLines(const string& textInBinaryMode,
-                             int maxConsequentEmptyLines,
-                             const string& outputFilePath)
+// Returns the size of the output.
+static std::uint64_t removeEmptyLines(const string& textInBinaryMode,
+                                      int maxConsequentEmptyLines,
+                                      const string& outputFilePath)
 {
     if (maxConsequentEmptyLines < 0)
         maxConsequentEmptyLines = std::numeric_limits<int>::max();
@@ -102,6 +146,7 @@ static void removeEmptyLines(const string& textInBinaryMode,
     ofstream out{outputFilePath, std::ios::binary};
     int currentConsequentEmptyLines = 0;
     bool readNonEmptyLine = false;
+    std::uint64_t outputSize = 0;
     string line;
     while (std::getline(in, line)) {
         if (isWhitespaceOnly(line))
@@ -111,9 +156,12 @@ static void removeEmptyLines(const string& textInBinaryMode,
             readNonEmptyLine = true;
         }
 
-        if (readNonEmptyLine && currentConsequentEmptyLines <= maxConsequentEmptyLines)
+        if (readNonEmptyLine && currentConsequentEmptyLines <= maxConsequentEmptyLines) {
             out << line << '\n';
+            outputSize += line.size() + 1;
+        }
     }
+    return outputSize;
 }
 
 static string pathConcat(const string& path, const string& fileName) {
@@ -123,19 +171,93 @@ static string pathConcat(const string& path, const string& fileName) {
     return result;
 }
 
-void CppInliner::inlineCode(const vector<string>& cppFilePaths, const string& outputFilePath) const {
+// Removes unused code from cppFile and writes the outputs. If the optimizer exceeds its budget,
+// writes cppFile itself (the result of the first stage) to all outputs instead.
+static void optimize(internal::Optimizer& optimizer, const internal::Cancellation& cancellation,
+        const string& cppFile, const vector<internal::OptimizerRoots>& roots,
+        int maxConsequentEmptyLines, const vector<string>& outputFilePaths, Stats& stats)
+{
+    vector<string> onlyReachableCode;
+    try {
+        onlyReachableCode = optimizer.doOptimize(cppFile, roots);
+        cancellation.check();
+    } catch (const internal::BudgetExceeded&) {
+        stats.degraded = true;
+    }
+
+    if (stats.degraded) {
+        const string stageOneCode{readFile(cppFile)};
+        for (const string& outputFilePath : outputFilePaths)
+            stats.bytesOut += removeEmptyLines(stageOneCode, maxConsequentEmptyLines, outputFilePath);
+    } else {
+        for (size_t i = 0; i < roots.size(); ++i) {
+            stats.bytesOut += removeEmptyLines(onlyReachableCode[i], maxConsequentEmptyLines,
+                outputFilePaths[i]);
+        }
+    }
+}
+
+Stats CppInliner::inlineCode(const vector<string>& cppFilePaths, const string& outputFilePath) const {
+    return inlineCodeVariants(cppFilePaths, vector<RootSpecification>(1), vector<string>{outputFilePath});
+}
+
+Stats CppInliner::inlineCodeVariants(const vector<string>& cppFilePaths,
+        const vector<RootSpecification>& roots, const vector<string>& outputFilePaths) const
+{
+    if (roots.size() != outputFilePaths.size())
+        throw std::invalid_argument("Number of root specifications and output files must match");
+    Stats stats;
+    if (roots.empty())
+        return stats;
+
+    const internal::PerfCounters counters{hardwareCounters};
+    stats.hasHardwareCounters = counters.isAvailable();
+    internal::HeaderCosts headerCosts{headerStats};
+    internal::TemplateCosts templateCosts{templateStats};
+    internal::EdgeProvenance edgeProvenance{edgeStats};
+
+    const internal::Cancellation cancellation{cancellationToken.get(), timeout};
+
+    vector<internal::OptimizerRoots> optimizerRoots(roots.size());
+    for (size_t i = 0; i < roots.size(); ++i) {
+        optimizerRoots[i].keepMain = roots[i].keepMain;
+        optimizerRoots[i].identifiersToKeep = roots[i].identifiersToKeep;
+    }
+
+    // A single file that includes only system headers goes to the optimizer directly.
+    if (cppFilePaths.size() == 1) {
+        const string contents{readFile(cppFilePaths[0])};
+        if (!internal::needsInlining(contents, clangCompilationOptions)) {
+            stats.bytesIn = stats.bytesInlined = contents.size();
+            internal::Optimizer optimizer{clangCompilationOptions, macrosToKeep,
+                identifiersToKeep, stats, minimizeIncludes,
+                cancellation.withBudget(optimizerTimeBudget, optimizerMemoryBudget),
+                dependencySummaryCache};
+            optimize(optimizer, cancellation, cppFilePaths[0], optimizerRoots,
+                maxConsequentEmptyLines, outputFilePaths, stats);
+            finishStats(stats, headerCosts, templateCosts, edgeProvenance);
+            return stats;
+        }
+    }
+
     const string concatStage{pathConcat(temporaryDirectory, "concat.cpp")};
     const string inlinedStage{pathConcat(temporaryDirectory, "inlined.cpp")};
 
-    concatFiles(cppFilePaths, concatStage);
+    stats.bytesIn = concatFiles(cppFilePaths, concatStage);
 
-    internal::Inliner inliner{clangCompilationOptions};
+    internal::Inliner inliner{clangCompilationOptions, stats, opaqueSystemHeaders, cancellation};
     std::string inlinedCode{inliner.doInline(concatStage)};
+    stats.bytesInlined = inlinedCode.size();
     removeInvalidDirectives(inlinedCode, inlinedStage);
 
-    internal::Optimizer optimizer{inliner.getResultingCommandLineOptions(), macrosToKeep, identifiersToKeep};
-    std::string onlyReachableCode{optimizer.doOptimize(inlinedStage)};
-    removeEmptyLines(onlyReachableCode, maxConsequentEmptyLines, outputFilePath);
+    internal::Optimizer optimizer{inliner.getResultingCommandLineOptions(), macrosToKeep,
+        identifiersToKeep, stats, minimizeIncludes,
+        cancellation.withBudget(optimizerTimeBudget, optimizerMemoryBudget),
+        dependencySummaryCache};
+    optimize(optimizer, cancellation, inlinedStage, optimizerRoots,
+        maxConsequentEmptyLines, outputFilePaths, stats);
+    finishStats(stats, headerCosts, templateCosts, edgeProvenance);
+    return stats;
 }
 
 void CppInliner::autoDetectCompilationOptions() {
@@ -151,6 +273,37 @@ static vector<string> arrayToCppVector(const char** array, int size) {
     return res;
 }
 
+static caide::CppInliner createInliner(const CaideCppInlinerOptions* options) {
+    caide::CppInliner inliner(options->temporaryDirectory);
+    inliner.clangCompilationOptions = arrayToCppVector(
+        options->clangCompilationOptions, options->numClangOptions);
+    inliner.macrosToKeep = arrayToCppVector(options->macrosToKeep, options->numMacrosToKeep);
+    inliner.identifiersToKeep = arrayToCppVector(options->identifiersToKeep, options->numIdentifiersToKeep);
+    inliner.maxConsequentEmptyLines = options->maxConsequentEmptyLines;
+    return inliner;
+}
+
+struct CaideCancellationToken {
+    std::shared_ptr<caide::CancellationToken> token;
+};
+
+extern "C" struct CaideCancellationToken* caideCreateCancellationToken(void) {
+    try {
+        return new CaideCancellationToken{std::make_shared<caide::CancellationToken>()};
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+extern "C" void caideCancel(struct CaideCancellationToken* token) {
+    if (token)
+        token->token->cancel();
+}
+
+extern "C" void caideDestroyCancellationToken(struct CaideCancellationToken* token) {
+    delete token;
+}
+
 extern "C" int caideInlineCppCode(
         const CaideCppInlinerOptions* options,
         const char** cppFilePaths,
@@ -158,12 +311,7 @@ extern "C" int caideInlineCppCode(
         const char* outputFilePath)
 {
     try {
-        caide::CppInliner inliner(options->temporaryDirectory);
-        inliner.clangCompilationOptions = arrayToCppVector(
-            options->clangCompilationOptions, options->numClangOptions);
-        inliner.macrosToKeep = arrayToCppVector(options->macrosToKeep, options->numMacrosToKeep);
-        inliner.identifiersToKeep = arrayToCppVector(options->identifiersToKeep, options->numIdentifiersToKeep);
-        inliner.maxConsequentEmptyLines = options->maxConsequentEmptyLines;
+        caide::CppInliner inliner = createInliner(options);
         vector<string> files = arrayToCppVector(cppFilePaths, numCppFiles);
         inliner.inlineCode(files, outputFilePath);
         return 0;
@@ -176,3 +324,152 @@ extern "C" int caideInlineCppCode(
     }
 }
 
+extern "C" int caideInlineCppCodeCancellable(
+        const CaideCppInlinerOptions* options,
+        const char** cppFilePaths,
+        int numCppFiles,
+        const char* outputFilePath,
+        CaideCancellationToken* cancellationToken,
+        int timeoutMilliseconds)
+{
+    CaideCallSettings settings = {};
+    settings.cancellationToken = cancellationToken;
+    settings.timeoutMilliseconds = timeoutMilliseconds;
+    return caideInlineCppCodeWithStats(options, cppFilePaths, numCppFiles, outputFilePath,
+        &settings, nullptr);
+}
+
+static void applySettings(caide::CppInliner& inliner, const CaideCallSettings* settings) {
+    if (!settings)
+        return;
+    if (settings->cancellationToken)
+        inliner.cancellationToken = settings->cancellationToken->token;
+    inliner.timeout = std::chrono::milliseconds(settings->timeoutMilliseconds);
+    inliner.optimizerTimeBudget = std::chrono::milliseconds(
+        std::max(settings->optimizerTimeBudgetMilliseconds, 0));
+    inliner.optimizerMemoryBudget = static_cast<std::size_t>(settings->optimizerMemoryBudget);
+    inliner.hardwareCounters = settings->hardwareCounters != 0;
+}
+
+static CaidePhaseStats toCStats(const caide::PhaseStats& phase) {
+    CaidePhaseStats res;
+    res.wallTimeMilliseconds =
+        std::chrono::duration<double, std::milli>(phase.wallTime).count();
+    res.cycles = phase.cycles;
+    res.instructions = phase.instructions;
+    res.cacheMisses = phase.cacheMisses;
+    res.branchMisses = phase.branchMisses;
+    res.residentSetSizeDelta = phase.residentSetSizeDelta;
+    res.astBytes = phase.astBytes;
+    res.sourceManagerBytes = phase.sourceManagerBytes;
+    res.caideBytes = phase.caideBytes;
+    return res;
+}
+
+static CaideStats toCStats(const caide::Stats& stats) {
+    CaideStats res;
+    res.degraded = stats.degraded ? 1 : 0;
+    res.hasHardwareCounters = stats.hasHardwareCounters ? 1 : 0;
+    res.inliner = toCStats(stats.inliner);
+    res.optimizer = toCStats(stats.optimizer);
+    res.dependencyGraph = toCStats(stats.dependencyGraph);
+    res.reachability = toCStats(stats.reachability);
+    res.codeRemoval = toCStats(stats.codeRemoval);
+    res.rewrite = toCStats(stats.rewrite);
+    res.peakResidentSetSize = stats.peakResidentSetSize;
+    res.bytesIn = stats.bytesIn;
+    res.bytesInlined = stats.bytesInlined;
+    res.bytesOut = stats.bytesOut;
+    res.declsVisited = stats.declsVisited;
+    res.declsVisitedForRemoval = stats.declsVisitedForRemoval;
+    res.graphNodes = stats.graphNodes;
+    res.graphEdges = stats.graphEdges;
+    res.reachableDecls = stats.reachableDecls;
+    res.removedRanges = stats.removedRanges;
+    res.macrosTracked = stats.macrosTracked;
+    res.delayedFunctionsParsed = stats.delayedFunctionsParsed;
+    res.templateArgumentSubstitutions = stats.templateArgumentSubstitutions;
+    res.astNodesVisited = stats.astNodesVisited;
+    res.lexerCalls = stats.lexerCalls;
+    res.intervalSetOperations = stats.intervalSetOperations;
+    res.dependencySummariesLoaded = stats.dependencySummariesLoaded;
+    res.dependencySummariesSaved = stats.dependencySummariesSaved;
+    return res;
+}
+
+extern "C" int caideInlineCppCodeWithStats(
+        const CaideCppInlinerOptions* options,
+        const char** cppFilePaths,
+        int numCppFiles,
+        const char* outputFilePath,
+        const CaideCallSettings* settings,
+        CaideStats* stats)
+{
+    try {
+        caide::CppInliner inliner = createInliner(options);
+        applySettings(inliner, settings);
+        inliner.hardwareCounters = inliner.hardwareCounters && stats != nullptr;
+        vector<string> files = arrayToCppVector(cppFilePaths, numCppFiles);
+        caide::Stats cppStats = inliner.inlineCode(files, outputFilePath);
+        if (stats)
+            *stats = toCStats(cppStats);
+        return 0;
+    } catch (const caide::InliningCancelled& e) {
+        std::cerr << e.what() << std::endl;
+        return 3;
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    } catch (...) {
+        return 2;
+    }
+}
+
+extern "C" int caideInlineCppCodeVariants(
+        const CaideCppInlinerOptions* options,
+        const char** cppFilePaths,
+        int numCppFiles,
+        const CaideCppInlinerRoots* roots,
+        const char** outputFilePaths,
+        int numOutputs)
+{
+    return caideInlineCppCodeVariantsWithStats(options, cppFilePaths, numCppFiles,
+        roots, outputFilePaths, numOutputs, nullptr, nullptr);
+}
+
+extern "C" int caideInlineCppCodeVariantsWithStats(
+        const CaideCppInlinerOptions* options,
+        const char** cppFilePaths,
+        int numCppFiles,
+        const CaideCppInlinerRoots* roots,
+        const char** outputFilePaths,
+        int numOutputs,
+        const CaideCallSettings* settings,
+        CaideStats* stats)
+{
+    try {
+        caide::CppInliner inliner = createInliner(options);
+        applySettings(inliner, settings);
+        inliner.hardwareCounters = inliner.hardwareCounters && stats != nullptr;
+        vector<string> files = arrayToCppVector(cppFilePaths, numCppFiles);
+        vector<caide::RootSpecification> rootSpecs(numOutputs);
+        for (int i = 0; i < numOutputs; ++i) {
+            rootSpecs[i].keepMain = roots[i].keepMain != 0;
+            rootSpecs[i].identifiersToKeep = arrayToCppVector(
+                roots[i].identifiersToKeep, roots[i].numIdentifiersToKeep);
+        }
+        vector<string> outputs = arrayToCppVector(outputFilePaths, numOutputs);
+        caide::Stats cppStats = inliner.inlineCodeVariants(files, rootSpecs, outputs);
+        if (stats)
+            *stats = toCStats(cppStats);
+        return 0;
+    } catch (const caide::InliningCancelled& e) {
+        std::cerr << e.what() << std::endl;
+        return 3;
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    } catch (...) {
+        return 2;
+    }
+}
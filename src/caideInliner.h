@@ -39,6 +39,128 @@ int caideInlineCppCode(
         int numCppFiles,
         const char* outputFilePath);
 
+/* Allows to stop caideInlineCppCodeCancellable() from another thread. */
+struct CaideCancellationToken;
+
+/* Returns NULL if out of memory. */
+struct CaideCancellationToken* caideCreateCancellationToken(void);
+
+/* Thread-safe. A cancelled token stays cancelled. */
+void caideCancel(struct CaideCancellationToken* token);
+
+void caideDestroyCancellationToken(struct CaideCancellationToken* token);
+
+/* Same as caideInlineCppCode, but returns 3 if cancellationToken (may be NULL) has been
+   cancelled or if the call takes longer than timeoutMilliseconds (no limit if not positive). */
+int caideInlineCppCodeCancellable(
+        const struct CaideCppInlinerOptions* options,
+        const char** cppFilePaths,
+        int numCppFiles,
+        const char* outputFilePath,
+        struct CaideCancellationToken* cancellationToken,
+        int timeoutMilliseconds);
+
+/* See caide::PhaseStats. */
+struct CaidePhaseStats {
+    double wallTimeMilliseconds;
+    unsigned long long cycles;
+    unsigned long long instructions;
+    unsigned long long cacheMisses;
+    unsigned long long branchMisses;
+    long long residentSetSizeDelta;
+    unsigned long long astBytes;
+    unsigned long long sourceManagerBytes;
+    unsigned long long caideBytes;
+};
+
+/* See caide::Stats. */
+struct CaideStats {
+    int degraded;
+    int hasHardwareCounters;
+
+    struct CaidePhaseStats inliner;
+    struct CaidePhaseStats optimizer;
+    struct CaidePhaseStats dependencyGraph;
+    struct CaidePhaseStats reachability;
+    struct CaidePhaseStats codeRemoval;
+    struct CaidePhaseStats rewrite;
+
+    unsigned long long peakResidentSetSize;
+    unsigned long long bytesIn;
+    unsigned long long bytesInlined;
+    unsigned long long bytesOut;
+    unsigned long long declsVisited;
+    unsigned long long declsVisitedForRemoval;
+    unsigned long long graphNodes;
+    unsigned long long graphEdges;
+    unsigned long long reachableDecls;
+    unsigned long long removedRanges;
+    unsigned long long macrosTracked;
+    unsigned long long delayedFunctionsParsed;
+    unsigned long long templateArgumentSubstitutions;
+    unsigned long long astNodesVisited;
+    unsigned long long lexerCalls;
+    unsigned long long intervalSetOperations;
+    unsigned long long dependencySummariesLoaded;
+    unsigned long long dependencySummariesSaved;
+};
+
+/* Limits of one call. Zero-initialize the struct and set the fields you need. */
+struct CaideCallSettings {
+    /* May be NULL. */
+    struct CaideCancellationToken* cancellationToken;
+
+    /* No limit if not positive. */
+    int timeoutMilliseconds;
+
+    /* See caide::CppInliner::optimizerTimeBudget. No limit if not positive. */
+    int optimizerTimeBudgetMilliseconds;
+
+    /* See caide::CppInliner::optimizerMemoryBudget. No limit if zero. */
+    unsigned long long optimizerMemoryBudget;
+
+    /* See caide::CppInliner::hardwareCounters. Measured if nonzero and stats are requested. */
+    int hardwareCounters;
+};
+
+/* Same as caideInlineCppCodeCancellable, but with settings (may be NULL), and also fills stats
+   (may be NULL) on success. */
+int caideInlineCppCodeWithStats(
+        const struct CaideCppInlinerOptions* options,
+        const char** cppFilePaths,
+        int numCppFiles,
+        const char* outputFilePath,
+        const struct CaideCallSettings* settings,
+        struct CaideStats* stats);
+
+struct CaideCppInlinerRoots {
+    int keepMain;
+
+    const char** identifiersToKeep;
+    int numIdentifiersToKeep;
+};
+
+int caideInlineCppCodeVariants(
+        const struct CaideCppInlinerOptions* options,
+        const char** cppFilePaths,
+        int numCppFiles,
+        const struct CaideCppInlinerRoots* roots,
+        const char** outputFilePaths,
+        int numOutputs);
+
+/* Same as caideInlineCppCodeVariants, but with settings (may be NULL), and also fills stats
+   (may be NULL) on success. Returns 3 if the call has been cancelled or has timed out, as
+   caideInlineCppCodeCancellable. */
+int caideInlineCppCodeVariantsWithStats(
+        const struct CaideCppInlinerOptions* options,
+        const char** cppFilePaths,
+        int numCppFiles,
+        const struct CaideCppInlinerRoots* roots,
+        const char** outputFilePaths,
+        int numOutputs,
+        const struct CaideCallSettings* settings,
+        struct CaideStats* stats);
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif
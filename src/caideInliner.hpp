@@ -6,6 +6,12 @@
 
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
 #include <string>
 #include <vector>
 
@@ -15,6 +21,274 @@
 
 namespace caide {
 
+/// \brief Code to keep in one output of CppInliner::inlineCodeVariants()
+///
+/// Declarations marked with a comment 'caide keep' and CppInliner::identifiersToKeep
+/// are kept in all outputs.
+struct RootSpecification {
+    /// \brief Whether code reachable from main function is kept
+    bool keepMain = true;
+
+    /// \brief Fully qualified names to preserve in this output, in addition to
+    /// CppInliner::identifiersToKeep (e.g. entry points of a particular problem)
+    std::vector<std::string> identifiersToKeep;
+};
+
+/// \brief Allows to stop CppInliner calls from another thread
+///
+/// A token may be shared by several CppInliner objects and calls. Once cancelled, it stays
+/// cancelled.
+class CancellationToken {
+public:
+    /// \brief Request cancellation of all calls using this token. Thread-safe.
+    void cancel() noexcept { cancelled.store(true, std::memory_order_relaxed); }
+
+    bool isCancelled() const noexcept { return cancelled.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<bool> cancelled{false};
+};
+
+/// \brief Resources used by one phase of CppInliner::inlineCode()
+struct PhaseStats {
+    /// \brief Wall time of the phase
+    std::chrono::nanoseconds wallTime{0};
+
+    /// \name Hardware counters
+    /// User space CPU cycles, instructions, cache misses and branch misses of the phase. Zero
+    /// unless Stats::hasHardwareCounters is set.
+    /// @{
+    std::uint64_t cycles = 0;
+    std::uint64_t instructions = 0;
+    std::uint64_t cacheMisses = 0;
+    std::uint64_t branchMisses = 0;
+    /// @}
+
+    /// \brief Change of the resident set size of the process during the phase, in bytes
+    ///
+    /// May be negative. Zero if it is not available (only Linux is supported).
+    std::int64_t residentSetSizeDelta = 0;
+
+    /// \name Memory at the end of the phase
+    /// Memory allocated for clang AST, memory used by source buffers and tables of clang
+    /// SourceManager, and approximate footprint of caide data structures (e.g. dependency graph,
+    /// removed ranges, macro tables), in bytes. If a phase is repeated for several outputs,
+    /// the maximum is reported. Zero if not applicable to the phase.
+    /// @{
+    std::uint64_t astBytes = 0;
+    std::uint64_t sourceManagerBytes = 0;
+    std::uint64_t caideBytes = 0;
+    /// @}
+};
+
+/// \brief Costs attributed to one header (see CppInliner::headerStats)
+///
+/// Times are self times: time spent while the header is at the top of the include stack,
+/// not including headers it includes.
+struct HeaderStats {
+    /// \brief Path of the header as found by the preprocessor
+    std::string path;
+
+    /// \brief Path of the file that first included the header
+    std::string includedFrom;
+
+    /// \brief Whether the header is a system header
+    bool isSystem = false;
+
+    /// \brief Time spent preprocessing the header in the first stage
+    std::chrono::nanoseconds preprocessingTime{0};
+
+    /// \brief Time spent lexing and parsing the header in the second stage
+    ///
+    /// Zero for user headers: they are parsed as part of the inlined file.
+    std::chrono::nanoseconds parseTime{0};
+
+    /// \brief Declarations in the header, including nested ones
+    ///
+    /// Zero for user headers, see parseTime.
+    std::uint64_t decls = 0;
+
+    /// \brief Implicit instantiations of templates defined in the header
+    ///
+    /// Zero for user headers, see parseTime.
+    std::uint64_t instantiations = 0;
+
+    /// \brief Size of the header
+    std::uint64_t bytes = 0;
+};
+
+/// \brief Costs of building the dependency graph attributed to one template
+/// (see CppInliner::templateStats)
+///
+/// Work done while traversing a template, its specializations and instantiations, or while
+/// substituting template arguments into it, is attributed to its primary template. Nested
+/// templates are attributed their own work only.
+struct TemplateStats {
+    /// \brief Qualified name of the primary template
+    std::string name;
+
+    /// \brief Location of the primary template in the code processed by the second stage
+    /// (file:line)
+    std::string location;
+
+    /// \brief Time spent in the template
+    std::chrono::nanoseconds traversalTime{0};
+
+    /// \brief Declarations, statements and types visited
+    std::uint64_t nodesVisited = 0;
+
+    /// \brief Edges added to the dependency graph
+    std::uint64_t edges = 0;
+};
+
+/// \brief References inserted into the dependency graph by one hook of the dependency collector
+/// (see CppInliner::edgeStats)
+///
+/// A reference is the request of a hook to add an edge; it may be ignored (e.g. a reference to
+/// a system declaration) or duplicate an existing edge.
+struct EdgeStats {
+    /// \brief Name of the hook, e.g. "VisitDeclRefExpr"
+    ///
+    /// References made while traversing the signature of a template specialization are
+    /// prefixed with "traverseSugaredSignature/".
+    std::string hook;
+
+    /// \brief References made by the hook
+    std::uint64_t references = 0;
+
+    /// \brief References that added a new edge
+    std::uint64_t newEdges = 0;
+
+    /// \brief References to an existing edge
+    std::uint64_t duplicateEdges = 0;
+
+    /// \brief New edges whose source declaration is reachable from the roots of some output
+    std::uint64_t reachableEdges = 0;
+};
+
+/// \brief Information about one CppInliner::inlineCode() or CppInliner::inlineCodeVariants() call
+///
+/// Phases that didn't run (e.g. the inliner for a single file that includes only system
+/// headers) have zero stats. With several outputs, the work done for each output (e.g.
+/// removedRanges, bytesOut) is summed over all outputs.
+struct Stats {
+    /// \brief Whether the optimizer exceeded its budget, so that the output contains the inlined,
+    /// but not optimized program
+    ///
+    /// \sa CppInliner::optimizerTimeBudget
+    bool degraded = false;
+
+    /// \brief Whether hardware counters of the phases have been measured
+    ///
+    /// \sa CppInliner::hardwareCounters
+    bool hasHardwareCounters = false;
+
+    /// \brief First stage: combining source files and user headers into a single file
+    PhaseStats inliner;
+
+    /// \brief Second stage: removal of unused code, including the phases below and the time
+    /// spent before it was abandoned
+    PhaseStats optimizer;
+
+    /// \brief Building of the dependency graph, including parsing of delayed-parsed functions
+    PhaseStats dependencyGraph;
+
+    /// \brief Search for reachable declarations for each output, if there are several outputs
+    PhaseStats reachability;
+
+    /// \brief Removal of unused declarations
+    PhaseStats codeRemoval;
+
+    /// \brief Removal of unused macros and inactive preprocessor blocks, and rewriting
+    PhaseStats rewrite;
+
+    /// \brief Peak resident set size of the process at the end of the call, in bytes
+    ///
+    /// Zero if it is not available on this platform.
+    std::uint64_t peakResidentSetSize = 0;
+
+    /// \brief Size of all source files
+    std::uint64_t bytesIn = 0;
+
+    /// \brief Size of the output of the first stage (of the source file, if the first stage
+    /// is skipped)
+    std::uint64_t bytesInlined = 0;
+
+    /// \brief Size of all output files
+    std::uint64_t bytesOut = 0;
+
+    /// \brief Declarations traversed while building the dependency graph
+    std::uint64_t declsVisited = 0;
+
+    /// \brief Declarations traversed while removing unused code
+    std::uint64_t declsVisitedForRemoval = 0;
+
+    /// \brief Nodes of the dependency graph, i.e. declarations that use something
+    std::uint64_t graphNodes = 0;
+
+    /// \brief Edges of the dependency graph
+    std::uint64_t graphEdges = 0;
+
+    /// \brief Declarations reachable from the roots of any output
+    std::uint64_t reachableDecls = 0;
+
+    /// \brief Source ranges removed by the optimizer
+    std::uint64_t removedRanges = 0;
+
+    /// \brief Macros defined in user code, tracked to find out whether they are used
+    std::uint64_t macrosTracked = 0;
+
+    /// \brief Delayed-parsed (e.g. with -fdelayed-template-parsing) functions that had to be parsed
+    std::uint64_t delayedFunctionsParsed = 0;
+
+    /// \brief Substitutions of template arguments into template signatures
+    std::uint64_t templateArgumentSubstitutions = 0;
+
+    /// \brief Declarations, statements and types visited while building the dependency graph
+    std::uint64_t astNodesVisited = 0;
+
+    /// \brief Raw lexer calls made by the optimizer to find tokens, e.g. the semicolon
+    /// after a declaration
+    std::uint64_t lexerCalls = 0;
+
+    /// \brief Insertions into and queries of the set of source ranges removed by the optimizer
+    std::uint64_t intervalSetOperations = 0;
+
+    /// \brief Top-level declarations whose dependencies have been read from
+    /// CppInliner::dependencySummaryCache instead of traversing them
+    std::uint64_t dependencySummariesLoaded = 0;
+
+    /// \brief Top-level declarations whose dependencies have been saved to
+    /// CppInliner::dependencySummaryCache
+    std::uint64_t dependencySummariesSaved = 0;
+
+    /// \brief Headers included by the program, in order of decreasing cost
+    /// (preprocessingTime + parseTime)
+    ///
+    /// Empty unless CppInliner::headerStats is set.
+    std::vector<HeaderStats> headers;
+
+    /// \brief Templates traversed while building the dependency graph, in order of decreasing
+    /// traversal time
+    ///
+    /// Empty unless CppInliner::templateStats is set.
+    std::vector<TemplateStats> templates;
+
+    /// \brief Hooks of the dependency collector, in order of decreasing number of new edges
+    ///
+    /// Empty unless CppInliner::edgeStats is set.
+    std::vector<EdgeStats> edges;
+};
+
+/// \brief Exception thrown by CppInliner when a call has been cancelled
+/// or has exceeded CppInliner::timeout
+///
+/// No output file is written in this case. The CppInliner object may be used again.
+class InliningCancelled: public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
+
 /// \brief C++ code inliner and unused code remover
 ///
 /// The C++ inliner transforms a program implemented as multiple C++ source files
@@ -44,12 +318,29 @@ public:
     /// All input C++ files and included user headers will be combined into a single C++ file,
     /// and only code reachable from main function will be kept. In addition, declarations
     /// marked with a comment 'caide keep' will be kept too.
-    void inlineCode(const std::vector<std::string>& cppFilePaths,
+    ///
+    /// \return statistics of this call
+    Stats inlineCode(const std::vector<std::string>& cppFilePaths,
                     const std::string& outputFilePath) const;
 
+    /// \brief Generate several single-file C++ programs from the same multiple-file program.
+    /// \param cppFilePaths full paths of all C++ files of a program
+    /// \param roots code to keep in each output
+    /// \param outputFilePaths paths to files where the inlined programs will be written, one for
+    /// each element of roots
+    ///
+    /// Same as calling inlineCode() once for each element of roots, with corresponding
+    /// identifiersToKeep, but the program is parsed and analyzed only once.
+    Stats inlineCodeVariants(const std::vector<std::string>& cppFilePaths,
+                            const std::vector<RootSpecification>& roots,
+                            const std::vector<std::string>& outputFilePaths) const;
+
     /// \brief Try to detect system include paths automatically and adjust
     /// clangCompilationOptions accordingly.
     ///
+    /// If CXX environment variable is set, the include paths of that (GCC-like) compiler are
+    /// used. Otherwise, the paths are computed by clang driver for the default target.
+    ///
     /// \sa clangCompilationOptions
     void autoDetectCompilationOptions();
 
@@ -114,8 +405,114 @@ public:
     /// Normally, only code reachable from main or marked by special comments
     /// is preserved. This settings provides additional identifiers to preserve.
     /// Identifiers must be fully qualified, e.g. "NamespaceName::ClassName::method".
+    /// A trailing '*' in a name component matches any name with the given prefix, e.g.
+    /// "NamespaceName::*" or "ClassName::get*". "ClassName::operator*" and
+    /// "ClassName::operator->*" denote these operators, not wildcards. Names with template
+    /// arguments (e.g. "ClassName<int>::method") are compared with names of all declarations
+    /// in the program, which is slower.
     std::vector<std::string> identifiersToKeep;
 
+    /// \brief whether to skip preprocessing of system headers that have been seen before
+    ///
+    /// System headers are not inlined, but the inliner still has to preprocess them
+    /// to know which macros they define. If this parameter is true, the macro definitions
+    /// made by a system header included from user code are remembered, and next time the
+    /// header is included after the same system headers, macro directives of user code and
+    /// with the same compilation options, they are used instead of the header. The cache lives
+    /// for the lifetime of the process.
+    ///
+    /// Default value is false.
+    bool opaqueSystemHeaders;
+
+    /// \brief whether to include only system headers that supply used code
+    ///
+    /// Normally, all system headers included by the source files are included in the output.
+    /// If this parameter is true, the output includes only those that supply declarations
+    /// and macros used by the remaining code. A header that is used only through a header
+    /// it includes (e.g. `<bits/stdc++.h>` including `<vector>`) may be replaced with the
+    /// latter. If the resulting program doesn't compile, all headers are included.
+    ///
+    /// Default value is false.
+    bool minimizeIncludes;
+
+    /// \brief Directory where dependencies of top-level declarations are cached between calls
+    ///
+    /// Building the dependency graph requires traversal of all used code. If this parameter is
+    /// not empty, dependencies of each top-level declaration of the program are saved in this
+    /// directory, and the next call reads them instead of traversing the declaration, provided
+    /// that the code up to the end of the declaration (including included headers), compilation
+    /// options and the version of clang have not changed. This speeds up repeated inlining of
+    /// a program with a large library prefix. The directory is created if it doesn't exist;
+    /// errors of reading and writing it are ignored. It may be shared by several processes.
+    ///
+    /// Not used with -fdelayed-template-parsing.
+    ///
+    /// Default value is empty (no cache).
+    std::string dependencySummaryCache;
+
+    /// \brief Token to stop inlineCode() and inlineCodeVariants() calls from another thread
+    ///
+    /// Cancellation is cooperative: it is checked during parsing, template instantiation and
+    /// analysis, so a cancelled call returns soon, but not immediately.
+    ///
+    /// Default value is null (no cancellation).
+    std::shared_ptr<const CancellationToken> cancellationToken;
+
+    /// \brief Time limit for a single inlineCode() or inlineCodeVariants() call
+    ///
+    /// A call that runs longer is cancelled (see cancellationToken).
+    ///
+    /// Default value is zero (no time limit).
+    std::chrono::milliseconds timeout;
+
+    /// \brief Time limit for removal of unused code
+    ///
+    /// If the limit is exceeded, the output contains all code of the inlined program, and
+    /// Stats::degraded is set. Unlike timeout, this is not an error.
+    ///
+    /// Default value is zero (no time limit).
+    std::chrono::milliseconds optimizerTimeBudget;
+
+    /// \brief Limit on memory allocated for the AST during removal of unused code, in bytes
+    ///
+    /// Handled the same way as optimizerTimeBudget.
+    ///
+    /// Default value is zero (no memory limit).
+    std::size_t optimizerMemoryBudget;
+
+    /// \brief whether to measure hardware counters of the phases in Stats
+    ///
+    /// Counters are read with perf_event_open and are only available on Linux. If they are
+    /// not available (e.g. not permitted by perf_event_paranoid setting), they are silently
+    /// not measured, and Stats::hasHardwareCounters is false.
+    ///
+    /// Default value is false.
+    bool hardwareCounters;
+
+    /// \brief whether to attribute costs to individual headers in Stats::headers
+    ///
+    /// Use this to find out which header makes inlining slow. Each include directive and
+    /// declaration is examined, which has some overhead.
+    ///
+    /// Default value is false.
+    bool headerStats;
+
+    /// \brief whether to attribute costs of building the dependency graph to templates in
+    /// Stats::templates
+    ///
+    /// Use this to find out which templates dominate the time of unused code removal.
+    ///
+    /// Default value is false.
+    bool templateStats;
+
+    /// \brief whether to count references inserted into the dependency graph by each hook of
+    /// the dependency collector in Stats::edges
+    ///
+    /// Use this to find out which kinds of references make the dependency graph large.
+    ///
+    /// Default value is false.
+    bool edgeStats;
+
 private:
     const std::string temporaryDirectory;
 };
@@ -6,6 +6,8 @@
 
 #include "../caideInliner.hpp"
 
+#include <chrono>
+#include <cstdint>
 #include <cstdlib>
 #include <fstream>
 #include <iostream>
@@ -15,6 +17,131 @@
 
 using namespace std;
 
+static void printJson(ostream& out, const char* name, const caide::PhaseStats& phase,
+        bool withCounters, bool last = false)
+{
+    out << "    \"" << name << "\": {\"wallTimeMs\": "
+        << chrono::duration<double, milli>(phase.wallTime).count();
+    if (withCounters) {
+        out << ", \"cycles\": " << phase.cycles
+            << ", \"instructions\": " << phase.instructions
+            << ", \"cacheMisses\": " << phase.cacheMisses
+            << ", \"branchMisses\": " << phase.branchMisses;
+    }
+    out << ", \"residentSetSizeDelta\": " << phase.residentSetSizeDelta
+        << ", \"astBytes\": " << phase.astBytes
+        << ", \"sourceManagerBytes\": " << phase.sourceManagerBytes
+        << ", \"caideBytes\": " << phase.caideBytes;
+    out << (last ? "}\n" : "},\n");
+}
+
+static void printJsonString(ostream& out, const string& s) {
+    out << '"';
+    for (char c : s) {
+        if (c == '"' || c == '\\')
+            out << '\\' << c;
+        else if (static_cast<unsigned char>(c) < 0x20)
+            out << "\\u00" << "0123456789abcdef"[(c >> 4) & 0xf] << "0123456789abcdef"[c & 0xf];
+        else
+            out << c;
+    }
+    out << '"';
+}
+
+static void printJson(ostream& out, const caide::HeaderStats& header, bool last) {
+    out << "    {\"path\": ";
+    printJsonString(out, header.path);
+    out << ", \"includedFrom\": ";
+    printJsonString(out, header.includedFrom);
+    out << ", \"system\": " << (header.isSystem ? "true" : "false")
+        << ", \"preprocessingMs\": "
+        << chrono::duration<double, milli>(header.preprocessingTime).count()
+        << ", \"parseMs\": " << chrono::duration<double, milli>(header.parseTime).count()
+        << ", \"decls\": " << header.decls
+        << ", \"instantiations\": " << header.instantiations
+        << ", \"bytes\": " << header.bytes;
+    out << (last ? "}\n" : "},\n");
+}
+
+static void printJson(ostream& out, const caide::TemplateStats& templateStats, bool last) {
+    out << "    {\"name\": ";
+    printJsonString(out, templateStats.name);
+    out << ", \"location\": ";
+    printJsonString(out, templateStats.location);
+    out << ", \"traversalMs\": "
+        << chrono::duration<double, milli>(templateStats.traversalTime).count()
+        << ", \"nodesVisited\": " << templateStats.nodesVisited
+        << ", \"edges\": " << templateStats.edges;
+    out << (last ? "}\n" : "},\n");
+}
+
+static void printJson(ostream& out, const caide::EdgeStats& edgeStats, bool last) {
+    out << "    {\"hook\": ";
+    printJsonString(out, edgeStats.hook);
+    out << ", \"references\": " << edgeStats.references
+        << ", \"newEdges\": " << edgeStats.newEdges
+        << ", \"duplicateEdges\": " << edgeStats.duplicateEdges
+        << ", \"reachableEdges\": " << edgeStats.reachableEdges;
+    out << (last ? "}\n" : "},\n");
+}
+
+static void printJson(ostream& out, const char* name, uint64_t value, bool last = false) {
+    out << "    \"" << name << "\": " << value << (last ? "\n" : ",\n");
+}
+
+static void printJson(ostream& out, const caide::Stats& stats) {
+    out << "{\n";
+    out << "  \"degraded\": " << (stats.degraded ? "true" : "false") << ",\n";
+    out << "  \"phases\": {\n";
+    const bool withCounters = stats.hasHardwareCounters;
+    printJson(out, "inliner", stats.inliner, withCounters);
+    printJson(out, "optimizer", stats.optimizer, withCounters);
+    printJson(out, "dependencyGraph", stats.dependencyGraph, withCounters);
+    printJson(out, "reachability", stats.reachability, withCounters);
+    printJson(out, "codeRemoval", stats.codeRemoval, withCounters);
+    printJson(out, "rewrite", stats.rewrite, withCounters, true);
+    out << "  },\n";
+    out << "  \"counters\": {\n";
+    printJson(out, "peakResidentSetSize", stats.peakResidentSetSize);
+    printJson(out, "bytesIn", stats.bytesIn);
+    printJson(out, "bytesInlined", stats.bytesInlined);
+    printJson(out, "bytesOut", stats.bytesOut);
+    printJson(out, "declsVisited", stats.declsVisited);
+    printJson(out, "declsVisitedForRemoval", stats.declsVisitedForRemoval);
+    printJson(out, "graphNodes", stats.graphNodes);
+    printJson(out, "graphEdges", stats.graphEdges);
+    printJson(out, "reachableDecls", stats.reachableDecls);
+    printJson(out, "removedRanges", stats.removedRanges);
+    printJson(out, "macrosTracked", stats.macrosTracked);
+    printJson(out, "delayedFunctionsParsed", stats.delayedFunctionsParsed);
+    printJson(out, "templateArgumentSubstitutions", stats.templateArgumentSubstitutions);
+    printJson(out, "astNodesVisited", stats.astNodesVisited);
+    printJson(out, "lexerCalls", stats.lexerCalls);
+    printJson(out, "intervalSetOperations", stats.intervalSetOperations);
+    printJson(out, "dependencySummariesLoaded", stats.dependencySummariesLoaded);
+    printJson(out, "dependencySummariesSaved", stats.dependencySummariesSaved, true);
+    out << "  }";
+    if (!stats.headers.empty()) {
+        out << ",\n  \"headers\": [\n";
+        for (size_t i = 0; i < stats.headers.size(); ++i)
+            printJson(out, stats.headers[i], i + 1 == stats.headers.size());
+        out << "  ]";
+    }
+    if (!stats.templates.empty()) {
+        out << ",\n  \"templates\": [\n";
+        for (size_t i = 0; i < stats.templates.size(); ++i)
+            printJson(out, stats.templates[i], i + 1 == stats.templates.size());
+        out << "  ]";
+    }
+    if (!stats.edges.empty()) {
+        out << ",\n  \"edges\": [\n";
+        for (size_t i = 0; i < stats.edges.size(); ++i)
+            printJson(out, stats.edges[i], i + 1 == stats.edges.size());
+        out << "  ]";
+    }
+    out << "\n}\n";
+}
+
 int main(int argc, const char* argv[]) {
     vector<string> sourceFiles;
     string tmpDirectory = "./caide-tmp";
@@ -22,12 +149,24 @@ int main(int argc, const char* argv[]) {
     vector<string> clangOptions;
     vector<string> macrosToKeep;
     int maxConsecutiveEmptyLines = 2;
+    bool minimizeIncludes = false;
+    bool printStats = false;
+    bool headerStats = false;
+    bool templateStats = false;
+    bool edgeStats = false;
+    string dependencySummaryCache;
 
     const string clangOptionsEnd = "--";
     const string directoryFlag = "-d";
     const string outputFlag = "-o";
     const string keepMacrosFlag = "-k";
     const string emptyLinesFlag = "-l";
+    const string minimizeIncludesFlag = "-m";
+    const string statsFlag = "-s";
+    const string headerStatsFlag = "-H";
+    const string templateStatsFlag = "-T";
+    const string edgeStatsFlag = "-E";
+    const string dependencySummaryCacheFlag = "-c";
 
     int i = 1;
     for (; i < argc && clangOptionsEnd != argv[i]; ++i) {
@@ -55,6 +194,19 @@ int main(int argc, const char* argv[]) {
         } else if (emptyLinesFlag == argv[i]) {
             ++i;
             if (i < argc) maxConsecutiveEmptyLines = strtol(argv[i], nullptr, 10);
+        } else if (minimizeIncludesFlag == argv[i]) {
+            minimizeIncludes = true;
+        } else if (statsFlag == argv[i]) {
+            printStats = true;
+        } else if (headerStatsFlag == argv[i]) {
+            printStats = headerStats = true;
+        } else if (templateStatsFlag == argv[i]) {
+            printStats = templateStats = true;
+        } else if (edgeStatsFlag == argv[i]) {
+            printStats = edgeStats = true;
+        } else if (dependencySummaryCacheFlag == argv[i]) {
+            ++i;
+            if (i < argc) dependencySummaryCache = argv[i];
         } else {
             sourceFiles.emplace_back(argv[i]);
         }
@@ -65,7 +217,15 @@ int main(int argc, const char* argv[]) {
     inliner.macrosToKeep.insert(inliner.macrosToKeep.end(),
         macrosToKeep.begin(), macrosToKeep.end());
     inliner.maxConsequentEmptyLines = maxConsecutiveEmptyLines;
-    inliner.inlineCode(sourceFiles, outputFile);
+    inliner.minimizeIncludes = minimizeIncludes;
+    inliner.hardwareCounters = printStats;
+    inliner.headerStats = headerStats;
+    inliner.templateStats = templateStats;
+    inliner.edgeStats = edgeStats;
+    inliner.dependencySummaryCache = dependencySummaryCache;
+    caide::Stats stats = inliner.inlineCode(sourceFiles, outputFile);
+    if (printStats)
+        printJson(cout, stats);
 
     return 0;
 }
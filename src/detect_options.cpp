@@ -11,17 +11,36 @@
 #include <cstdlib>
 #include <fstream>
 #include <memory>
-#include <sstream>
 #include <string>
 #include <vector>
 
 #include <clang/AST/ASTConsumer.h>
 #include <clang/AST/ASTContext.h>
 #include <clang/Basic/Diagnostic.h>
+#include <clang/Basic/DiagnosticIDs.h>
+#include <clang/Basic/DiagnosticOptions.h>
+#include <clang/Driver/Compilation.h>
+#include <clang/Driver/Driver.h>
+#include <clang/Driver/Job.h>
+#include <clang/Driver/ToolChain.h>
 #include <clang/Frontend/FrontendAction.h>
 #include <clang/Tooling/CompilationDatabase.h>
 #include <clang/Tooling/Tooling.h>
 
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/Support/Allocator.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/Program.h>
+#include <llvm/Support/StringSaver.h>
+#if CAIDE_CLANG_VERSION_AT_LEAST(17, 0)
+#include <llvm/TargetParser/Host.h>
+#else
+#include <llvm/Support/Host.h>
+#endif
+
 using std::string;
 using std::vector;
 
@@ -32,24 +51,6 @@ namespace internal {
 
 namespace {
 
-string trim(const string& s) {
-    std::size_t i = s.find_first_not_of(" ");
-    std::size_t j = s.find_last_not_of(" ");
-    if (i != string::npos && j != string::npos && i <= j)
-        return s.substr(i, j - i + 1);
-    return s;
-}
-
-bool startsWith(const string& s, const string& prefix) {
-    return s.length() >= prefix.length() &&
-        std::mismatch(prefix.begin(), prefix.end(), s.begin()).first == prefix.end();
-}
-
-bool endsWith(const string& s, const string& prefix) {
-    return s.length() >= prefix.length() &&
-        std::mismatch(prefix.rbegin(), prefix.rend(), s.rbegin()).first == prefix.rend();
-}
-
 string pathConcat(const string& directory, const string& fileName) {
     return directory + "/" + fileName;
 }
@@ -81,36 +82,137 @@ public:
 #endif
 };
 
-bool testOptions(const vector<string>& compilationOptions, const string& cppFile) {
+bool testOptions(const vector<string>& compilationOptions, const string& cppFile,
+        const string& cppFileContent)
+{
     std::unique_ptr<clang::tooling::FixedCompilationDatabase> compilationDatabase(
         createCompilationDatabaseFromCommandLine(compilationOptions));
 
     vector<string> sources{cppFile};
     DetectOptionsFrontendActionFactory factory;
     clang::tooling::ClangTool tool(*compilationDatabase, sources);
+    tool.mapVirtualFile(cppFile, cppFileContent);
     return tool.run(&factory) == 0;
 }
 
-} // anonymous namespace
+// Include directories from the search list printed by a GCC-like compiler, in search order.
+// The command line (e.g. the value of CXX environment variable) is split as by a POSIX shell,
+// so that it may contain options and quoted paths, but the compiler is run without a shell.
+vector<string> getCompilerIncludeDirectories(const string& cxx, const string& temporaryDirectory) {
+    llvm::BumpPtrAllocator allocator;
+    llvm::StringSaver saver(allocator);
+    llvm::SmallVector<const char*, 8> cxxArgs;
+    llvm::cl::TokenizeGNUCommandLine(cxx, saver, cxxArgs);
+    if (cxxArgs.empty())
+        return {};
+
+    llvm::ErrorOr<string> program = llvm::sys::findProgramByName(cxxArgs[0]);
+    if (!program)
+        return {};
+
+    vector<StringRef> args(cxxArgs.begin(), cxxArgs.end());
+    for (const char* arg : {"-x", "c++", "-E", "-v", "-"})
+        args.push_back(arg);
+
+    // Empty source is read from the null device (empty redirect); the search list is printed
+    // to stderr.
+    const string logFile = pathConcat(temporaryDirectory, "cxx-search-list.txt");
+    if (llvm::sys::ExecuteAndWait(*program, args, /*Env*/{},
+            {StringRef(), StringRef(), StringRef(logFile)}) < 0)
+        return {};
+
+    std::ifstream log(logFile.c_str());
+    string line;
+    bool isSearchList = false;
+    vector<string> directories;
+    while (std::getline(log, line)) {
+        const StringRef trimmed = StringRef(line).trim();
+        if (trimmed.find("End of search list") == 0)
+            break;
+
+        const StringRef searchListStart = "search starts here:";
+        if (trimmed.take_back(searchListStart.size()) == searchListStart)
+            isSearchList = true;
+        else if (isSearchList && llvm::sys::fs::is_directory(trimmed))
+            directories.push_back(trimmed.str());
+    }
 
-vector<string> detectClangOptions(const string& temporaryDirectory) {
-    vector<string> gccLikeCompilers;
-    if (const char* cxx = ::getenv("CXX"))
-        gccLikeCompilers.push_back(cxx);
-    vector<string> options{"g++", "clang++"};
-    for (const auto& s : options) {
-        if (gccLikeCompilers.end() == std::find(gccLikeCompilers.begin(), gccLikeCompilers.end(), s)) {
-            gccLikeCompilers.push_back(s);
+    return directories;
+}
+
+// System include directories, in search order, as computed by clang driver for the default
+// target. This includes detection of GCC installation (libstdc++ headers), MSVC headers etc.
+vector<string> getSystemIncludeDirectories() {
+    IgnoringDiagConsumer diagConsumer;
+#if CAIDE_CLANG_VERSION_AT_LEAST(21, 0)
+    DiagnosticOptions diagOptions;
+    DiagnosticsEngine diags(new DiagnosticIDs(), diagOptions, &diagConsumer, /*ShouldOwnClient*/false);
+#else
+    IntrusiveRefCntPtr<DiagnosticOptions> diagOptions(new DiagnosticOptions());
+    DiagnosticsEngine diags(new DiagnosticIDs(), diagOptions, &diagConsumer, /*ShouldOwnClient*/false);
+#endif
+
+    // The executable doesn't need to exist; the directories are found relative to the system
+    // root and the detected GCC installation.
+    driver::Driver driver("clang++", llvm::sys::getDefaultTargetTriple(), diags);
+    const char* args[] = {"clang++", "--driver-mode=g++", "-fsyntax-only", "-x", "c++", "-"};
+    std::unique_ptr<driver::Compilation> compilation(driver.BuildCompilation(args));
+    if (!compilation || diags.hasErrorOccurred())
+        return {};
+
+    vector<string> directories;
+    auto addDirectory = [&](StringRef dir) {
+        if (llvm::sys::fs::is_directory(dir)
+                && std::find(directories.begin(), directories.end(), dir) == directories.end())
+            directories.push_back(dir.str());
+    };
+
+    for (const driver::Command& job : compilation->getJobs()) {
+        const llvm::opt::ArgStringList& jobArgs = job.getArguments();
+        if (jobArgs.empty() || StringRef(jobArgs[0]) != "-cc1")
+            continue;
+        for (size_t i = 0; i + 1 < jobArgs.size(); ++i) {
+            StringRef arg(jobArgs[i]);
+            if (arg == "-internal-isystem" || arg == "-internal-externc-isystem"
+                    || arg == "-isystem" || arg == "-cxx-isystem")
+                addDirectory(jobArgs[++i]);
         }
+        break;
     }
 
-    const string emptySourceFile = pathConcat(temporaryDirectory, "empty.cpp");
-    const string outputExeFile = pathConcat(temporaryDirectory, "detect.exe");
-    const string gccLogFile = pathConcat(temporaryDirectory, "gcclog.txt");
-    const string detectSourceFile = pathConcat(temporaryDirectory, "detect.cpp");
-    (void)std::ofstream(emptySourceFile.c_str());
-    std::ofstream detectFile(detectSourceFile.c_str());
-    detectFile <<
+    // Builtin headers (stddef.h etc.) are looked up in the resource directory, which is not
+    // available to a library, and then among toolchain paths that include the GCC installation.
+    string builtinHeader = driver.GetFilePath("include/stddef.h", compilation->getDefaultToolChain());
+    if (llvm::sys::path::is_absolute(builtinHeader)) {
+        StringRef builtinDir = llvm::sys::path::parent_path(builtinHeader);
+        if (std::find(directories.begin(), directories.end(), builtinDir) == directories.end()) {
+            // Same as GCC: builtin headers come after C++ standard library headers.
+            auto it = std::find_if(directories.begin(), directories.end(), [](const string& dir) {
+                return dir.find("c++") == string::npos;
+            });
+            if (llvm::sys::fs::is_directory(builtinDir))
+                directories.insert(it, builtinDir.str());
+        }
+    }
+
+    return directories;
+}
+
+} // anonymous namespace
+
+vector<string> detectClangOptions(const string& temporaryDirectory) {
+    vector<string> directories;
+    if (const char* cxx = std::getenv("CXX"))
+        directories = getCompilerIncludeDirectories(cxx, temporaryDirectory);
+    if (directories.empty())
+        directories = getSystemIncludeDirectories();
+    if (directories.empty())
+        return {}; // let clang determine the options automatically
+
+    // The detection source is never written to disk.
+    llvm::SmallString<256> detectSourceFile(pathConcat(temporaryDirectory, "detect.cpp"));
+    llvm::sys::fs::make_absolute(detectSourceFile);
+    const string detectSource =
         "#include <cstdlib>\n#include <csignal>\n#include <csetjmp>\n#include <cstdarg>\n"
         "#include <typeinfo>\n#include <bitset>\n#include <functional>\n#include <utility>\n"
         "#include <ctime>\n#include <cstddef>\n#include <new>\n#include <memory>\n"
@@ -124,41 +226,23 @@ vector<string> detectClangOptions(const string& temporaryDirectory) {
         "#include <ostream>\n#include <iostream>\n#include <fstream>\n#include <sstream>\n"
         "#include <iomanip>\n#include <streambuf>\n#include <cstdio>\n"
         "int main() { return 0; }\n";
-    detectFile.close();
-
-    for (const auto& cxx: gccLikeCompilers) {
-        // TODO: escape whitespace and quotes.
-        // TODO: use correct locale somehow.
-        std::stringstream command;
-        command << cxx << " -x c++ -c -v " << emptySourceFile << " -o " << outputExeFile << " 2>" << gccLogFile;
-        std::system(command.str().c_str());
-        std::ifstream logFile(gccLogFile.c_str());
-        string line;
-        bool isSearchList = false;
-        vector<string> compilationOptions;
-        while (std::getline(logFile, line)) {
-            if (startsWith(line, "End of search list"))
-                break;
-
-            if (endsWith(line, "search starts here:"))
-                isSearchList = true;
-            else if (isSearchList) {
-                compilationOptions.push_back("-isystem");
-                compilationOptions.push_back(trim(line));
-            }
-        }
 
-        if (compilationOptions.empty())
-            continue;
+    vector<string> compilationOptions;
+    for (const string& dir : directories) {
+        compilationOptions.push_back("-isystem");
+        compilationOptions.push_back(dir);
+    }
+    compilationOptions.push_back("-nostdlibinc");
 
-        compilationOptions.push_back("-nostdlibinc");
-        compilationOptions.push_back("-nobuiltininc");
-        if (testOptions(compilationOptions, detectSourceFile))
-            return compilationOptions;
+    // Candidates in order of preference. They are validated one at a time: clang tools share
+    // process-wide state (e.g. command line options and signal handlers) and are not safe
+    // to run concurrently.
+    vector<vector<string>> candidates(2, compilationOptions);
+    candidates[0].push_back("-nobuiltininc");
 
-        compilationOptions.pop_back();
-        if (testOptions(compilationOptions, detectSourceFile))
-            return compilationOptions;
+    for (const auto& candidate : candidates) {
+        if (testOptions(candidate, string(detectSourceFile.str()), detectSource))
+            return candidate;
     }
 
     return {}; // let clang determine the options automatically
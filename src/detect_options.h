@@ -12,6 +12,8 @@
 namespace caide {
 namespace internal {
 
+// System include paths of the compiler named by CXX environment variable or, if it is not set
+// or can't be queried, of the GCC or MSVC installation found by clang driver.
 std::vector<std::string> detectClangOptions(const std::string& temporaryDirectory);
 
 }
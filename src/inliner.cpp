@@ -5,8 +5,12 @@
 // option) any later version. See LICENSE.TXT for details.
 
 #include "inliner.h"
+#include "caideInliner.hpp"
+#include "Cancellation.h"
 #include "clang_compat.h"
 #include "clang_version.h"
+#include "HeaderCosts.h"
+#include "MemoryUsage.h"
 #include "util.h"
 #include "Timer.h"
 
@@ -17,16 +21,26 @@
 #include <clang/Frontend/CompilerInstance.h>
 #include <clang/Frontend/FrontendAction.h>
 #include <clang/Frontend/FrontendActions.h>
+#include <clang/Lex/Lexer.h>
+#include <clang/Lex/MacroInfo.h>
 #include <clang/Lex/Preprocessor.h>
 #include <clang/Lex/Token.h>
 #include <clang/Tooling/CompilationDatabase.h>
 #include <clang/Tooling/Tooling.h>
 
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/VirtualFileSystem.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstdint>
 #include <iostream>
 #include <memory>
+#include <mutex>
 #include <stdexcept>
 #include <string>
 #include <sstream>
+#include <tuple>
 #include <unordered_map>
 #include <unordered_set>
 
@@ -39,9 +53,138 @@ using std::vector;
 namespace caide {
 namespace internal {
 
+// Macro definitions made by system headers included from user code, recorded in the opaque
+// system headers mode. Key: compilation options, the system headers included and the macro
+// directives made by user code before, the header itself and its version on disk (see
+// getSnapshotKey). Shared by all inliner runs in the process.
+class SystemHeaderSnapshots {
+public:
+    static SystemHeaderSnapshots& instance() {
+        static SystemHeaderSnapshots snapshots;
+        return snapshots;
+    }
+
+    bool find(const string& key, string& snapshot) const {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = snapshots.find(key);
+        if (it == snapshots.end())
+            return false;
+        snapshot = it->second;
+        return true;
+    }
+
+    void insert(const string& key, string snapshot) {
+        std::lock_guard<std::mutex> lock(mutex);
+        snapshots.emplace(key, std::move(snapshot));
+    }
+
+private:
+    mutable std::mutex mutex;
+    std::unordered_map<string, string> snapshots;
+};
+
+// State of the opaque system headers mode, shared by preprocessor callbacks and the file system.
+struct OpaqueHeadersState {
+    // Compilation options, system headers that have been included from user code so far and
+    // macro directives of user code between them: a system header may depend on macros defined
+    // by the user (NDEBUG, _GLIBCXX_DEBUG etc.)
+    string includeSetKey;
+    // Whether the preprocessor is in a user file (as opposed to a system header).
+    bool inUserFile = true;
+    // Headers are read from it unless a snapshot is used.
+    llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> realFileSystem;
+};
+
+// Key of the snapshot of a system header included at this point. A snapshot of a header
+// that has changed on disk since is not used. Empty if the header can't be found.
+static string getSnapshotKey(const OpaqueHeadersState& state, const llvm::Twine& path) {
+    llvm::ErrorOr<llvm::vfs::Status> status = state.realFileSystem->status(path);
+    if (!status)
+        return string();
+    std::ostringstream key;
+    key << state.includeSetKey << '\n' << path.str() << '\n' << status->getSize() << ' '
+        << status->getLastModificationTime().time_since_epoch().count() << ' '
+        << status->getUniqueID().getDevice() << ' ' << status->getUniqueID().getFile();
+    return key.str();
+}
+
 struct InlinerState {
     string result;
     std::unordered_set<string>& inlinedPathsFromCommandLine;
+    // Null unless system headers are opaque.
+    OpaqueHeadersState* opaqueHeaders;
+    const Cancellation& cancellation;
+    Stats& stats;
+};
+
+// Contents of a system header replaced with a snapshot of its macro definitions.
+class SnapshotFile: public llvm::vfs::File {
+public:
+    SnapshotFile(llvm::vfs::Status status_, string contents_)
+        : fileStatus(std::move(status_))
+        , contents(std::move(contents_))
+    {}
+
+    llvm::ErrorOr<llvm::vfs::Status> status() override {
+        return fileStatus;
+    }
+
+    llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> getBuffer(const llvm::Twine& name,
+            int64_t /*FileSize*/, bool /*RequiresNullTerminator*/, bool /*IsVolatile*/) override
+    {
+        return llvm::MemoryBuffer::getMemBufferCopy(contents, name);
+    }
+
+    std::error_code close() override {
+        return std::error_code();
+    }
+
+private:
+    llvm::vfs::Status fileStatus;
+    string contents;
+};
+
+// Serves recorded snapshots instead of system headers included from user code. Other files,
+// including headers without a snapshot, are read from the underlying file system.
+class OpaqueSystemHeadersFileSystem: public llvm::vfs::ProxyFileSystem {
+public:
+    OpaqueSystemHeadersFileSystem(llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> fs,
+            const OpaqueHeadersState& state_)
+        : ProxyFileSystem(std::move(fs))
+        , state(state_)
+    {}
+
+    llvm::ErrorOr<llvm::vfs::Status> status(const llvm::Twine& path) override {
+        llvm::ErrorOr<llvm::vfs::Status> realStatus = ProxyFileSystem::status(path);
+        string snapshot;
+        if (!realStatus || !findSnapshot(path, snapshot))
+            return realStatus;
+        // File size must match the contents, or the file will be reported as modified.
+        return llvm::vfs::Status::copyWithNewSize(*realStatus, snapshot.size());
+    }
+
+    llvm::ErrorOr<std::unique_ptr<llvm::vfs::File>> openFileForRead(const llvm::Twine& path) override {
+        string snapshot;
+        if (!findSnapshot(path, snapshot))
+            return ProxyFileSystem::openFileForRead(path);
+        llvm::ErrorOr<llvm::vfs::Status> realStatus = ProxyFileSystem::status(path);
+        if (!realStatus)
+            return realStatus.getError();
+        llvm::vfs::Status snapshotStatus =
+            llvm::vfs::Status::copyWithNewSize(*realStatus, snapshot.size());
+        return std::unique_ptr<llvm::vfs::File>(
+            new SnapshotFile(std::move(snapshotStatus), std::move(snapshot)));
+    }
+
+private:
+    bool findSnapshot(const llvm::Twine& path, string& snapshot) const {
+        if (!state.inUserFile)
+            return false;
+        const string key = getSnapshotKey(state, path);
+        return !key.empty() && SystemHeaderSnapshots::instance().find(key, snapshot);
+    }
+
+    const OpaqueHeadersState& state;
 };
 
 struct IncludeReplacement {
@@ -52,8 +195,9 @@ struct IncludeReplacement {
 
 class TrackMacro: public PPCallbacks {
 public:
-    TrackMacro(SourceManager& srcManager_, InlinerState& state_)
+    TrackMacro(SourceManager& srcManager_, const LangOptions& langOptions_, InlinerState& state_)
         : srcManager(srcManager_)
+        , langOptions(langOptions_)
         , state(state_)
     {
         // Setup a placeholder where the result for the whole CPP file will be stored
@@ -137,6 +281,10 @@ public:
                              FileID PrevFID) override
     {
         dbg(CAIDE_FUNC << Loc.printToString(srcManager) << "\n");
+        state.cancellation.stopCompilationIfRequested(srcManager.getDiagnostics());
+        if (state.opaqueHeaders)
+            recordSnapshots(Loc, Reason, FileType);
+
         const FileEntry* curEntry = srcManager.getFileEntryForID(PrevFID);
         if (Reason == PPCallbacks::EnterFile) {
             const FileEntry* file = srcManager.getFileEntryForID(srcManager.getFileID(Loc));
@@ -181,6 +329,7 @@ public:
         replacementStack[0].replaceWith = calcReplacements(0, srcManager.getMainFileID());
         replacementStack.resize(1);
         state.result = replacementStack[0].replaceWith;
+        recordMemory();
     }
 
 #if CAIDE_CLANG_VERSION_AT_LEAST(10, 0)
@@ -205,10 +354,44 @@ public:
         }
     }
 
+    virtual void MacroDefined(const Token& MacroNameTok, const MacroDirective* MD) override {
+        string* macros = getMacroDirectivesOutput(MacroNameTok);
+        if (!macros || !MD)
+            return;
+        const MacroInfo* info = MD->getMacroInfo();
+        if (!info)
+            return;
+        const char* b;
+        const char* e;
+        std::tie(b, e) = getCharRange(
+            SourceRange(info->getDefinitionLoc(), info->getDefinitionEndLoc()), srcManager, langOptions);
+        if (!b || !e)
+            return;
+        *macros += "#define ";
+        macros->append(b, e);
+        *macros += "\n";
+    }
+
+#if CAIDE_CLANG_VERSION_AT_LEAST(5,0)
+    virtual void MacroUndefined(const Token& MacroNameTok, const MacroDefinition& /*MD*/,
+                                const MacroDirective* /*Undef*/) override
+#else
+    virtual void MacroUndefined(const Token& MacroNameTok, const MacroDefinition& /*MD*/) override
+#endif
+    {
+        string* macros = getMacroDirectivesOutput(MacroNameTok);
+        if (!macros || !MacroNameTok.getIdentifierInfo())
+            return;
+        *macros += "#undef ";
+        *macros += MacroNameTok.getIdentifierInfo()->getName().str();
+        *macros += "\n";
+    }
+
     virtual ~TrackMacro() override = default;
 
 private:
     SourceManager& srcManager;
+    const LangOptions& langOptions;
 
     InlinerState& state;
 
@@ -227,6 +410,74 @@ private:
      */
     vector<IncludeReplacement> replacementStack;
 
+    // Opaque system headers mode: nesting depth inside the system header included from user code
+    // whose macro definitions are being recorded (0 if none).
+    int recordingDepth = 0;
+    string recordedHeader;
+    string recordedKey;
+    string recordedMacros;
+
+    // Memory snapshot at the end of the main file. Replacements of all included files have
+    // been merged into the result by now, so the result dominates caide memory.
+    void recordMemory() const {
+        PhaseStats& phase = state.stats.inliner;
+        phase.sourceManagerBytes = std::max(phase.sourceManagerBytes,
+            getSourceManagerMemory(srcManager));
+        std::uint64_t caideBytes = state.result.capacity() + recordedMacros.capacity()
+            + getHashContainerMemory<const FileEntry*>(includedHeaders.size(),
+                includedHeaders.bucket_count())
+            + getHashContainerMemory<std::pair<const FileEntry* const, string>>(
+                pendingInlinedPathsFromCommandLine.size(),
+                pendingInlinedPathsFromCommandLine.bucket_count());
+        for (const IncludeReplacement& replacement : replacementStack)
+            caideBytes += sizeof(replacement) + replacement.replaceWith.capacity();
+        phase.caideBytes = std::max(phase.caideBytes, caideBytes);
+    }
+
+    // Opaque system headers mode: macro directives of a recorded system header go to its snapshot,
+    // and macro directives of user code go to the key of subsequent snapshots. Predefined macros
+    // are covered by compilation options in the key.
+    string* getMacroDirectivesOutput(const Token& MacroNameTok) {
+        if (recordingDepth > 0)
+            return &recordedMacros;
+        OpaqueHeadersState* opaque = state.opaqueHeaders;
+        if (!opaque || !opaque->inUserFile
+                || isWrittenInBuiltinFile(srcManager, MacroNameTok.getLocation()))
+            return nullptr;
+        opaque->includeSetKey += '\n';
+        return &opaque->includeSetKey;
+    }
+
+    // A system header included from user code is replaced with a snapshot of macro definitions
+    // it makes when included after the same system headers, if such a snapshot has been recorded
+    // before. Otherwise the header is processed as usual and its snapshot is recorded.
+    void recordSnapshots(SourceLocation Loc, FileChangeReason Reason,
+                         SrcMgr::CharacteristicKind FileType)
+    {
+        OpaqueHeadersState& opaque = *state.opaqueHeaders;
+        if (Reason == PPCallbacks::EnterFile) {
+            if (recordingDepth > 0) {
+                ++recordingDepth;
+            } else if (SrcMgr::isSystem(FileType) && opaque.inUserFile) {
+                recordingDepth = 1;
+                recordedHeader = srcManager.getFilename(Loc).str();
+                recordedKey = getSnapshotKey(opaque, recordedHeader);
+                recordedMacros.clear();
+            }
+            opaque.inUserFile = !SrcMgr::isSystem(FileType);
+        } else if (Reason == PPCallbacks::ExitFile) {
+            opaque.inUserFile = isUserFile(Loc);
+            if (recordingDepth > 0 && --recordingDepth == 0) {
+                // The header may have been cut short by a fatal error.
+                if (!recordedKey.empty() && !srcManager.getDiagnostics().hasErrorOccurred())
+                    SystemHeaderSnapshots::instance().insert(recordedKey, std::move(recordedMacros));
+                opaque.includeSetKey += '\n';
+                opaque.includeSetKey += recordedHeader;
+                recordedMacros.clear();
+            }
+        }
+    }
+
     /*
      * Unwinds inclusion stack and calculates the result of inclusion of current file
      */
@@ -350,7 +601,12 @@ public:
 #endif
     {
         compiler.getPreprocessor().addPPCallbacks(std::unique_ptr<TrackMacro>(new TrackMacro(
-                compiler.getSourceManager(), state)));
+                compiler.getSourceManager(), compiler.getLangOpts(), state)));
+        if (HeaderCosts* headerCosts = HeaderCosts::current()) {
+            compiler.getPreprocessor().addPPCallbacks(std::unique_ptr<HeaderCostTracker>(
+                new HeaderCostTracker(*headerCosts, compiler.getSourceManager(),
+                    &HeaderStats::preprocessingTime)));
+        }
         return true;
     }
 };
@@ -374,26 +630,44 @@ public:
 #endif
 };
 
-Inliner::Inliner(const vector<string>& cmdLineOptions_)
+Inliner::Inliner(const vector<string>& cmdLineOptions_, Stats& stats_, bool opaqueSystemHeaders_,
+                 const Cancellation& cancellation_)
     : cmdLineOptions(cmdLineOptions_)
+    , stats(stats_)
+    , opaqueSystemHeaders(opaqueSystemHeaders_)
+    , cancellation(cancellation_)
 {}
 
 string Inliner::doInline(const string& cppFile) {
-    ScopedTimer t("Inliner::doInline");
+    ScopedTimer t("Inliner::doInline", &stats.inliner);
     std::unique_ptr<clang::tooling::FixedCompilationDatabase> compilationDatabase(
         createCompilationDatabaseFromCommandLine(cmdLineOptions));
 
     vector<string> sources(1);
     sources[0] = cppFile;
 
-    InlinerState state{"", inlinedPathsFromCommandLine};
+    OpaqueHeadersState opaqueHeaders;
+    opaqueHeaders.realFileSystem = llvm::vfs::getRealFileSystem();
+    for (const string& option : cmdLineOptions) {
+        opaqueHeaders.includeSetKey += option;
+        opaqueHeaders.includeSetKey += ' ';
+    }
+
+    InlinerState state{"", inlinedPathsFromCommandLine,
+        opaqueSystemHeaders ? &opaqueHeaders : nullptr, cancellation, stats};
     InlinerFrontendActionFactory factory(state);
 
-    clang::tooling::ClangTool tool(*compilationDatabase, sources);
+    llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> fileSystem = opaqueHeaders.realFileSystem;
+    if (opaqueSystemHeaders)
+        fileSystem = new OpaqueSystemHeadersFileSystem(fileSystem, opaqueHeaders);
+
+    clang::tooling::ClangTool tool(*compilationDatabase, sources,
+        std::make_shared<PCHContainerOperations>(), fileSystem);
 
     ScopedTimer t2("Inliner::tool.run");
     int ret = tool.run(&factory);
 
+    cancellation.check();
     if (ret != 0)
         throw std::runtime_error("Compilation error");
 
@@ -401,6 +675,105 @@ string Inliner::doInline(const string& cppFile) {
     return state.result;
 }
 
+template<std::size_t N>
+static bool hasPrefix(const string& option, const char* const (&prefixes)[N]) {
+    for (const char* prefix : prefixes) {
+        if (option.rfind(prefix, 0) == 0)
+            return true;
+    }
+    return false;
+}
+
+// Whether the options can't add user headers or include paths. Only known options are
+// accepted: there are too many spellings of the others (-I, --include-directory=, -include,
+// -Wp,-I, -Xclang etc.)
+static bool onlySystemIncludePaths(const vector<string>& cmdLineOptions) {
+    static const char* const safePrefixes[] = {"-std=", "-D", "-U", "-W", "-w", "-O", "-f", "-m",
+        "-g", "-pedantic", "-v", "-x", "-isystem", "-cxx-isystem", "-isysroot", "--sysroot",
+        "-nostdinc", "-nostdlibinc", "-nobuiltininc", "-stdlib=", "-resource-dir",
+        "--gcc-toolchain=", "-gcc-toolchain", "-target", "--target="};
+    static const char* const unsafePrefixes[] = {"-Wp,", "-fmodule", "-fimplicit-module",
+        "-fcxx-modules", "-fprebuilt-"};
+    // Options whose value may be given as the next argument.
+    static const char* const optionsWithValue[] = {"-D", "-U", "-x", "-isystem", "-cxx-isystem",
+        "-isysroot", "--sysroot", "-resource-dir", "-gcc-toolchain", "-target"};
+
+    for (std::size_t i = 0; i < cmdLineOptions.size(); ++i) {
+        const string& option = cmdLineOptions[i];
+        if (!hasPrefix(option, safePrefixes) || hasPrefix(option, unsafePrefixes))
+            return false;
+        for (const char* optionWithValue : optionsWithValue) {
+            if (option == optionWithValue) {
+                ++i;
+                break;
+            }
+        }
+    }
+
+    // Directories from these variables are searched as if given by -I or -isystem.
+    static const char* const includePathVariables[] = {"CPATH", "C_INCLUDE_PATH",
+        "CPLUS_INCLUDE_PATH", "OBJC_INCLUDE_PATH", "OBJCPLUS_INCLUDE_PATH"};
+    for (const char* variable : includePathVariables) {
+        const char* value = std::getenv(variable);
+        if (value && *value)
+            return false;
+    }
+
+    return true;
+}
+
+bool needsInlining(const string& fileContents, const vector<string>& cmdLineOptions) {
+    if (!onlySystemIncludePaths(cmdLineOptions))
+        return true;
+
+    LangOptions langOptions;
+    langOptions.CPlusPlus = langOptions.CPlusPlus11 = 1;
+    const char* begin = fileContents.c_str();
+    Lexer lexer(SourceLocation(), langOptions, begin, begin, begin + fileContents.size());
+
+    std::unordered_set<string> systemHeaders;
+    Token token;
+    lexer.LexFromRawLexer(token);
+    while (token.isNot(tok::eof)) {
+        if (token.is(tok::raw_identifier)) {
+            StringRef name = token.getRawIdentifier();
+            if (name == "__has_include" || name == "__has_include_next")
+                return true;
+        }
+
+        if (!token.is(tok::hash) || !token.isAtStartOfLine()) {
+            lexer.LexFromRawLexer(token);
+            continue;
+        }
+
+        // A null directive ('#' alone on its line) is followed by the first token of the next line.
+        lexer.LexFromRawLexer(token);
+        if (token.isAtStartOfLine() || !token.is(tok::raw_identifier))
+            continue;
+
+        StringRef directive = token.getRawIdentifier();
+        lexer.LexFromRawLexer(token);
+        if (directive == "include") {
+            if (token.isAtStartOfLine() || !token.is(tok::less))
+                return true;
+            const char* headerBegin = lexer.getBufferLocation();
+            const char* headerEnd = headerBegin;
+            while (headerEnd != begin + fileContents.size() && *headerEnd != '>' && *headerEnd != '\n')
+                ++headerEnd;
+            if (!systemHeaders.emplace(headerBegin, headerEnd).second)
+                return true;
+        } else if (directive == "import" || directive == "include_next" || directive == "line") {
+            return true;
+        } else if (directive == "pragma") {
+            if (!token.isAtStartOfLine() && token.is(tok::raw_identifier)
+                    && token.getRawIdentifier() == "once")
+                return true;
+        }
+    }
+
+    return false;
+}
+
 vector<string> Inliner::getResultingCommandLineOptions() const {
     vector<string> res;
     for (std::size_t i = 0; i < cmdLineOptions.size();) {
@@ -6,17 +6,36 @@
 
 #pragma once
 
+#include "Cancellation.h"
+
 #include <vector>
 #include <string>
 #include <unordered_set>
 
 namespace caide {
+
+struct Stats;
+
 namespace internal {
 
+// Cheap check, based on a raw lexer scan, whether the first stage would leave the file as is,
+// so that it can be handed to the optimizer directly. False negatives are not allowed: the
+// function returns true if the file contains quoted, computed or repeated include directives,
+// or directives that the first stage removes, or unless all options (and include path
+// environment variables) are known to add only system include paths.
+bool needsInlining(const std::string& fileContents, const std::vector<std::string>& cmdLineOptions);
+
 // First inliner stage: inline included headers
 class Inliner {
 public:
-    explicit Inliner(const std::vector<std::string>& clangCommandLineOptions);
+    // If opaqueSystemHeaders is true, a system header included from user code is not preprocessed
+    // again when it has already been seen (in this process) after the same system headers with the
+    // same options: the macro definitions it made last time are substituted instead.
+    // Phase times of doInline calls are added to stats.
+    Inliner(const std::vector<std::string>& clangCommandLineOptions,
+            Stats& stats,
+            bool opaqueSystemHeaders = false,
+            const Cancellation& cancellation = Cancellation());
 
     // The file is read in binary mode, so the returned string is also
     // 'in binary mode' (contains \r\n on Windows)
@@ -30,6 +49,9 @@ public:
 
 private:
     std::vector<std::string> cmdLineOptions;
+    Stats& stats;
+    bool opaqueSystemHeaders;
+    Cancellation cancellation;
     std::unordered_set<std::string> includedHeaders;
     std::vector<std::string> inlineResults;
     std::unordered_set<std::string> inlinedPathsFromCommandLine;
@@ -5,8 +5,13 @@
 // option) any later version. See LICENSE.TXT for details.
 
 #include "optimizer.h"
+#include "caideInliner.hpp"
 #include "DependenciesCollector.h"
-#include "MergeNamespacesVisitor.h"
+#include "DependencySummaryCache.h"
+#include "HeaderCosts.h"
+#include "IncludeMinimizer.h"
+#include "MainFileIndex.h"
+#include "MemoryUsage.h"
 #include "OptimizerVisitor.h"
 #include "RemoveInactivePreprocessorBlocks.h"
 #include "SmartRewriter.h"
@@ -21,21 +26,27 @@
 
 #include <clang/AST/ASTConsumer.h>
 #include <clang/AST/ASTContext.h>
+#include <clang/AST/DeclCXX.h>
 #include <clang/Basic/SourceManager.h>
 #include <clang/Frontend/CompilerInstance.h>
 #include <clang/Frontend/FrontendAction.h>
+#include <clang/Frontend/FrontendActions.h>
 #include <clang/Lex/Preprocessor.h>
 #include <clang/Sema/Sema.h>
 #include <clang/Tooling/CompilationDatabase.h>
 #include <clang/Tooling/Tooling.h>
 
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/Support/FileSystem.h>
 
+#include <algorithm>
+#include <cstdint>
 #include <fstream>
 #include <memory>
 #include <set>
 #include <stdexcept>
 #include <string>
-#include <unordered_set>
 #include <vector>
 
 
@@ -48,6 +59,12 @@ using std::vector;
 namespace caide {
 namespace internal {
 
+// Heap footprint of the dependency graph, in bytes.
+static std::uint64_t getMemorySize(const SourceInfo& srcInfo) {
+    return srcInfo.uses.getMemorySize() + srcInfo.usedSystemDecls.getMemorySize()
+        + srcInfo.unparsedBodyEnds.getMemorySize();
+}
+
 // The 'optimizer' stage acts on a single source file without dependencies (except for system headers).
 // It removes code unreachable from main function.
 //
@@ -82,65 +99,130 @@ namespace internal {
 
 
 
-class BuildNonImplicitDeclMap: public clang::RecursiveASTVisitor<BuildNonImplicitDeclMap> {
-public:
-    BuildNonImplicitDeclMap(SourceInfo& srcInfo_)
-        : srcInfo(srcInfo_)
-        , t("BuildNonImplicitDeclMap::VisitDecl")
-    {
-        t.pause();
+// Tokens of a delayed-parsed function, cached by the parser, end with the closing brace of
+// the body (or of the last handler of a function-try-block).
+static SourceLocation findEndOfCachedBody(const CachedTokens& toks) {
+    for (auto it = toks.rbegin(); it != toks.rend(); ++it) {
+        if (it->is(tok::r_brace))
+            return it->getLocation();
+        if (!it->is(tok::eof))
+            break;
     }
+    return SourceLocation();
+}
 
-    bool shouldVisitImplicitCode() const { return false; }
-    bool shouldVisitTemplateInstantiations() const { return false; }
-    bool shouldWalkTypesOfTypeLocs() const { return false; }
-
-    bool VisitDecl(clang::Decl* decl) {
-        t.resume();
-        auto key = SourceInfo::makeKey(decl);
-        srcInfo.nonImplicitDecls.emplace(std::move(key), decl);
-        t.pause();
-        return true;
-    }
+// Parsed form of OptimizerRoots.
+struct RootSet {
+    bool keepMain;
+    IdentifierMatcher identifiersToKeep;
+};
 
-private:
-    SourceInfo& srcInfo;
-    ScopedTimer t;
+struct OptimizerResult {
+    string code;
+    // Empty unless includes have been minimized: the same code including all system headers.
+    string codeWithAllIncludes;
 };
 
 class OptimizerConsumer: public ASTConsumer {
 public:
     OptimizerConsumer(CompilerInstance& compiler_,
             std::unique_ptr<SmartRewriter> smartRewriter_,
+            std::unique_ptr<MainFileIndex> mainFileIndex_,
             RemoveInactivePreprocessorBlocks& ppCallbacks_,
-            const std::unordered_set<string>& identifiersToKeep_,
-            string& result_)
+            const IncludeMinimizer* includeMinimizer_,
+            HeaderCostTracker* headerCosts_,
+            const IdentifierMatcher& identifiersToKeep_,
+            const vector<RootSet>& rootSets_,
+            const vector<string>& cmdLineOptions_,
+            const string& dependencySummaryCache_,
+            Stats& stats_,
+            const Cancellation& cancellation_,
+            vector<OptimizerResult>& results_)
         : compiler(compiler_)
         , sourceManager(compiler.getSourceManager())
         , smartRewriter(std::move(smartRewriter_))
+        , mainFileIndex(std::move(mainFileIndex_))
         , ppCallbacks(ppCallbacks_)
+        , includeMinimizer(includeMinimizer_)
+        , headerCosts(headerCosts_)
         , identifiersToKeep(identifiersToKeep_)
-        , result(result_)
+        , rootSets(rootSets_)
+        , cmdLineOptions(cmdLineOptions_)
+        , dependencySummaryCache(dependencySummaryCache_)
+        , stats(stats_)
+        , cancellation(cancellation_)
+        , results(results_)
     {
     }
 
-    virtual void HandleTranslationUnit(ASTContext& Ctx) override {
-        // 0. Collect auxiliary information.
-        {
-            ScopedTimer t("BuildNonImplicitDeclMap");
-            BuildNonImplicitDeclMap visitor(srcInfo);
-            visitor.TraverseDecl(Ctx.getTranslationUnitDecl());
+    // Parsing is aborted if false is returned.
+    virtual bool HandleTopLevelDecl(DeclGroupRef D) override {
+        reportMemoryUsage();
+        if (headerCosts) {
+            for (Decl* decl : D)
+                headerCosts->addDecl(decl);
+        }
+        return !cancellation.stopCompilationIfRequested(compiler.getDiagnostics());
+    }
+
+    virtual void HandleCXXImplicitFunctionInstantiation(FunctionDecl* D) override {
+        reportMemoryUsage();
+        if (headerCosts)
+            headerCosts->addInstantiation(D->getTemplateInstantiationPattern());
+        cancellation.stopCompilationIfRequested(compiler.getDiagnostics());
+    }
+
+    // Called, in particular, for instantiated class templates.
+    virtual void HandleTagDeclDefinition(TagDecl* D) override {
+        if (!headerCosts)
+            return;
+        if (const auto* record = dyn_cast<CXXRecordDecl>(D)) {
+            if (isTemplateInstantiation(record->getTemplateSpecializationKind()))
+                headerCosts->addInstantiation(record->getTemplateInstantiationPattern());
         }
+    }
 
-        // 1. Build dependency graph for semantic declarations.
+    // If cancellation is requested, returns early without results.
+    virtual void HandleTranslationUnit(ASTContext& Ctx) override {
+        reportMemoryUsage(/*force=*/true);
+        if (cancellation.isRequested())
+            return;
+
+        TranslationUnitDecl* tu = Ctx.getTranslationUnitDecl();
+
+        // 1. Build dependency graph for semantic declarations, starting from the roots.
+        // 2. Find semantic declarations that are reachable from main function in the graph.
+        //
+        // With several root sets, the graph is expanded from all of them, and used is their
+        // union. Reachability for each root set is computed later in the resulting graph.
+        DeclSet used;
+        vector<llvm::SmallPtrSet<Decl*, 16>> roots(rootSets.size());
         {
-            ScopedTimer t("DependenciesCollector");
+            ScopedTimer t("DependenciesCollector", &stats.dependencyGraph);
             clang::Sema& sema = compiler.getSema();
-            DependenciesCollector depsVisitor(sourceManager, sema, identifiersToKeep, srcInfo);
-            depsVisitor.TraverseDecl(Ctx.getTranslationUnitDecl());
+            // Summaries can't be replayed if function bodies are parsed after the graph is built.
+            std::unique_ptr<DependencySummaryCache> summaryCache;
+            if (!dependencySummaryCache.empty() && !compiler.getLangOpts().DelayedTemplateParsing) {
+                summaryCache.reset(new DependencySummaryCache(dependencySummaryCache, cmdLineOptions,
+                    sourceManager, Ctx, stats));
+            }
+            DependenciesCollector depsVisitor(sourceManager, sema, srcInfo, used, stats,
+                cancellation, summaryCache.get());
+            depsVisitor.collectRoots(tu);
+            for (size_t i = 0; i < rootSets.size(); ++i) {
+                roots[i].insert(srcInfo.declsToKeep.begin(), srcInfo.declsToKeep.end());
+                if (rootSets[i].keepMain)
+                    roots[i].insert(srcInfo.mainFunctions.begin(), srcInfo.mainFunctions.end());
+                identifiersToKeep.findDecls(tu, roots[i]);
+                rootSets[i].identifiersToKeep.findDecls(tu, roots[i]);
+                depsVisitor.expandReachable(roots[i]);
+            }
+            if (summaryCache && !cancellation.isRequested())
+                summaryCache->save();
 
             // Source range of delayed-parsed template functions includes only declaration part.
-            //     Force their parsing to get correct source ranges.
+            //     For unused functions, find the end of the body in the cached tokens.
+            //     Force parsing of the remaining functions to get correct source ranges.
             //     Suppress error messages temporarily (it's OK for these functions
             //     to be malformed).
             DiagnosticsEngine& diag = sema.getDiagnostics();
@@ -148,9 +230,22 @@ public:
             diag.setSuppressAllDiagnostics(true);
             for (FunctionDecl* f : srcInfo.delayedParsedFunctions) {
                 auto& /*ptr to clang::LateParsedTemplate*/ lpt = sema.LateParsedTemplateMap[f];
+                if (!lpt)
+                    continue;
+                if (used.count(f->getCanonicalDecl()) == 0) {
+                    SourceLocation bodyEnd = findEndOfCachedBody(lpt->Toks);
+                    if (bodyEnd.isValid()) {
+                        srcInfo.unparsedBodyEnds[f] = bodyEnd;
+                        continue;
+                    }
+                }
                 sema.LateTemplateParser(sema.OpaqueParser, *lpt);
+                ++stats.delayedFunctionsParsed;
             }
             diag.setSuppressAllDiagnostics(suppressAll);
+            stats.graphNodes = srcInfo.uses.size();
+            recordMemory(stats.dependencyGraph,
+                depsVisitor.getMemorySize() + getMemorySize(srcInfo) + used.getMemorySize());
 
 #ifdef CAIDE_DEBUG_MODE
             std::ofstream file("caide-graph.dot");
@@ -158,54 +253,74 @@ public:
 #endif
         }
 
-        // 2. Find semantic declarations that are reachable from main function in the graph.
-        std::unordered_set<Decl*> used;
-        {
-            ScopedTimer t("BFS");
-            set<Decl*> queue;
-            for (Decl* decl : srcInfo.declsToKeep)
-                queue.insert(decl->getCanonicalDecl());
-
-            while (!queue.empty()) {
-                Decl* decl = *queue.begin();
-                queue.erase(queue.begin());
-                if (used.insert(decl).second)
-                    queue.insert(srcInfo.uses[decl].begin(), srcInfo.uses[decl].end());
-            }
-        }
+        if (cancellation.isRequested())
+            return;
 
-        // 3. Remove unnecessary lexical declarations.
-        std::unordered_set<Decl*> removedDecls;
-        {
-            ScopedTimer t("OptimizerVisitor");
-            OptimizerVisitor visitor(sourceManager, used, removedDecls, *smartRewriter);
-            visitor.TraverseDecl(Ctx.getTranslationUnitDecl());
-            visitor.Finalize(Ctx);
-        }
-        {
-            ScopedTimer t("MergeNamespacesVisitor");
-            MergeNamespacesVisitor visitor(sourceManager, removedDecls, *smartRewriter);
-            visitor.TraverseDecl(Ctx.getTranslationUnitDecl());
-        }
+        // The rewriter contains changes made during preprocessing; each root set gets its own
+        // copy of them (the last one takes the original).
+        results.clear();
+        for (size_t i = 0; i < rootSets.size(); ++i) {
+            std::unique_ptr<SmartRewriter> rewriter =
+                i + 1 < rootSets.size() ? smartRewriter->fork() : std::move(smartRewriter);
 
-        // 4. Remove inactive preprocessor branches that have not yet been removed.
-        // 5. Remove preprocessor definitions, all usages of which are inside removed code.
-        //
-        // Callbacks have been called implicitly before this method, so we only need to call
-        // Finalize() method that will actually use the information collected by callbacks
-        // to remove unused preprocessor code
-        ScopedTimer t("Finalize+Rewrite");
-        ppCallbacks.Finalize();
+            DeclSet reachable;
+            if (rootSets.size() > 1) {
+                ScopedTimer t("DependenciesCollector::findReachable", &stats.reachability);
+                DependenciesCollector::findReachable(srcInfo, roots[i], reachable);
+            }
+            const DeclSet& usedByRootSet = rootSets.size() > 1 ? reachable : used;
+
+            // 3. Remove unnecessary lexical declarations.
+            DeclSet removedDecls;
+            {
+                ScopedTimer t("OptimizerVisitor", &stats.codeRemoval);
+                OptimizerVisitor visitor(sourceManager, srcInfo, usedByRootSet, removedDecls,
+                    *rewriter, *mainFileIndex, stats, cancellation);
+                visitor.TraverseDecl(tu);
+                if (cancellation.isRequested())
+                    return;
+                visitor.Finalize(Ctx);
+                recordMemory(stats.codeRemoval, getMemorySize(srcInfo)
+                    + removedDecls.getMemorySize() + rewriter->getMemorySize());
+            }
 
-        smartRewriter->applyChanges();
+            // 4. Remove inactive preprocessor branches that have not yet been removed.
+            // 5. Remove preprocessor definitions, all usages of which are inside removed code.
+            //
+            // Callbacks have been called implicitly before this method, so we only need to call
+            // Finalize() method that will actually use the information collected by callbacks
+            // to remove unused preprocessor code
+            ScopedTimer t("Finalize+Rewrite", &stats.rewrite);
+            ppCallbacks.Finalize(*rewriter);
+
+            // System headers go to the beginning of the output.
+            string includes;
+            for (const HoistedInclude& include : ppCallbacks.getHoistedIncludes())
+                includes += include.directive;
+            string selectedIncludes = includeMinimizer
+                ? includeMinimizer->selectIncludes(ppCallbacks.getHoistedIncludes(), srcInfo,
+                    usedByRootSet, *rewriter)
+                : includes;
+            rewriter->appendToPreamble(selectedIncludes);
+
+            rewriter->applyChanges();
+            recordMemory(stats.rewrite, rewriter->getMemorySize() + ppCallbacks.getMemorySize());
+
+            OptimizerResult result;
+            result.code = getResult(*rewriter);
+            // The preamble is inserted at the beginning of the main file.
+            if (selectedIncludes != includes)
+                result.codeWithAllIncludes = includes + result.code.substr(selectedIncludes.size());
+            results.push_back(std::move(result));
+        }
 
-        result = getResult();
+        recordMemory(stats.optimizer, getMemorySize(srcInfo) + ppCallbacks.getMemorySize());
     }
 
 private:
-    string getResult() const {
+    string getResult(const SmartRewriter& rewriter) const {
         string rewriteBuf;
-        if (smartRewriter->getRewriteBufferFor(sourceManager.getMainFileID(), rewriteBuf))
+        if (rewriter.getRewriteBufferFor(sourceManager.getMainFileID(), rewriteBuf))
             return rewriteBuf;
 
         // No changes
@@ -223,28 +338,74 @@ private:
 #endif
     }
 
+    // AST memory is the bulk of what the optimizer allocates. Computing it walks allocator
+    // slabs, so it is done only once in a while.
+    void reportMemoryUsage(bool force = false) {
+        if (!cancellation.hasMemoryBudget() || (!force && callsUntilMemoryCheck-- != 0))
+            return;
+        callsUntilMemoryCheck = 64;
+        const ASTContext& ctx = compiler.getASTContext();
+        cancellation.reportMemoryUsage(ctx.getASTAllocatedMemory() + ctx.getSideTableAllocatedMemory());
+    }
+
+    // Memory snapshot at the end of a phase; the maximum is kept if the phase is repeated.
+    void recordMemory(PhaseStats& phase, std::uint64_t caideBytes) const {
+        const ASTContext& ctx = compiler.getASTContext();
+        phase.astBytes = std::max<std::uint64_t>(phase.astBytes,
+            ctx.getASTAllocatedMemory() + ctx.getSideTableAllocatedMemory());
+        phase.sourceManagerBytes = std::max(phase.sourceManagerBytes,
+            getSourceManagerMemory(sourceManager));
+        phase.caideBytes = std::max(phase.caideBytes, caideBytes);
+    }
+
 private:
     CompilerInstance& compiler;
     SourceManager& sourceManager;
     std::unique_ptr<SmartRewriter> smartRewriter;
+    std::unique_ptr<MainFileIndex> mainFileIndex;
     RemoveInactivePreprocessorBlocks& ppCallbacks;
-    const std::unordered_set<string>& identifiersToKeep;
-    string& result;
+    const IncludeMinimizer* includeMinimizer;
+    // Null unless header costs are collected.
+    HeaderCostTracker* headerCosts;
+    const IdentifierMatcher& identifiersToKeep;
+    const vector<RootSet>& rootSets;
+    const vector<string>& cmdLineOptions;
+    // Empty unless dependency summaries are cached.
+    const string& dependencySummaryCache;
+    Stats& stats;
+    const Cancellation& cancellation;
+    vector<OptimizerResult>& results;
     SourceInfo srcInfo;
+    // Zero, so that a budget smaller than an empty AST is exceeded at the first declaration.
+    unsigned callsUntilMemoryCheck = 0;
 };
 
 
 class OptimizerFrontendAction : public ASTFrontendAction {
 private:
-    string& result;
+    vector<OptimizerResult>& results;
     const set<string>& macrosToKeep;
-    const std::unordered_set<string>& identifiersToKeep;
+    const IdentifierMatcher& identifiersToKeep;
+    const vector<RootSet>& rootSets;
+    bool minimizeIncludes;
+    const vector<string>& cmdLineOptions;
+    const string& dependencySummaryCache;
+    Stats& stats;
+    const Cancellation& cancellation;
 public:
-    OptimizerFrontendAction(string& result_, const std::set<string>& macrosToKeep_,
-            const std::unordered_set<string>& identifiersToKeep_)
-        : result(result_)
+    OptimizerFrontendAction(vector<OptimizerResult>& results_, const std::set<string>& macrosToKeep_,
+            const IdentifierMatcher& identifiersToKeep_, const vector<RootSet>& rootSets_,
+            bool minimizeIncludes_, const vector<string>& cmdLineOptions_,
+            const string& dependencySummaryCache_, Stats& stats_, const Cancellation& cancellation_)
+        : results(results_)
         , macrosToKeep(macrosToKeep_)
         , identifiersToKeep(identifiersToKeep_)
+        , rootSets(rootSets_)
+        , minimizeIncludes(minimizeIncludes_)
+        , cmdLineOptions(cmdLineOptions_)
+        , dependencySummaryCache(dependencySummaryCache_)
+        , stats(stats_)
+        , cancellation(cancellation_)
     {}
 
     virtual std::unique_ptr<ASTConsumer> CreateASTConsumer(CompilerInstance& compiler, StringRef /*file*/) override
@@ -252,36 +413,70 @@ public:
         if (!compiler.hasSourceManager())
             throw "No source manager";
         auto smartRewriter = std::unique_ptr<SmartRewriter>(
-            new SmartRewriter(compiler.getSourceManager(), compiler.getLangOpts()));
+            new SmartRewriter(compiler.getSourceManager(), compiler.getLangOpts(), stats));
+        // Shared by preprocessor callbacks and the AST consumer; built on first use.
+        auto mainFileIndex = std::unique_ptr<MainFileIndex>(
+            new MainFileIndex(compiler.getSourceManager(), compiler.getLangOpts(), stats));
         auto ppCallbacks = std::unique_ptr<RemoveInactivePreprocessorBlocks>(
             new RemoveInactivePreprocessorBlocks(compiler.getSourceManager(), compiler.getLangOpts(),
-                *smartRewriter, macrosToKeep));
+                *smartRewriter, *mainFileIndex, macrosToKeep, stats));
+        std::unique_ptr<IncludeMinimizer> includeMinimizer;
+        if (minimizeIncludes)
+            includeMinimizer.reset(new IncludeMinimizer(compiler.getSourceManager()));
+        std::unique_ptr<HeaderCostTracker> headerCosts;
+        if (HeaderCosts* costs = HeaderCosts::current()) {
+            headerCosts.reset(new HeaderCostTracker(*costs, compiler.getSourceManager(),
+                &HeaderStats::parseTime));
+        }
         auto consumer = std::unique_ptr<OptimizerConsumer>(
-            new OptimizerConsumer(compiler, std::move(smartRewriter), *ppCallbacks, identifiersToKeep, result));
+            new OptimizerConsumer(compiler, std::move(smartRewriter), std::move(mainFileIndex),
+                *ppCallbacks, includeMinimizer.get(), headerCosts.get(), identifiersToKeep,
+                rootSets, cmdLineOptions, dependencySummaryCache, stats, cancellation, results));
         compiler.getPreprocessor().addPPCallbacks(std::move(ppCallbacks));
+        if (includeMinimizer)
+            compiler.getPreprocessor().addPPCallbacks(std::move(includeMinimizer));
+        if (headerCosts)
+            compiler.getPreprocessor().addPPCallbacks(std::move(headerCosts));
         return consumer;
     }
 };
 
 class OptimizerFrontendActionFactory: public tooling::FrontendActionFactory {
 private:
-    string& result;
+    vector<OptimizerResult>& results;
     const std::set<string>& macrosToKeep;
-    const std::unordered_set<string>& identifiersToKeep;
+    const IdentifierMatcher& identifiersToKeep;
+    const vector<RootSet>& rootSets;
+    bool minimizeIncludes;
+    const vector<string>& cmdLineOptions;
+    const string& dependencySummaryCache;
+    Stats& stats;
+    const Cancellation& cancellation;
 public:
-    OptimizerFrontendActionFactory(string& result_, const std::set<string>& macrosToKeep_,
-            const std::unordered_set<string>& identifiersToKeep_)
-        : result(result_)
+    OptimizerFrontendActionFactory(vector<OptimizerResult>& results_,
+            const std::set<string>& macrosToKeep_, const IdentifierMatcher& identifiersToKeep_,
+            const vector<RootSet>& rootSets_, bool minimizeIncludes_,
+            const vector<string>& cmdLineOptions_, const string& dependencySummaryCache_,
+            Stats& stats_, const Cancellation& cancellation_)
+        : results(results_)
         , macrosToKeep(macrosToKeep_)
         , identifiersToKeep(identifiersToKeep_)
+        , rootSets(rootSets_)
+        , minimizeIncludes(minimizeIncludes_)
+        , cmdLineOptions(cmdLineOptions_)
+        , dependencySummaryCache(dependencySummaryCache_)
+        , stats(stats_)
+        , cancellation(cancellation_)
     {}
 #if CAIDE_CLANG_VERSION_AT_LEAST(10, 0)
     std::unique_ptr<FrontendAction> create() override {
-        return std::make_unique<OptimizerFrontendAction>(result, macrosToKeep, identifiersToKeep);
+        return std::make_unique<OptimizerFrontendAction>(results, macrosToKeep, identifiersToKeep,
+            rootSets, minimizeIncludes, cmdLineOptions, dependencySummaryCache, stats, cancellation);
     }
 #else
     FrontendAction* create() override {
-        return new OptimizerFrontendAction(result, macrosToKeep, identifiersToKeep);
+        return new OptimizerFrontendAction(results, macrosToKeep, identifiersToKeep, rootSets,
+            minimizeIncludes, cmdLineOptions, dependencySummaryCache, stats, cancellation);
     }
 #endif
 };
@@ -317,16 +512,53 @@ private:
     vector<string> errors;
 };
 
+// Checks that the code compiles, without reporting errors.
+static bool compiles(const vector<string>& cmdLineOptions, const string& cppFile, const string& code) {
+    std::unique_ptr<tooling::FixedCompilationDatabase> compilationDatabase(
+        createCompilationDatabaseFromCommandLine(cmdLineOptions));
+
+    // The file is never written to disk.
+    llvm::SmallString<256> checkedFile(cppFile + ".check.cpp");
+    llvm::sys::fs::make_absolute(checkedFile);
+
+    vector<string> sources{string(checkedFile.str())};
+    IgnoringDiagConsumer diagConsumer;
+    clang::tooling::ClangTool tool(*compilationDatabase, sources);
+    tool.mapVirtualFile(checkedFile, code);
+    tool.setDiagnosticConsumer(&diagConsumer);
+    return tool.run(tooling::newFrontendActionFactory<SyntaxOnlyAction>().get()) == 0;
+}
+
 Optimizer::Optimizer(const vector<string>& cmdLineOptions_,
                      const vector<string>& macrosToKeep_,
-                     const std::vector<std::string>& identifiersToKeep_)
+                     const std::vector<std::string>& identifiersToKeep_,
+                     Stats& stats_,
+                     bool minimizeIncludes_,
+                     const Cancellation& cancellation_,
+                     const string& dependencySummaryCache_)
     : cmdLineOptions(cmdLineOptions_)
     , macrosToKeep(macrosToKeep_.begin(), macrosToKeep_.end())
-    , identifiersToKeep(identifiersToKeep_.begin(), identifiersToKeep_.end())
+    , identifiersToKeep(identifiersToKeep_)
+    , stats(stats_)
+    , minimizeIncludes(minimizeIncludes_)
+    , cancellation(cancellation_)
+    , dependencySummaryCache(dependencySummaryCache_)
 {}
 
 string Optimizer::doOptimize(const string& cppFile) {
-    ScopedTimer t("Optimizer::doOptimize");
+    return doOptimize(cppFile, vector<OptimizerRoots>(1)).front();
+}
+
+vector<string> Optimizer::doOptimize(const string& cppFile, const vector<OptimizerRoots>& roots) {
+    ScopedTimer t("Optimizer::doOptimize", &stats.optimizer);
+    if (roots.empty())
+        return {};
+
+    vector<RootSet> rootSets;
+    rootSets.reserve(roots.size());
+    for (const OptimizerRoots& r : roots)
+        rootSets.push_back(RootSet{r.keepMain, IdentifierMatcher(r.identifiersToKeep)});
+
     std::unique_ptr<tooling::FixedCompilationDatabase> compilationDatabase(
         createCompilationDatabaseFromCommandLine(cmdLineOptions));
 
@@ -337,11 +569,13 @@ string Optimizer::doOptimize(const string& cppFile) {
     clang::tooling::ClangTool tool(*compilationDatabase, sources);
     tool.setDiagnosticConsumer(&errors);
 
-    string result;
-    OptimizerFrontendActionFactory factory(result, macrosToKeep, identifiersToKeep);
+    vector<OptimizerResult> results;
+    OptimizerFrontendActionFactory factory(results, macrosToKeep, identifiersToKeep, rootSets,
+        minimizeIncludes, cmdLineOptions, dependencySummaryCache, stats, cancellation);
 
     ScopedTimer t2("Optimizer::tool.run");
     int ret = tool.run(&factory);
+    cancellation.check();
     if (ret != 0) {
         string message = "Inliner failed.";
         if (!errors.getErrors().empty()) {
@@ -354,7 +588,19 @@ string Optimizer::doOptimize(const string& cppFile) {
         throw std::runtime_error(message.c_str());
     }
 
-    return result;
+    vector<string> codes;
+    codes.reserve(results.size());
+    for (OptimizerResult& result : results) {
+        if (!result.codeWithAllIncludes.empty()) {
+            ScopedTimer t3("Optimizer::checkMinimizedIncludes");
+            cancellation.check();
+            if (!compiles(cmdLineOptions, cppFile, result.code))
+                result.code = std::move(result.codeWithAllIncludes);
+        }
+        codes.push_back(std::move(result.code));
+    }
+
+    return codes;
 }
 
 }
@@ -6,29 +6,62 @@
 
 #pragma once
 
+#include "Cancellation.h"
+#include "IdentifierMatcher.h"
+
 #include <vector>
 #include <set>
 #include <string>
-#include <unordered_set>
 
 namespace caide {
+
+struct Stats;
+
 namespace internal {
 
+// Roots of the dependency graph for one output of the optimizer, in addition to declarations
+// marked with a 'caide keep' comment and identifiersToKeep passed to Optimizer constructor.
+struct OptimizerRoots {
+    bool keepMain = true;
+    std::vector<std::string> identifiersToKeep;
+};
+
 // Second inliner stage: remove unused code
 class Optimizer {
 public:
+    // Counters and phase times of doOptimize calls are added to stats.
+    //
+    // If minimizeIncludes is true, only system headers that supply used declarations and
+    // macros are included in the output (see IncludeMinimizer). An output with minimized
+    // includes that doesn't compile is replaced with the one that includes all headers.
+    // doOptimize throws BudgetExceeded if cancellation has a budget and it is exceeded.
+    //
+    // If dependencySummaryCache is not empty, it is the directory of DependencySummaryCache.
     Optimizer(const std::vector<std::string>& cmdLineOptions,
               const std::vector<std::string>& macrosToKeep,
-              const std::vector<std::string>& identifiersToKeep);
+              const std::vector<std::string>& identifiersToKeep,
+              Stats& stats,
+              bool minimizeIncludes = false,
+              const Cancellation& cancellation = Cancellation(),
+              const std::string& dependencySummaryCache = std::string());
 
     // The file is read in binary mode, so the returned string is also
     // 'in binary mode' (contains \r\n on Windows)
     std::string doOptimize(const std::string& cppFile);
 
+    // Same as above, but produces one output for each element of roots. The file is parsed
+    // and the dependency graph is built only once.
+    std::vector<std::string> doOptimize(const std::string& cppFile,
+                                        const std::vector<OptimizerRoots>& roots);
+
 private:
     std::vector<std::string> cmdLineOptions;
     std::set<std::string> macrosToKeep;
-    std::unordered_set<std::string> identifiersToKeep;
+    IdentifierMatcher identifiersToKeep;
+    Stats& stats;
+    bool minimizeIncludes;
+    Cancellation cancellation;
+    std::string dependencySummaryCache;
 };
 
 }
@@ -5,10 +5,12 @@
 // option) any later version. See LICENSE.TXT for details.
 
 #include "sema_utils.h"
+#include "caideInliner.hpp"
 
 // #define CAIDE_DEBUG_MODE
 #include "caide_debug.h"
 #include "clang_version.h"
+#include "MemoryUsage.h"
 #include "Timer.h"
 #include "util.h"
 
@@ -351,5 +353,63 @@ SugaredSignature substituteTemplateArguments(
     return ret;
 }
 
-}}
+TemplateSubstitutionCache::TemplateSubstitutionCache(Sema& sema_, Stats& stats_)
+    : sema(sema_)
+    , stats(stats_)
+{}
+
+static void addArgs(llvm::FoldingSetNodeID& id, const ASTContext& astContext,
+        llvm::ArrayRef<TemplateArgument> args)
+{
+    id.AddInteger(args.size());
+    for (const TemplateArgument& arg : args)
+        arg.Profile(id, astContext);
+}
+
+const SugaredSignature& TemplateSubstitutionCache::substitute(TemplateDecl* templateDecl,
+        llvm::ArrayRef<TemplateArgument> writtenArgs,
+        llvm::ArrayRef<TemplateArgument> args)
+{
+    llvm::FoldingSetNodeID id;
+    id.AddPointer(templateDecl);
+    addArgs(id, sema.getASTContext(), writtenArgs);
+    addArgs(id, sema.getASTContext(), args);
+
+    auto it = results.find(id);
+    if (it == results.end()) {
+        ++stats.templateArgumentSubstitutions;
+        SugaredSignature sig = substituteTemplateArguments(sema, templateDecl, writtenArgs, args);
+        it = results.emplace(std::move(id), std::move(sig)).first;
+    }
+    return it->second;
+}
+
+const SugaredSignature& TemplateSubstitutionCache::substitute(
+        ClassTemplatePartialSpecializationDecl* templateDecl,
+        llvm::ArrayRef<TemplateArgument> args)
+{
+    llvm::FoldingSetNodeID id;
+    id.AddPointer(templateDecl);
+    addArgs(id, sema.getASTContext(), args);
+
+    auto it = results.find(id);
+    if (it == results.end()) {
+        ++stats.templateArgumentSubstitutions;
+        SugaredSignature sig = substituteTemplateArguments(sema, templateDecl, args);
+        it = results.emplace(std::move(id), std::move(sig)).first;
+    }
+    return it->second;
+}
 
+std::uint64_t TemplateSubstitutionCache::getMemorySize() const {
+    std::uint64_t size = getNodeContainerMemory<decltype(results)::value_type>(results.size());
+    for (const auto& entry : results) {
+        const SugaredSignature& sig = entry.second;
+        size += sig.templateArgLocs.capacity() * sizeof(TemplateArgumentLoc)
+            + sig.associatedConstraints.capacity() * sizeof(Expr*)
+            + sig.argTypes.capacity() * sizeof(TypeSourceInfo*);
+    }
+    return size;
+}
+
+}}
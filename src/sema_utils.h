@@ -7,7 +7,10 @@
 #pragma once
 
 #include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/FoldingSet.h>
 
+#include <cstdint>
+#include <map>
 #include <vector>
 
 namespace clang {
@@ -20,7 +23,11 @@ namespace clang {
     class TypeSourceInfo;
 }
 
-namespace caide { namespace internal {
+namespace caide {
+
+struct Stats;
+
+namespace internal {
 
 class SuppressErrorsInScope {
 public:
@@ -55,5 +62,28 @@ SugaredSignature substituteTemplateArguments(
         clang::Sema&, clang::ClassTemplatePartialSpecializationDecl*,
         llvm::ArrayRef<clang::TemplateArgument> args);
 
+// Memoizes results of substituteTemplateArguments(). Substitution goes through Sema and is
+// expensive, while the same specialization is usually referenced from many places.
+class TemplateSubstitutionCache {
+public:
+    TemplateSubstitutionCache(clang::Sema& sema_, Stats& stats_);
+
+    const SugaredSignature& substitute(clang::TemplateDecl*,
+            llvm::ArrayRef<clang::TemplateArgument> writtenArgs,
+            llvm::ArrayRef<clang::TemplateArgument> args);
+
+    const SugaredSignature& substitute(clang::ClassTemplatePartialSpecializationDecl*,
+            llvm::ArrayRef<clang::TemplateArgument> args);
+
+    // Approximate heap footprint of cached results, in bytes.
+    std::uint64_t getMemorySize() const;
+
+private:
+    clang::Sema& sema;
+    Stats& stats;
+    // Key identifies the template and (sugared) template arguments.
+    std::map<llvm::FoldingSetNodeID, SugaredSignature> results;
+};
+
 }}
 
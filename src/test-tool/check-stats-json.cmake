@@ -0,0 +1,39 @@
+# Runs cmd with all statistics on a test case and checks that it prints well-formed JSON
+# with populated counters. Parameters: CMD, CLANG_OPTIONS_FILE, TEMP_DIR, SOURCE.
+
+execute_process(
+    COMMAND "${CMD}" "@${CLANG_OPTIONS_FILE}" -- -d "${TEMP_DIR}" -o "${TEMP_DIR}/stats-json.cpp"
+        -s -H -T -E "${SOURCE}"
+    RESULT_VARIABLE result
+    OUTPUT_VARIABLE output)
+if(NOT result EQUAL 0)
+    message(FATAL_ERROR "cmd failed with ${result}")
+endif()
+
+# Parsing any member parses the whole document.
+string(JSON degraded ERROR_VARIABLE error GET "${output}" degraded)
+if(error)
+    message(FATAL_ERROR "Invalid JSON: ${error}\n${output}")
+endif()
+# The parser accepts trailing commas.
+string(REGEX MATCH ",[ \t\r\n]*[]}]" trailingComma "${output}")
+if(trailingComma)
+    message(FATAL_ERROR "Trailing comma in JSON\n${output}")
+endif()
+if(degraded)
+    message(FATAL_ERROR "Unexpected degraded output\n${output}")
+endif()
+
+foreach(counter bytesIn bytesOut graphNodes graphEdges reachableDecls astNodesVisited)
+    string(JSON value GET "${output}" counters ${counter})
+    if(NOT value GREATER 0)
+        message(FATAL_ERROR "Counter ${counter} is ${value}\n${output}")
+    endif()
+endforeach()
+
+foreach(list headers templates edges)
+    string(JSON length ERROR_VARIABLE error LENGTH "${output}" ${list})
+    if(error OR NOT length GREATER 0)
+        message(FATAL_ERROR "No ${list} are reported\n${output}")
+    endif()
+endforeach()
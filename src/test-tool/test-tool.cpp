@@ -7,8 +7,12 @@
 #include "../caideInliner.hpp"
 
 #include <algorithm>
+#include <cstdint>
+#include <cstdlib>
 #include <fstream>
 #include <iostream>
+#include <map>
+#include <memory>
 #include <sstream>
 #include <stdexcept>
 #include <string>
@@ -36,6 +40,176 @@ static string pathConcat(const string& directory, const string& fileName) {
     return directory + "/" + fileName;
 }
 
+static bool compareWithEtalon(const string& outputFilePath, const string& etalonFilePath) {
+    const vector<string> output = readNonEmptyLines(outputFilePath);
+    const vector<string> etalon = readNonEmptyLines(etalonFilePath);
+
+    const int minLength = (int)std::min(output.size(), etalon.size());
+    for (int i = 0; i < minLength; ++i) {
+        // TODO: Print line numbers
+        if (output[i] != etalon[i]) {
+            std::cout
+                << "< " << etalon[i] << "\n"
+                << "> " << output[i] << "\n";
+            return false;
+        }
+    }
+
+    if (output.size() < etalon.size()) {
+        std::cout << "Unexpected end of file: " << outputFilePath << "\n";
+        return false;
+    }
+
+    if (output.size() > etalon.size()) {
+        std::cout << "Unexpected end of file: " << etalonFilePath << "\n";
+        return false;
+    }
+
+    return true;
+}
+
+// Counters of work that don't depend on the machine or its load, unlike time.
+static std::map<string, std::uint64_t> getWorkCounters(const caide::Stats& stats) {
+    return {
+        {"astNodesVisited", stats.astNodesVisited},
+        {"declsVisited", stats.declsVisited},
+        {"declsVisitedForRemoval", stats.declsVisitedForRemoval},
+        {"graphEdges", stats.graphEdges},
+        {"graphNodes", stats.graphNodes},
+        {"intervalSetOperations", stats.intervalSetOperations},
+        {"lexerCalls", stats.lexerCalls},
+        {"templateArgumentSubstitutions", stats.templateArgumentSubstitutions},
+    };
+}
+
+static bool isEnabled(const char* environmentVariable) {
+    const char* value = std::getenv(environmentVariable);
+    return value && *value == '1';
+}
+
+static bool isUpdatingWorkCounters() {
+    return isEnabled("CAIDE_TEST_UPDATE_COUNTERS");
+}
+
+// Whether the test includes system headers other than its own, e.g. the standard library.
+static bool dependsOnSystemHeaders(const string& testDirectory, const caide::Stats& stats) {
+    for (const caide::HeaderStats& header : stats.headers) {
+        if (header.isSystem && header.path.rfind(testDirectory, 0) != 0)
+            return true;
+    }
+    return false;
+}
+
+// Each line of workCounters.txt is a counter name followed by its expected value. Counters
+// depend somewhat on clang version, hence the tolerance; a pass that has become e.g. quadratic
+// exceeds it. With CAIDE_TEST_UPDATE_COUNTERS=1, the file is written with the current values
+// instead. The file is required, except for tests that depend on system headers: their counters
+// depend on the standard library too much, so the file is not created for them.
+static bool checkWorkCounters(const string& testDirectory, const caide::Stats& stats) {
+    const string filePath = pathConcat(testDirectory, "workCounters.txt");
+    const bool exists = static_cast<bool>(ifstream{filePath.c_str()});
+    const bool isRequired = !dependsOnSystemHeaders(testDirectory, stats);
+    const std::map<string, std::uint64_t> counters = getWorkCounters(stats);
+
+    if (isUpdatingWorkCounters()) {
+        if (!exists && !isRequired) {
+            std::cout << "Work counters are not recorded: the test depends on system headers\n";
+            return true;
+        }
+        std::ofstream os(filePath.c_str());
+        for (const auto& counter : counters)
+            os << counter.first << ' ' << counter.second << '\n';
+        return true;
+    }
+
+    if (!exists) {
+        if (isRequired) {
+            std::cout << "Missing workCounters.txt, record it with CAIDE_TEST_UPDATE_COUNTERS=1\n";
+            return false;
+        }
+        return true;
+    }
+
+    bool ok = true;
+    for (const string& line : readNonEmptyLines(filePath)) {
+        std::istringstream in{line};
+        string name;
+        std::uint64_t expected = 0;
+        if (!(in >> name >> expected))
+            throw std::runtime_error("Invalid line in workCounters.txt: " + line);
+
+        auto it = counters.find(name);
+        if (it == counters.end())
+            throw std::runtime_error("Unknown work counter: " + name);
+
+        const std::uint64_t actual = it->second;
+        const std::uint64_t tolerance = expected / 4 + 10;
+        if (actual > expected + tolerance || actual + tolerance < expected) {
+            std::cout << "Work counter " << name << ": expected " << expected
+                << ", got " << actual << "\n";
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+// Checks the counters that every successful call must populate.
+static bool checkStats(const caide::Stats& stats) {
+    bool ok = true;
+    auto require = [&ok](bool condition, const char* description) {
+        if (!condition) {
+            std::cout << "Stats: " << description << "\n";
+            ok = false;
+        }
+    };
+    require(stats.bytesIn > 0, "bytesIn is zero");
+    require(stats.bytesOut > 0, "bytesOut is zero");
+    require(stats.optimizer.wallTime.count() > 0, "optimizer wall time is zero");
+    if (!stats.degraded)
+        require(stats.reachableDecls > 0, "reachableDecls is zero");
+    if (stats.hasHardwareCounters)
+        require(stats.optimizer.instructions > 0, "optimizer instructions are zero");
+    return ok;
+}
+
+// Each line of variants.txt describes one output: etalon file name, followed by identifiers
+// to keep. Identifier '-main' means that main function is not kept.
+static bool runVariantsTest(const string& testDirectory, const string& tempDirectory,
+        const caide::CppInliner& inliner, const vector<string>& cppFiles,
+        const vector<string>& variants, caide::Stats& stats)
+{
+    vector<caide::RootSpecification> roots;
+    vector<string> etalonFiles;
+    vector<string> outputFiles;
+    for (const string& line : variants) {
+        std::istringstream in{line};
+        string etalonFile;
+        in >> etalonFile;
+        caide::RootSpecification root;
+        string identifier;
+        while (in >> identifier) {
+            if (identifier == "-main")
+                root.keepMain = false;
+            else
+                root.identifiersToKeep.push_back(identifier);
+        }
+        roots.push_back(std::move(root));
+        etalonFiles.push_back(pathConcat(testDirectory, etalonFile));
+        outputFiles.push_back(pathConcat(tempDirectory, "result-" + etalonFile));
+    }
+
+    // Run
+    stats = inliner.inlineCodeVariants(cppFiles, roots, outputFiles);
+
+    // Assert
+    bool ok = true;
+    for (size_t i = 0; i < outputFiles.size(); ++i) {
+        if (!compareWithEtalon(outputFiles[i], etalonFiles[i]))
+            ok = false;
+    }
+    return ok;
+}
+
 static bool runTest(const string& testDirectory, const string& tempDirectory, caide::CppInliner inliner) {
     // Setup
     vector<string> cppFiles = readNonEmptyLines(pathConcat(testDirectory, "fileList.txt"));
@@ -73,38 +247,99 @@ static bool runTest(const string& testDirectory, const string& tempDirectory, ca
     inliner.macrosToKeep = readNonEmptyLines(pathConcat(testDirectory, "macrosToKeep.txt"));
     inliner.identifiersToKeep = readNonEmptyLines(pathConcat(testDirectory, "identifiersToKeep.txt"));
 
-    const string outputFilePath = pathConcat(tempDirectory, "result.cpp");
+    bool cancelFirstCall = false;
+    bool expectDegraded = false;
+    const string memoryBudgetOption = "optimizerMemoryBudget=";
+    for (const string& option : readNonEmptyLines(pathConcat(testDirectory, "inlinerOptions.txt"))) {
+        if (option == "cancelFirstCall")
+            cancelFirstCall = true;
+        else if (option == "expectDegraded")
+            expectDegraded = true;
+        else if (option.rfind(memoryBudgetOption, 0) == 0)
+            inliner.optimizerMemoryBudget = std::stoul(option.substr(memoryBudgetOption.size()));
+        else if (option == "minimizeIncludes")
+            inliner.minimizeIncludes = true;
+        else if (option == "opaqueSystemHeaders")
+            inliner.opaqueSystemHeaders = true;
+        else if (option == "dependencySummaryCache")
+            inliner.dependencySummaryCache = pathConcat(tempDirectory, "dependency-summaries");
+        else
+            throw std::runtime_error("Unknown inliner option: " + option);
+    }
 
-    // Run
-    inliner.inlineCode(cppFiles, outputFilePath);
+    // Summaries must be loaded by the second call of a test that asks for the cache. With
+    // CAIDE_TEST_DEPENDENCY_SUMMARY_CACHE=1, every test runs with a cold and then a warm cache,
+    // but a test may have no summaries to load.
+    const bool requireSummaries = !inliner.dependencySummaryCache.empty();
+    if (isEnabled("CAIDE_TEST_DEPENDENCY_SUMMARY_CACHE"))
+        inliner.dependencySummaryCache = pathConcat(tempDirectory, "dependency-summaries");
 
-    // Assert
-    const string etalonFilePath = pathConcat(testDirectory, "etalon.cpp");
-    const vector<string> output = readNonEmptyLines(outputFilePath);
-    const vector<string> etalon = readNonEmptyLines(etalonFilePath);
+    // Tells whether work counters are required.
+    inliner.headerStats = true;
 
-    const int minLength = (int)std::min(output.size(), etalon.size());
-    for (int i = 0; i < minLength; ++i) {
-        // TODO: Print line numbers
-        if (output[i] != etalon[i]) {
-            std::cout
-                << "< " << etalon[i] << "\n"
-                << "> " << output[i] << "\n";
-            return false;
+    const string warmupFile = pathConcat(testDirectory, "warmup.cpp");
+    if (inliner.opaqueSystemHeaders && ifstream{warmupFile.c_str()}) {
+        // Record system header snapshots in a different context first: they must not be used
+        // by the test if it defines macros before including the same headers.
+        inliner.inlineCode(vector<string>{warmupFile}, pathConcat(tempDirectory, "warmup.cpp"));
+    }
+
+    bool ok = true;
+    if (cancelFirstCall) {
+        // A cancelled call must throw, and the same inliner must work after it. The token is
+        // cancelled before the call, so the call stops at the first file of the first stage;
+        // the result doesn't depend on the clock.
+        auto token = std::make_shared<caide::CancellationToken>();
+        token->cancel();
+        inliner.cancellationToken = token;
+        try {
+            inliner.inlineCode(cppFiles, pathConcat(tempDirectory, "cancelled.cpp"));
+            std::cout << "Cancelled call has succeeded\n";
+            ok = false;
+        } catch (const caide::InliningCancelled&) {
         }
+        inliner.cancellationToken.reset();
     }
 
-    if (output.size() < etalon.size()) {
-        std::cout << "Unexpected end of file: " << outputFilePath << "\n";
-        return false;
+    // The second call must use dependencies or system header snapshots saved by the first one
+    // and give the same result.
+    const int numCalls = !inliner.dependencySummaryCache.empty() || inliner.opaqueSystemHeaders ? 2 : 1;
+    const vector<string> variants = readNonEmptyLines(pathConcat(testDirectory, "variants.txt"));
+    caide::Stats stats;
+    for (int call = 0; call < numCalls; ++call) {
+        if (!variants.empty()) {
+            if (!runVariantsTest(testDirectory, tempDirectory, inliner, cppFiles, variants, stats))
+                ok = false;
+        } else {
+            const string outputFilePath = pathConcat(tempDirectory, "result.cpp");
+
+            // Run
+            stats = inliner.inlineCode(cppFiles, outputFilePath);
+
+            // Assert
+            if (!compareWithEtalon(outputFilePath, pathConcat(testDirectory, "etalon.cpp")))
+                ok = false;
+        }
+
+        if (!checkStats(stats))
+            ok = false;
+
+        if (stats.degraded != expectDegraded) {
+            std::cout << "Stats::degraded is " << stats.degraded << ", expected " << expectDegraded << "\n";
+            ok = false;
+        }
     }
 
-    if (output.size() > etalon.size()) {
-        std::cout << "Unexpected end of file: " << etalonFilePath << "\n";
-        return false;
+    if (requireSummaries && stats.dependencySummariesLoaded == 0) {
+        std::cout << "No dependency summaries have been loaded\n";
+        ok = false;
     }
 
-    return true;
+    // The cache directory persists between test runs, so work done by the first call depends
+    // on previous runs too.
+    if (inliner.dependencySummaryCache.empty() && !checkWorkCounters(testDirectory, stats))
+        ok = false;
+    return ok;
 }
 
 
@@ -127,6 +362,8 @@ int main(int argc, char* argv[]) {
     }
 
     inliner.clangCompilationOptions = readNonEmptyLines(argv[2]);
+    // Checked by checkStats, if available on this machine.
+    inliner.hardwareCounters = true;
 
     int numFailedTests = 0;
     for (int i = 3; i < argc; ++i) {
@@ -9,6 +9,7 @@
 #include "clang_version.h"
 
 #include <clang/AST/ASTContext.h>
+#include <clang/AST/DeclCXX.h>
 #include <clang/AST/Stmt.h>
 #include <clang/Basic/FileManager.h>
 #include <clang/Basic/SourceManager.h>
@@ -270,6 +271,17 @@ SourceRange getExpansionRange(SourceManager& sourceManager, const Decl* decl) {
             getExpansionEnd(sourceManager, decl));
 }
 
-}
+bool isInstantiated(const Decl* decl) {
+    if (const auto* f = dyn_cast<FunctionDecl>(decl))
+        return isTemplateInstantiation(f->getTemplateSpecializationKind());
+    if (const auto* recordDecl = dyn_cast<CXXRecordDecl>(decl))
+        return isTemplateInstantiation(recordDecl->getTemplateSpecializationKind());
+    if (const auto* varDecl = dyn_cast<VarDecl>(decl))
+        return isTemplateInstantiation(varDecl->getTemplateSpecializationKind());
+    if (const auto* enumDecl = dyn_cast<EnumDecl>(decl))
+        return isTemplateInstantiation(enumDecl->getTemplateSpecializationKind());
+    return false;
 }
 
+}
+}
@@ -54,6 +54,9 @@ clang::SourceLocation getExpansionEnd(clang::SourceManager& sourceManager,
 clang::SourceRange getExpansionRange(clang::SourceManager& sourceManager,
         const clang::Decl* decl);
 
+// Whether decl is an implicit or explicit instantiation of a template.
+bool isInstantiated(const clang::Decl* decl);
+
 }
 }
 
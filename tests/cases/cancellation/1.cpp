@@ -0,0 +1,5 @@
+#include "header.h"
+
+int main() {
+    return twice(21);
+}
@@ -0,0 +1,7 @@
+int twice(int x) {
+    return 2 * x;
+}
+
+int main() {
+    return twice(21);
+}
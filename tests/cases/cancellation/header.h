@@ -0,0 +1,7 @@
+int twice(int x) {
+    return 2 * x;
+}
+
+int unused() {
+    return 0;
+}
@@ -0,0 +1,6 @@
+#include "lib.h"
+
+int main() {
+    Point p{3, 4};
+    return sumOfNorms(&p, 1) == 25 ? 0 : 1;
+}
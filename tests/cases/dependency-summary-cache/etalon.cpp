@@ -0,0 +1,22 @@
+inline int square(int x) {
+    return x * x;
+}
+
+struct Point {
+    int x, y;
+    int norm() const {
+        return square(x) + square(y);
+    }
+};
+
+inline int sumOfNorms(const Point* points, int n) {
+    int sum = 0;
+    for (int i = 0; i < n; ++i)
+        sum += points[i].norm();
+    return sum;
+}
+
+int main() {
+    Point p{3, 4};
+    return sumOfNorms(&p, 1) == 25 ? 0 : 1;
+}
@@ -0,0 +1,21 @@
+inline int square(int x) {
+    return x * x;
+}
+
+inline int unusedHelper(int x) {
+    return x + 1;
+}
+
+struct Point {
+    int x, y;
+    int norm() const {
+        return square(x) + square(y);
+    }
+};
+
+inline int sumOfNorms(const Point* points, int n) {
+    int sum = 0;
+    for (int i = 0; i < n; ++i)
+        sum += points[i].norm();
+    return sum;
+}
@@ -0,0 +1,13 @@
+void f1() { }
+void f2() { }
+
+template<typename T>
+struct C {
+    void f() { f1(); }
+    void g() { f2(); }
+};
+
+int main() {
+    C<int> c;
+}
+
@@ -0,0 +1,11 @@
+void f1() { }
+
+template<typename T>
+struct C {
+    void f() { f1(); }
+};
+
+int main() {
+    C<int> c;
+}
+
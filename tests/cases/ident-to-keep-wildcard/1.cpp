@@ -0,0 +1,23 @@
+void f1() { }
+void f2() { }
+void f3() { }
+void f4() { }
+void f5() { }
+
+namespace ns {
+void a() { f1(); }
+void b() { f2(); }
+}
+
+struct S {
+    int operator*() const { f3(); return 0; }
+    bool operator==(const S&) const { f4(); return true; }
+
+    void get1() { f5(); }
+    void get2() { }
+    void g() { }
+};
+
+int main() {
+}
+
@@ -0,0 +1,8 @@
+#include <unused.h>
+#include <all.h>
+#include <macros.h>
+
+int main() {
+    mystd::vector v;
+    return MYSTD_ONE;
+}
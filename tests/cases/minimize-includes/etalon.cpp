@@ -0,0 +1,7 @@
+#include <vec>
+#include <macros.h>
+
+int main() {
+    mystd::vector v;
+    return MYSTD_ONE;
+}
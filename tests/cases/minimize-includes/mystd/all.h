@@ -0,0 +1,2 @@
+#include <vec>
+#include <lst>
@@ -0,0 +1 @@
+#define MYSTD_ONE 1
@@ -0,0 +1,3 @@
+namespace mystd {
+struct unused {};
+}
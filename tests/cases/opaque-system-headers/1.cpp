@@ -0,0 +1,12 @@
+#define CONFIG_NO_CHECKS
+#include <config.h>
+
+#if CONFIG_CHECKS
+#include "checks.h"
+#else
+#include "nochecks.h"
+#endif
+
+int main() {
+    return check(1);
+}
@@ -0,0 +1,3 @@
+int check(int x) {
+    return x > 0 ? 0 : 1;
+}
@@ -0,0 +1,10 @@
+#include <config.h>
+#define CONFIG_NO_CHECKS
+
+int check(int) {
+    return 0;
+}
+
+int main() {
+    return check(1);
+}
@@ -0,0 +1,3 @@
+int check(int) {
+    return 0;
+}
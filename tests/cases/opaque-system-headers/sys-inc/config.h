@@ -0,0 +1,5 @@
+#ifdef CONFIG_NO_CHECKS
+#define CONFIG_CHECKS 0
+#else
+#define CONFIG_CHECKS 1
+#endif
@@ -0,0 +1,4 @@
+#include <config.h>
+
+int main() {
+}
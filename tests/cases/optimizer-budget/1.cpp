@@ -0,0 +1,7 @@
+#include "header.h"
+
+#define UNUSED_MACRO 1
+
+int main() {
+    return twice(21);
+}
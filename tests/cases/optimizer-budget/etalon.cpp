@@ -0,0 +1,13 @@
+int twice(int x) {
+    return 2 * x;
+}
+
+int unused() {
+    return 0;
+}
+
+#define UNUSED_MACRO 1
+
+int main() {
+    return twice(21);
+}
@@ -0,0 +1,8 @@
+#pragma once
+int twice(int x) {
+    return 2 * x;
+}
+
+int unused() {
+    return 0;
+}
@@ -0,0 +1,11 @@
+#define A_VALUE 1
+
+void f1() { }
+void f2() { }
+
+int solveA() { f1(); return A_VALUE; }
+void solveB() { f2(); }
+
+int main() {
+}
+
@@ -0,0 +1,9 @@
+#define A_VALUE 1
+
+void f1() { }
+
+int solveA() { f1(); return A_VALUE; }
+
+int main() {
+}
+
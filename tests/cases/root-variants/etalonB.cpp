@@ -0,0 +1,4 @@
+void f2() { }
+
+void solveB() { f2(); }
+
@@ -0,0 +1,6 @@
+#include "quoted.h"
+#include <angled.h>
+
+int main() {
+    return fromQuotedHeader() + fromAngledHeader();
+}
@@ -0,0 +1,11 @@
+int fromQuotedHeader() {
+    return 1;
+}
+
+int fromAngledHeader() {
+    return 2;
+}
+
+int main() {
+    return fromQuotedHeader() + fromAngledHeader();
+}
@@ -0,0 +1,3 @@
+int fromAngledHeader() {
+    return 2;
+}
@@ -0,0 +1,3 @@
+int fromQuotedHeader() {
+    return 1;
+}
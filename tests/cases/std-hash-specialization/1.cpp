@@ -0,0 +1,23 @@
+#include <unordered_set>
+
+struct Point {
+    int x, y;
+    bool operator==(const Point& other) const { return x == other.x && y == other.y; }
+    bool operator<(const Point& other) const { return x < other.x; }
+};
+
+namespace std {
+template<>
+struct hash<Point> {
+    size_t operator()(const Point& p) const { return p.x * 31 + p.y; }
+};
+}
+
+struct Unused {};
+
+int main() {
+    std::unordered_set<Point> points;
+    points.insert(Point{1, 2});
+    return (int)points.size();
+}
+
@@ -0,0 +1,20 @@
+#include <unordered_set>
+
+struct Point {
+    int x, y;
+    bool operator==(const Point& other) const { return x == other.x && y == other.y; }
+};
+
+namespace std {
+template<>
+struct hash<Point> {
+    size_t operator()(const Point& p) const { return p.x * 31 + p.y; }
+};
+}
+
+int main() {
+    std::unordered_set<Point> points;
+    points.insert(Point{1, 2});
+    return (int)points.size();
+}
+